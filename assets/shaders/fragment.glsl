@@ -8,15 +8,41 @@ out vec4 FragColor;
 
 in vec3 frag_normal;
 in vec3 fragPos;
-in vec4 frag_pos_light_space;
 
-uniform sampler2D shadow_map;
+#define MAX_CASCADES 4
+
+// Offsets of the PCF taps, in texels. Each tap is a bilinear compare
+// done by the hardware, so few of them are enough.
+#define MAX_SHADOW_TAPS 8
+const vec2 poisson_disk[MAX_SHADOW_TAPS] = vec2[](
+	vec2(-0.94201624, -0.39906216),
+	vec2( 0.94558609, -0.76890725),
+	vec2(-0.09418410, -0.92938870),
+	vec2( 0.34495938,  0.29387760),
+	vec2(-0.91588581,  0.45771432),
+	vec2(-0.81544232, -0.87912464),
+	vec2(-0.38277543,  0.27676845),
+	vec2( 0.97484398,  0.75648379)
+);
+
+uniform sampler2DArrayShadow shadow_map;
+uniform int   shadow_taps;   // How many entries of poisson_disk to use
+uniform float shadow_radius; // Scale of the kernel, in texels
+uniform mat4  light_space_matrices[MAX_CASCADES];
+uniform float cascade_splits[MAX_CASCADES]; // Distance from the camera where each cascade ends
+uniform int   num_cascades;
+uniform mat4  view;
 uniform vec3 viewPos;
 
-uniform float perceptualRoughness; //  [0, 1]
-uniform float metallic; // [0, 1]
-uniform float reflectance; // [0, 1]
-uniform vec3  baseColor;
+// Per-object data, written once per frame to the stream buffer
+layout (std140) uniform Object {
+	mat4  model;
+	mat4  norm;
+	vec3  baseColor;
+	float perceptualRoughness; //  [0, 1]
+	float metallic; // [0, 1]
+	float reflectance; // [0, 1]
+};
 
 uniform vec3 lightDir;
 uniform vec3 lightColor;
@@ -26,7 +52,7 @@ uniform samplerCube irradianceMap;
 uniform samplerCube prefilterMap;
 uniform sampler2D   brdfLUT;  
 
-float shadow_factor(vec4 frag_pos_light_space);
+float shadow_factor(vec3 world_pos, float NoL);
 
 float distribGGX(float NoH, float a) {
 	float a2 = a * a;
@@ -71,7 +97,7 @@ void main()
 
 	vec3 color = vec3(0);
 
-	float shadow = shadow_factor(frag_pos_light_space);
+	float shadow = shadow_factor(fragPos, NoL);
 
 	// Direct lighting
 	{
@@ -115,23 +141,42 @@ void main()
 	FragColor = vec4(color, 1.0);
 }
 
-float shadow_factor(vec4 frag_pos_light_space)
+float shadow_factor(vec3 world_pos, float NoL)
 {
+	// Pick the first cascade whose slice contains the fragment
+	float depth = -(view * vec4(world_pos, 1.0)).z;
+	int cascade = 0;
+	while (cascade < num_cascades && depth > cascade_splits[cascade])
+		cascade++;
+	if (cascade == num_cascades)
+		return 0.0; // Beyond the shadow distance
+
+	vec4 frag_pos_light_space = light_space_matrices[cascade] * vec4(world_pos, 1.0);
 	vec3 proj_coords = frag_pos_light_space.xyz / frag_pos_light_space.w;
 	proj_coords = proj_coords * 0.5 + 0.5;
 
-	float closest_depth = texture(shadow_map, proj_coords.xy).r;
 	float current_depth = proj_coords.z;
+	if (current_depth > 1.0)
+		return 0.0;
+
+	// Slope-scaled bias: surfaces at grazing angles with the light
+	// need a larger offset to avoid acne
+	float tan_theta = sqrt(1.0 - NoL * NoL) / max(NoL, 0.01);
+	float bias = clamp(0.002 * tan_theta, 0.002, 0.01);
+
+	// Rotate the kernel per pixel to trade banding for noise
+	float noise = fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+	float angle = 2.0 * PI * noise;
+	mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+
+	vec2 delta = shadow_radius / textureSize(shadow_map, 0).xy;
+
+	// The compare returns the fraction of the bilinear footprint that is lit
+	float lit = 0;
+	for (int i = 0; i < shadow_taps; i++) {
+		vec2 offset = rotation * poisson_disk[i] * delta;
+		lit += texture(shadow_map, vec4(proj_coords.xy + offset, cascade, current_depth - bias));
+	}
 
-	float bias = 0.005;
-	float shadow = 0;
-	vec2 delta = 1.0 / textureSize(shadow_map, 0);
-	for (int i = -1; i < 2; i++)
-		for (int j = -1; j < 2; j++) {
-			float closest_depth = texture(shadow_map, proj_coords.xy + vec2(i, j) * delta).r;
-			shadow += (current_depth - bias > closest_depth) ? 1.0 : 0.0;
-		}
-
-	shadow /= 9;
-	return shadow;
+	return 1.0 - lit / shadow_taps;
 }
\ No newline at end of file
@@ -0,0 +1,15 @@
+#version 330 core
+
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec4 aColor;
+
+uniform vec2 screen_size;
+
+out vec4 Color;
+
+void main()
+{
+	// Pixel coordinates with the origin at the top-left corner
+	Color = aColor;
+	gl_Position = vec4(aPos / screen_size * vec2(2.0, -2.0) + vec2(-1.0, 1.0), 0.0, 1.0);
+}
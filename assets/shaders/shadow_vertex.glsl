@@ -2,7 +2,16 @@
 layout (location = 0) in vec3 aPos;
 
 uniform mat4 light_space_matrix;
-uniform mat4 model;
+
+// Per-object data, written once per frame to the stream buffer
+layout (std140) uniform Object {
+	mat4  model;
+	mat4  norm;
+	vec3  baseColor;
+	float perceptualRoughness; //  [0, 1]
+	float metallic; // [0, 1]
+	float reflectance; // [0, 1]
+};
 
 void main()
 {
@@ -20,6 +20,21 @@ Vector3 get_camera_pos(void)
 	return camera_pos;
 }
 
+Vector3 get_camera_front(void)
+{
+	return camera_front;
+}
+
+void set_camera(Vector3 pos, Vector3 target)
+{
+	camera_pos = pos;
+	camera_front = normalize(combine(target, pos, 1, -1));
+
+	// Keep the angles in sync so that mouse rotation continues from here
+	pitch = rad2deg(asinf(camera_front.y));
+	yaw   = rad2deg(atan2f(camera_front.z, camera_front.x));
+}
+
 void rotate_camera(double mouse_x, double mouse_y)
 {
 	float x = mouse_x;
@@ -7,4 +7,6 @@ typedef enum {
 Matrix4 camera_pov(void);
 void move_camera(Direction dir, float speed);
 void rotate_camera(double mouse_x, double mouse_y);
-Vector3 get_camera_pos(void);
\ No newline at end of file
+void set_camera(Vector3 pos, Vector3 target);
+Vector3 get_camera_pos(void);
+Vector3 get_camera_front(void);
\ No newline at end of file
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "image.h"
+#include "profiler.h"
+#include "encoder.h"
+
+// Bounds the memory used by frames waiting to be encoded
+#define ENCODER_QUEUE_SIZE 16
+#define MAX_ENCODER_THREADS 32
+
+struct VideoFile {
+	FILE       *stream;
+	VideoFormat format;
+	int         width;
+	int         height;
+	int         queued;  // Frames handed to the encoder
+	int         written; // Frames written (or dropped) so far
+	bool        failed;
+	pthread_mutex_t mutex;
+	pthread_cond_t  frame_done;
+};
+
+typedef struct {
+	char *file;            // Set for single images
+	VideoFile *video;      // Set for video frames
+	int   frame;           // Position of the frame in the video
+	unsigned char *pixels;
+	int width;
+	int height;
+} EncodeJob;
+
+static EncodeJob queue[ENCODER_QUEUE_SIZE];
+static int queue_head;
+static int queue_count;
+static bool stopping;
+static bool failed;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  not_full  = PTHREAD_COND_INITIALIZER;
+
+static pthread_t threads[MAX_ENCODER_THREADS];
+static int num_threads_;
+
+// Converts RGB to 8-bit YCbCr with full range BT.601 coefficients, as
+// implied by the C420jpeg tag. Chroma is averaged over 2x2 blocks.
+static unsigned char *rgb_to_yuv420(const unsigned char *rgb, int w, int h, size_t *size)
+{
+	int cw = (w + 1) / 2;
+	int ch = (h + 1) / 2;
+	*size = (size_t) w * h + 2 * (size_t) cw * ch;
+
+	unsigned char *yuv = malloc(*size);
+	if (yuv == NULL)
+		return NULL;
+
+	unsigned char *y_plane = yuv;
+	unsigned char *u_plane = yuv + (size_t) w * h;
+	unsigned char *v_plane = u_plane + (size_t) cw * ch;
+
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++) {
+			const unsigned char *p = rgb + 3 * ((size_t) y * w + x);
+			y_plane[(size_t) y * w + x] = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+		}
+
+	for (int y = 0; y < ch; y++)
+		for (int x = 0; x < cw; x++) {
+			int r = 0, g = 0, b = 0, n = 0;
+			for (int dy = 0; dy < 2 && 2*y+dy < h; dy++)
+				for (int dx = 0; dx < 2 && 2*x+dx < w; dx++) {
+					const unsigned char *p = rgb + 3 * ((size_t) (2*y+dy) * w + 2*x+dx);
+					r += p[0];
+					g += p[1];
+					b += p[2];
+					n++;
+				}
+			r /= n;
+			g /= n;
+			b /= n;
+			u_plane[(size_t) y * cw + x] = (-43 * r -  85 * g + 128 * b + 128 * 256 + 128) >> 8;
+			v_plane[(size_t) y * cw + x] = (128 * r - 107 * g -  21 * b + 128 * 256 + 128) >> 8;
+		}
+
+	return yuv;
+}
+
+static void encode_frame(EncodeJob job)
+{
+	VideoFile *video = job.video;
+
+	unsigned char *data = job.pixels;
+	size_t size = (size_t) job.width * job.height * 3;
+	bool ok = true;
+
+	if (job.width != video->width || job.height != video->height) {
+		fprintf(stderr, "Dropping video frame of size %dx%d (expected %dx%d)\n",
+			job.width, job.height, video->width, video->height);
+		data = NULL;
+	} else if (video->format == VIDEO_Y4M) {
+		data = rgb_to_yuv420(job.pixels, job.width, job.height, &size);
+		if (data == NULL)
+			ok = false;
+	}
+
+	pthread_mutex_lock(&video->mutex);
+	while (video->written != job.frame)
+		pthread_cond_wait(&video->frame_done, &video->mutex);
+
+	if (data) {
+		if (video->format == VIDEO_Y4M)
+			fputs("FRAME\n", video->stream);
+		fwrite(data, 1, size, video->stream);
+		if (ferror(video->stream))
+			ok = false;
+	}
+	if (!ok)
+		video->failed = true;
+
+	video->written++;
+	pthread_cond_broadcast(&video->frame_done);
+	pthread_mutex_unlock(&video->mutex);
+
+	if (data != job.pixels)
+		free(data);
+}
+
+static void *encoder_thread(void *arg)
+{
+	(void) arg;
+	if (profiler_enabled)
+		profile_thread_name("encoder");
+
+	for (;;) {
+		pthread_mutex_lock(&mutex);
+		while (queue_count == 0 && !stopping)
+			pthread_cond_wait(&not_empty, &mutex);
+		if (queue_count == 0) {
+			pthread_mutex_unlock(&mutex);
+			break;
+		}
+		EncodeJob job = queue[queue_head];
+		queue_head = (queue_head + 1) % ENCODER_QUEUE_SIZE;
+		queue_count--;
+		pthread_cond_signal(&not_full);
+		pthread_mutex_unlock(&mutex);
+
+		if (job.video) {
+			PROFILE_BEGIN("encode video frame");
+			encode_frame(job);
+			free(job.pixels);
+			PROFILE_END();
+			continue;
+		}
+
+		PROFILE_BEGIN("encode image");
+		bool ok = save_image(job.file, job.pixels, job.width, job.height);
+		PROFILE_END();
+		if (!ok)
+			fprintf(stderr, "Couldn't write '%s'\n", job.file);
+
+		free(job.file);
+		free(job.pixels);
+
+		if (!ok) {
+			pthread_mutex_lock(&mutex);
+			failed = true;
+			pthread_mutex_unlock(&mutex);
+		}
+	}
+
+	// The threads end with free_encoder
+	profile_thread_exit();
+	return NULL;
+}
+
+bool init_encoder(int num_threads)
+{
+	if (num_threads < 1) num_threads = 1;
+	if (num_threads > MAX_ENCODER_THREADS) num_threads = MAX_ENCODER_THREADS;
+
+	queue_head = 0;
+	queue_count = 0;
+	stopping = false;
+	failed = false;
+
+	num_threads_ = 0;
+	for (int i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, encoder_thread, NULL))
+			break;
+		num_threads_++;
+	}
+	if (num_threads_ == 0) {
+		fprintf(stderr, "Couldn't start encoder threads\n");
+		return false;
+	}
+	return true;
+}
+
+bool free_encoder(void)
+{
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&not_empty);
+	pthread_mutex_unlock(&mutex);
+
+	for (int i = 0; i < num_threads_; i++)
+		pthread_join(threads[i], NULL);
+	num_threads_ = 0;
+
+	return !failed;
+}
+
+static void push_job(EncodeJob job)
+{
+	pthread_mutex_lock(&mutex);
+	while (queue_count == ENCODER_QUEUE_SIZE)
+		pthread_cond_wait(&not_full, &mutex);
+	int tail = (queue_head + queue_count) % ENCODER_QUEUE_SIZE;
+	queue[tail] = job;
+	queue_count++;
+	pthread_cond_signal(&not_empty);
+	pthread_mutex_unlock(&mutex);
+}
+
+void encode_image(const char *file, unsigned char *pixels, int width, int height)
+{
+	size_t len = strlen(file);
+	char *copy = malloc(len + 1);
+	if (copy == NULL) {
+		free(pixels);
+		pthread_mutex_lock(&mutex);
+		failed = true;
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+	memcpy(copy, file, len + 1);
+
+	push_job((EncodeJob) {.file=copy, .pixels=pixels, .width=width, .height=height});
+}
+
+VideoFile *open_video(const char *file, VideoFormat format, int width, int height, int fps)
+{
+	VideoFile *video = malloc(sizeof(VideoFile));
+	if (video == NULL)
+		return NULL;
+
+	video->stream = fopen(file, "wb");
+	if (video->stream == NULL) {
+		fprintf(stderr, "Couldn't open '%s'\n", file);
+		free(video);
+		return NULL;
+	}
+	video->format  = format;
+	video->width   = width;
+	video->height  = height;
+	video->queued  = 0;
+	video->written = 0;
+	video->failed  = false;
+	pthread_mutex_init(&video->mutex, NULL);
+	pthread_cond_init(&video->frame_done, NULL);
+
+	if (format == VIDEO_Y4M)
+		fprintf(video->stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+
+	return video;
+}
+
+bool close_video(VideoFile *video)
+{
+	pthread_mutex_lock(&video->mutex);
+	while (video->written != video->queued)
+		pthread_cond_wait(&video->frame_done, &video->mutex);
+	pthread_mutex_unlock(&video->mutex);
+
+	bool ok = !video->failed;
+	if (fclose(video->stream))
+		ok = false;
+
+	pthread_mutex_destroy(&video->mutex);
+	pthread_cond_destroy(&video->frame_done);
+	free(video);
+	return ok;
+}
+
+void encode_video_frame(VideoFile *video, unsigned char *pixels, int width, int height)
+{
+	// Only the thread that queues frames touches "queued", so the
+	// frame number doesn't need the lock
+	int frame = video->queued;
+
+	pthread_mutex_lock(&video->mutex);
+	video->queued++;
+	pthread_mutex_unlock(&video->mutex);
+
+	push_job((EncodeJob) {.video=video, .frame=frame, .pixels=pixels, .width=width, .height=height});
+}
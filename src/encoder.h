@@ -0,0 +1,41 @@
+#ifndef ENCODER_INCLUDED
+#define ENCODER_INCLUDED
+
+#include <stdbool.h>
+
+// Pool of threads that compress and write images in the background, so
+// that rendering the next frame overlaps with encoding the previous ones.
+// The format is chosen from the extension of the file (see save_image).
+
+bool init_encoder(int num_threads);
+
+// Finishes the queued images and stops the threads. Returns false if
+// any image couldn't be written.
+bool free_encoder(void);
+
+// Queues "pixels" (RGB rows, top to bottom) to be saved to "file". The
+// encoder takes ownership of the buffer, which must come from malloc.
+// Blocks if too many images are already waiting.
+void encode_image(const char *file, unsigned char *pixels, int width, int height);
+
+// Video files hold a sequence of frames of the same size. Frames are
+// converted in parallel but always written in the order they were
+// queued.
+typedef enum {
+	VIDEO_RAW, // Concatenated RGB frames
+	VIDEO_Y4M, // YUV4MPEG2 with 4:2:0 chroma, readable by ffmpeg and most players
+} VideoFormat;
+
+typedef struct VideoFile VideoFile;
+
+VideoFile *open_video(const char *file, VideoFormat format, int width, int height, int fps);
+
+// Waits for the queued frames to be written. Returns false if any of
+// them couldn't be.
+bool close_video(VideoFile *video);
+
+// Same ownership rules of encode_image. Frames of the wrong size are
+// dropped.
+void encode_video_frame(VideoFile *video, unsigned char *pixels, int width, int height);
+
+#endif
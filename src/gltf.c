@@ -0,0 +1,700 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gltf.h"
+
+#define GLB_HEADER_SIZE 12
+#define GLB_CHUNK_JSON  0x4E4F534Au
+#define GLB_CHUNK_BIN   0x004E4942u
+
+#define GLTF_BYTE           5120
+#define GLTF_UNSIGNED_BYTE  5121
+#define GLTF_SHORT          5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT   5125
+#define GLTF_FLOAT          5126
+
+#define GLTF_TRIANGLES 4
+
+// Deeper JSON or node hierarchies are rejected
+#define GLTF_MAX_DEPTH 64
+
+/*
+ * JSON
+ *
+ * The document is turned into a flat array of tokens in document
+ * order. Each token knows where its subtree ends, so lookups walk the
+ * direct children only. Strings are compared as they appear in the
+ * file, escapes included, which is enough for the keys and enums of
+ * glTF.
+ */
+
+typedef enum {
+	JSON_OBJECT,
+	JSON_ARRAY,
+	JSON_STRING,
+	JSON_PRIMITIVE, // Numbers, booleans and null
+} JSONType;
+
+typedef struct {
+	JSONType type;
+	int start; // Without the quotes, for strings
+	int end;
+	int size;  // Number of members or elements
+	int next;  // First token after the subtree
+} JSONToken;
+
+typedef struct {
+	const char *src;
+	int         len;
+	int         cur;
+	JSONToken  *tokens;
+	int         num_tokens;
+	int         cap_tokens;
+} JSON;
+
+static int push_token(JSON *json, JSONType type, int start)
+{
+	if (json->num_tokens == json->cap_tokens) {
+		json->cap_tokens = json->cap_tokens ? 2 * json->cap_tokens : 256;
+		json->tokens = realloc(json->tokens, json->cap_tokens * sizeof(JSONToken));
+		if (json->tokens == NULL) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+	}
+	json->tokens[json->num_tokens] = (JSONToken) {.type = type, .start = start};
+	return json->num_tokens++;
+}
+
+static void skip_space(JSON *json)
+{
+	while (json->cur < json->len && strchr(" \t\r\n", json->src[json->cur]))
+		json->cur++;
+}
+
+static bool parse_json_value(JSON *json, int depth);
+
+static bool parse_json_string(JSON *json)
+{
+	json->cur++; // Opening quote
+	int t = push_token(json, JSON_STRING, json->cur);
+	while (json->cur < json->len && json->src[json->cur] != '"') {
+		if (json->src[json->cur] == '\\')
+			json->cur++;
+		json->cur++;
+	}
+	if (json->cur >= json->len)
+		return false;
+	json->tokens[t].end = json->cur++;
+	json->tokens[t].next = json->num_tokens;
+	return true;
+}
+
+static bool parse_json_container(JSON *json, int depth)
+{
+	char open = json->src[json->cur++];
+	char close = open == '{' ? '}' : ']';
+	int t = push_token(json, open == '{' ? JSON_OBJECT : JSON_ARRAY, json->cur - 1);
+
+	skip_space(json);
+	if (json->cur < json->len && json->src[json->cur] == close) {
+		json->cur++;
+	} else {
+		for (;;) {
+			if (open == '{') {
+				skip_space(json);
+				if (json->cur >= json->len || json->src[json->cur] != '"' || !parse_json_string(json))
+					return false;
+				skip_space(json);
+				if (json->cur >= json->len || json->src[json->cur] != ':')
+					return false;
+				json->cur++;
+			}
+			if (!parse_json_value(json, depth + 1))
+				return false;
+			json->tokens[t].size++;
+
+			skip_space(json);
+			if (json->cur >= json->len)
+				return false;
+			char c = json->src[json->cur++];
+			if (c == close)
+				break;
+			if (c != ',')
+				return false;
+		}
+	}
+
+	json->tokens[t].end = json->cur;
+	json->tokens[t].next = json->num_tokens;
+	return true;
+}
+
+static bool parse_json_value(JSON *json, int depth)
+{
+	if (depth > GLTF_MAX_DEPTH)
+		return false;
+
+	skip_space(json);
+	if (json->cur >= json->len)
+		return false;
+
+	char c = json->src[json->cur];
+	if (c == '{' || c == '[')
+		return parse_json_container(json, depth);
+	if (c == '"')
+		return parse_json_string(json);
+
+	int t = push_token(json, JSON_PRIMITIVE, json->cur);
+	while (json->cur < json->len && !strchr(",]} \t\r\n", json->src[json->cur]))
+		json->cur++;
+	if (json->cur == json->tokens[t].start)
+		return false;
+	json->tokens[t].end = json->cur;
+	json->tokens[t].next = json->num_tokens;
+	return true;
+}
+
+// Returns the value of "key" in "object", or -1
+static int json_find(JSON *json, int object, const char *key)
+{
+	if (object < 0 || json->tokens[object].type != JSON_OBJECT)
+		return -1;
+	size_t len = strlen(key);
+	int t = object + 1;
+	for (int i = 0; i < json->tokens[object].size; i++) {
+		JSONToken k = json->tokens[t];
+		if ((size_t) (k.end - k.start) == len && !memcmp(json->src + k.start, key, len))
+			return t + 1;
+		t = json->tokens[t + 1].next;
+	}
+	return -1;
+}
+
+// Returns the element "index" of "array", or -1
+static int json_index(JSON *json, int array, int index)
+{
+	if (array < 0 || json->tokens[array].type != JSON_ARRAY)
+		return -1;
+	if (index < 0 || index >= json->tokens[array].size)
+		return -1;
+	int t = array + 1;
+	for (int i = 0; i < index; i++)
+		t = json->tokens[t].next;
+	return t;
+}
+
+static int json_size(JSON *json, int array)
+{
+	if (array < 0 || json->tokens[array].type != JSON_ARRAY)
+		return 0;
+	return json->tokens[array].size;
+}
+
+static bool json_equals(JSON *json, int t, const char *str)
+{
+	if (t < 0 || json->tokens[t].type != JSON_STRING)
+		return false;
+	size_t len = strlen(str);
+	JSONToken k = json->tokens[t];
+	return (size_t) (k.end - k.start) == len && !memcmp(json->src + k.start, str, len);
+}
+
+static double json_number(JSON *json, int t, double fallback)
+{
+	if (t < 0 || json->tokens[t].type != JSON_PRIMITIVE)
+		return fallback;
+
+	char buf[64];
+	int len = json->tokens[t].end - json->tokens[t].start;
+	if (len >= (int) sizeof(buf))
+		return fallback;
+	memcpy(buf, json->src + json->tokens[t].start, len);
+	buf[len] = '\0';
+
+	char *end;
+	double value = strtod(buf, &end);
+	return end == buf ? fallback : value;
+}
+
+static int json_int(JSON *json, int t, int fallback)
+{
+	double value = json_number(json, t, fallback);
+	if (value < INT32_MIN || value > INT32_MAX)
+		return fallback;
+	return (int) value;
+}
+
+static bool json_bool(JSON *json, int t, bool fallback)
+{
+	if (t < 0 || json->tokens[t].type != JSON_PRIMITIVE)
+		return fallback;
+	JSONToken k = json->tokens[t];
+	if (k.end - k.start == 4 && !memcmp(json->src + k.start, "true", 4))
+		return true;
+	if (k.end - k.start == 5 && !memcmp(json->src + k.start, "false", 5))
+		return false;
+	return fallback;
+}
+
+/*
+ * Accessors
+ */
+
+typedef struct {
+	JSON        json;
+	int         root;
+	const char *bin;
+	size_t      bin_size;
+	MeshData   *result;
+	int         cap_vertices;
+	int         cap_indices;
+} GLB;
+
+typedef struct {
+	const unsigned char *data;
+	size_t stride;
+	int    count;
+	int    components;
+	int    component_type;
+	bool   normalized;
+} Accessor;
+
+static int component_size(int type)
+{
+	switch (type) {
+		case GLTF_BYTE:
+		case GLTF_UNSIGNED_BYTE:  return 1;
+		case GLTF_SHORT:
+		case GLTF_UNSIGNED_SHORT: return 2;
+		case GLTF_UNSIGNED_INT:
+		case GLTF_FLOAT:          return 4;
+	}
+	return 0;
+}
+
+static int type_components(JSON *json, int t)
+{
+	if (json_equals(json, t, "SCALAR")) return 1;
+	if (json_equals(json, t, "VEC2"))   return 2;
+	if (json_equals(json, t, "VEC3"))   return 3;
+	if (json_equals(json, t, "VEC4"))   return 4;
+	return 0;
+}
+
+// Resolves an accessor to the bytes of the binary chunk it reads
+static bool get_accessor(GLB *glb, int index, Accessor *result)
+{
+	JSON *json = &glb->json;
+
+	int accessor = json_index(json, json_find(json, glb->root, "accessors"), index);
+	if (accessor < 0)
+		return false;
+
+	// Accessors without a buffer view are all zeros, which is of no use
+	// for any attribute read here
+	int view = json_index(json, json_find(json, glb->root, "bufferViews"),
+		json_int(json, json_find(json, accessor, "bufferView"), -1));
+	if (view < 0)
+		return false;
+
+	if (json_int(json, json_find(json, view, "buffer"), -1) != 0 || glb->bin == NULL)
+		return false;
+
+	double view_offset = json_number(json, json_find(json, view, "byteOffset"), 0);
+	double view_length = json_number(json, json_find(json, view, "byteLength"), -1);
+	double offset      = json_number(json, json_find(json, accessor, "byteOffset"), 0);
+	if (view_offset < 0 || view_length < 0 || offset < 0 || view_offset + view_length > glb->bin_size)
+		return false;
+
+	result->count          = json_int(json, json_find(json, accessor, "count"), -1);
+	result->components     = type_components(json, json_find(json, accessor, "type"));
+	result->component_type = json_int(json, json_find(json, accessor, "componentType"), 0);
+	result->normalized     = json_bool(json, json_find(json, accessor, "normalized"), false);
+
+	size_t element_size = result->components * component_size(result->component_type);
+	if (result->count < 0 || element_size == 0)
+		return false;
+
+	double stride = json_number(json, json_find(json, view, "byteStride"), element_size);
+	if (stride < element_size)
+		return false;
+	result->stride = stride;
+
+	if (result->count > 0 && offset + (result->count - 1) * stride + element_size > view_length)
+		return false;
+
+	result->data = (const unsigned char*) glb->bin + (size_t) view_offset + (size_t) offset;
+	return true;
+}
+
+static float read_component(const unsigned char *src, int type, bool normalized)
+{
+	switch (type) {
+		case GLTF_FLOAT: {
+			float f;
+			memcpy(&f, src, sizeof(f));
+			return f;
+		}
+		case GLTF_BYTE: {
+			int8_t v = *(const int8_t*) src;
+			return normalized ? fmaxf(v / 127.0f, -1) : v;
+		}
+		case GLTF_UNSIGNED_BYTE: {
+			uint8_t v = *src;
+			return normalized ? v / 255.0f : v;
+		}
+		case GLTF_SHORT: {
+			int16_t v;
+			memcpy(&v, src, sizeof(v));
+			return normalized ? fmaxf(v / 32767.0f, -1) : v;
+		}
+		case GLTF_UNSIGNED_SHORT: {
+			uint16_t v;
+			memcpy(&v, src, sizeof(v));
+			return normalized ? v / 65535.0f : v;
+		}
+		case GLTF_UNSIGNED_INT: {
+			uint32_t v;
+			memcpy(&v, src, sizeof(v));
+			return v;
+		}
+	}
+	return 0;
+}
+
+// Reads up to "n" components of element "i", the others are left alone
+static void read_element(Accessor a, int i, float *dst, int n)
+{
+	const unsigned char *src = a.data + (size_t) i * a.stride;
+	int size = component_size(a.component_type);
+	for (int k = 0; k < n && k < a.components; k++)
+		dst[k] = read_component(src + k * size, a.component_type, a.normalized);
+}
+
+static uint32_t read_index(Accessor a, int i)
+{
+	const unsigned char *src = a.data + (size_t) i * a.stride;
+	switch (a.component_type) {
+		case GLTF_UNSIGNED_BYTE:
+			return *src;
+		case GLTF_UNSIGNED_SHORT: {
+			uint16_t v;
+			memcpy(&v, src, sizeof(v));
+			return v;
+		}
+		default: {
+			uint32_t v;
+			memcpy(&v, src, sizeof(v));
+			return v;
+		}
+	}
+}
+
+/*
+ * Scene
+ */
+
+static void reserve_output(GLB *glb, int num_vertices, int num_indices)
+{
+	MeshData *result = glb->result;
+
+	int need = result->vertices.size + num_vertices;
+	if (need > glb->cap_vertices) {
+		glb->cap_vertices = need > 2 * glb->cap_vertices ? need : 2 * glb->cap_vertices;
+		result->vertices.data = realloc(result->vertices.data, glb->cap_vertices * sizeof(Vertex));
+		result->vertices.capacity = glb->cap_vertices;
+	}
+
+	need = result->num_indices + num_indices;
+	if (need > glb->cap_indices) {
+		glb->cap_indices = need > 2 * glb->cap_indices ? need : 2 * glb->cap_indices;
+		result->indices = realloc(result->indices, glb->cap_indices * sizeof(uint32_t));
+	}
+
+	if ((glb->cap_vertices && !result->vertices.data) || (glb->cap_indices && !result->indices)) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+}
+
+static Vector3 transform_point(Matrix4 m, Vector3 p)
+{
+	Vector4 r = rdotv(m, (Vector4) {p.x, p.y, p.z, 1});
+	return (Vector3) {r.x, r.y, r.z};
+}
+
+static Vector3 transform_normal(Matrix4 m, Vector3 n)
+{
+	Vector4 r = rdotv(m, (Vector4) {n.x, n.y, n.z, 0});
+	Vector3 v = {r.x, r.y, r.z};
+	return norm2_of(v) > 0 ? normalize(v) : v;
+}
+
+static void read_material(GLB *glb, int index)
+{
+	JSON *json = &glb->json;
+	MeshMaterial *mat = &glb->result->material;
+
+	int material = json_index(json, json_find(json, glb->root, "materials"), index);
+	if (material < 0)
+		return;
+
+	int pbr = json_find(json, material, "pbrMetallicRoughness");
+	int color = json_find(json, pbr, "baseColorFactor");
+
+	mat->present = true;
+	for (int i = 0; i < 3; i++)
+		mat->base_color[i] = json_number(json, json_index(json, color, i), 1);
+	mat->metallic  = json_number(json, json_find(json, pbr, "metallicFactor"), 1);
+	mat->roughness = json_number(json, json_find(json, pbr, "roughnessFactor"), 1);
+}
+
+static bool add_primitive(GLB *glb, int primitive, Matrix4 model, Matrix4 normal)
+{
+	JSON *json = &glb->json;
+	MeshData *result = glb->result;
+
+	if (json_int(json, json_find(json, primitive, "mode"), GLTF_TRIANGLES) != GLTF_TRIANGLES)
+		return true;
+
+	int attributes = json_find(json, primitive, "attributes");
+
+	Accessor positions, normals, texcoords, indices;
+	if (!get_accessor(glb, json_int(json, json_find(json, attributes, "POSITION"), -1), &positions)
+		|| positions.components != 3)
+		return false;
+
+	bool has_normals   = get_accessor(glb, json_int(json, json_find(json, attributes, "NORMAL"), -1), &normals);
+	bool has_texcoords = get_accessor(glb, json_int(json, json_find(json, attributes, "TEXCOORD_0"), -1), &texcoords);
+	if ((has_normals && normals.count != positions.count) || (has_texcoords && texcoords.count != positions.count))
+		return false;
+
+	int indices_accessor = json_int(json, json_find(json, primitive, "indices"), -1);
+	bool has_indices = indices_accessor >= 0;
+	if (has_indices) {
+		if (!get_accessor(glb, indices_accessor, &indices) || indices.components != 1)
+			return false;
+		if (indices.component_type != GLTF_UNSIGNED_BYTE
+			&& indices.component_type != GLTF_UNSIGNED_SHORT
+			&& indices.component_type != GLTF_UNSIGNED_INT)
+			return false;
+	}
+	int num_indices = has_indices ? indices.count : positions.count;
+	num_indices -= num_indices % 3;
+
+	int material = json_int(json, json_find(json, primitive, "material"), -1);
+	if (!result->material.present && material >= 0)
+		read_material(glb, material);
+
+	// Flat normals need a vertex per corner
+	int num_vertices = has_normals ? positions.count : num_indices;
+	reserve_output(glb, num_vertices, num_indices);
+
+	uint32_t base = result->vertices.size;
+	Vertex *out = result->vertices.data + base;
+	uint32_t *out_indices = result->indices + result->num_indices;
+
+	for (int i = 0; i < num_indices; i++) {
+		uint32_t index = has_indices ? read_index(indices, i) : (uint32_t) i;
+		if (index >= (uint32_t) positions.count)
+			return false;
+		out_indices[i] = has_normals ? base + index : base + i;
+	}
+
+	if (has_normals) {
+		for (int i = 0; i < positions.count; i++) {
+			float p[3] = {0}, n[3] = {0}, t[2] = {0};
+			read_element(positions, i, p, 3);
+			read_element(normals, i, n, 3);
+			if (has_texcoords)
+				read_element(texcoords, i, t, 2);
+
+			// glTF puts the origin of texture coordinates at the top
+			Vector3 pos = transform_point(model, (Vector3) {p[0], p[1], p[2]});
+			Vector3 nor = transform_normal(normal, (Vector3) {n[0], n[1], n[2]});
+			out[i] = (Vertex) {pos.x, pos.y, pos.z, nor.x, nor.y, nor.z, t[0], 1 - t[1]};
+		}
+	} else {
+		for (int i = 0; i < num_indices; i += 3) {
+			Vertex *tri = out + i;
+			for (int k = 0; k < 3; k++) {
+				uint32_t index = has_indices ? read_index(indices, i + k) : (uint32_t) (i + k);
+				float p[3] = {0}, t[2] = {0};
+				read_element(positions, index, p, 3);
+				if (has_texcoords)
+					read_element(texcoords, index, t, 2);
+				Vector3 pos = transform_point(model, (Vector3) {p[0], p[1], p[2]});
+				tri[k] = (Vertex) {pos.x, pos.y, pos.z, 0, 0, 0, t[0], 1 - t[1]};
+			}
+			Vector3 e1 = {tri[1].x - tri[0].x, tri[1].y - tri[0].y, tri[1].z - tri[0].z};
+			Vector3 e2 = {tri[2].x - tri[0].x, tri[2].y - tri[0].y, tri[2].z - tri[0].z};
+			Vector3 n = cross(e1, e2);
+			if (norm2_of(n) > 0)
+				n = normalize(n);
+			for (int k = 0; k < 3; k++) {
+				tri[k].nx = n.x;
+				tri[k].ny = n.y;
+				tri[k].nz = n.z;
+			}
+		}
+	}
+
+	result->vertices.size += num_vertices;
+	result->num_indices += num_indices;
+	return true;
+}
+
+static bool add_mesh(GLB *glb, int index, Matrix4 model)
+{
+	JSON *json = &glb->json;
+	int mesh = json_index(json, json_find(json, glb->root, "meshes"), index);
+	if (mesh < 0)
+		return false;
+
+	Matrix4 normal = normal_matrix(model);
+
+	int primitives = json_find(json, mesh, "primitives");
+	for (int i = 0; i < json_size(json, primitives); i++)
+		if (!add_primitive(glb, json_index(json, primitives, i), model, normal))
+			return false;
+	return true;
+}
+
+static Matrix4 node_matrix(JSON *json, int node)
+{
+	Matrix4 m = identity_matrix();
+
+	int matrix = json_find(json, node, "matrix");
+	if (matrix >= 0) {
+		for (int i = 0; i < 16; i++)
+			m.data[i / 4][i % 4] = json_number(json, json_index(json, matrix, i), i % 5 == 0);
+		return m;
+	}
+
+	int t = json_find(json, node, "translation");
+	int r = json_find(json, node, "rotation");
+	int s = json_find(json, node, "scale");
+
+	float x = json_number(json, json_index(json, r, 0), 0);
+	float y = json_number(json, json_index(json, r, 1), 0);
+	float z = json_number(json, json_index(json, r, 2), 0);
+	float w = json_number(json, json_index(json, r, 3), 1);
+
+	float rot[3][3] = {
+		{1 - 2 * (y * y + z * z), 2 * (x * y - z * w),     2 * (x * z + y * w)},
+		{2 * (x * y + z * w),     1 - 2 * (x * x + z * z), 2 * (y * z - x * w)},
+		{2 * (x * z - y * w),     2 * (y * z + x * w),     1 - 2 * (x * x + y * y)},
+	};
+
+	// Column-major, translation * rotation * scale
+	for (int col = 0; col < 3; col++) {
+		float scale = json_number(json, json_index(json, s, col), 1);
+		for (int row = 0; row < 3; row++)
+			m.data[col][row] = rot[row][col] * scale;
+		m.data[3][col] = json_number(json, json_index(json, t, col), 0);
+	}
+	return m;
+}
+
+static bool add_node(GLB *glb, int index, Matrix4 parent, int depth)
+{
+	JSON *json = &glb->json;
+	int node = json_index(json, json_find(json, glb->root, "nodes"), index);
+	if (node < 0 || depth > GLTF_MAX_DEPTH)
+		return false;
+
+	Matrix4 model = dotm(parent, node_matrix(json, node));
+
+	int mesh = json_int(json, json_find(json, node, "mesh"), -1);
+	if (mesh >= 0 && !add_mesh(glb, mesh, model))
+		return false;
+
+	int children = json_find(json, node, "children");
+	for (int i = 0; i < json_size(json, children); i++)
+		if (!add_node(glb, json_int(json, json_index(json, children, i), -1), model, depth + 1))
+			return false;
+	return true;
+}
+
+static bool parse_scene(GLB *glb)
+{
+	JSON *json = &glb->json;
+
+	int scenes = json_find(json, glb->root, "scenes");
+	int scene = json_index(json, scenes, json_int(json, json_find(json, glb->root, "scene"), 0));
+
+	// Without scenes every mesh is drawn as it is
+	if (scene < 0) {
+		int meshes = json_find(json, glb->root, "meshes");
+		for (int i = 0; i < json_size(json, meshes); i++)
+			if (!add_mesh(glb, i, identity_matrix()))
+				return false;
+		return true;
+	}
+
+	int nodes = json_find(json, scene, "nodes");
+	for (int i = 0; i < json_size(json, nodes); i++)
+		if (!add_node(glb, json_int(json, json_index(json, nodes, i), -1), identity_matrix(), 0))
+			return false;
+	return true;
+}
+
+bool parse_glb(const char *src, size_t len, MeshData *result, const char *file)
+{
+	*result = (MeshData) {0};
+
+	uint32_t header[3];
+	if (len < GLB_HEADER_SIZE + 8) {
+		printf("Failed loading '%s' (truncated glTF)\n", file);
+		return false;
+	}
+	memcpy(header, src, sizeof(header));
+	if (memcmp(src, GLB_MAGIC, 4) || header[1] != 2) {
+		printf("Failed loading '%s' (not a glTF 2.0 binary)\n", file);
+		return false;
+	}
+	if (header[2] < len)
+		len = header[2];
+
+	// The JSON chunk comes first and the binary one, if any, second
+	const char *chunks[2] = {NULL, NULL};
+	uint32_t chunk_sizes[2] = {0, 0};
+	size_t offset = GLB_HEADER_SIZE;
+	for (int i = 0; i < 2 && offset + 8 <= len; i++) {
+		uint32_t chunk[2];
+		memcpy(chunk, src + offset, sizeof(chunk));
+		if (chunk[0] > len - offset - 8)
+			break;
+		if (chunk[1] == (i == 0 ? GLB_CHUNK_JSON : GLB_CHUNK_BIN)) {
+			chunks[i] = src + offset + 8;
+			chunk_sizes[i] = chunk[0];
+		}
+		offset += 8 + (size_t) chunk[0];
+	}
+	if (chunks[0] == NULL) {
+		printf("Failed loading '%s' (missing JSON chunk)\n", file);
+		return false;
+	}
+
+	GLB glb = {0};
+	glb.json.src  = chunks[0];
+	glb.json.len  = chunk_sizes[0];
+	glb.bin       = chunks[1];
+	glb.bin_size  = chunk_sizes[1];
+	glb.result    = result;
+
+	bool ok = parse_json_value(&glb.json, 0);
+	if (!ok)
+		printf("Failed loading '%s' (invalid JSON at byte %d)\n", file, glb.json.cur);
+	else if (!(ok = parse_scene(&glb)))
+		printf("Failed loading '%s' (invalid or unsupported geometry)\n", file);
+
+	free(glb.json.tokens);
+	if (!ok)
+		free_mesh_data(result);
+	return ok;
+}
@@ -0,0 +1,25 @@
+#ifndef GLTF_INCLUDED
+#define GLTF_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "mesh.h"
+
+// Loader for binary glTF 2.0 files (.glb). Only the JSON chunk is
+// parsed, the geometry is read straight from the binary chunk of the
+// file as it was mapped in memory.
+//
+// The triangles of the meshes in the default scene are merged in one
+// indexed mesh, transformed by the nodes that reference them. Vertex
+// attributes may be floats or normalized integers, as allowed by
+// KHR_mesh_quantization. Primitives without normals get flat ones.
+// Textures, skins, morph targets, animations and primitives that
+// aren't triangle lists are ignored. The material is the one of the
+// first primitive that has one.
+
+#define GLB_MAGIC "glTF"
+
+// "file" is only used in error messages
+bool parse_glb(const char *src, size_t len, MeshData *result, const char *file);
+
+#endif
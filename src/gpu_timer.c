@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "profiler.h"
+#include "gpu_timer.h"
+
+typedef struct {
+	unsigned int queries[GPU_ZONE_COUNT][2]; // Start and end timestamps
+	bool used[GPU_ZONE_COUNT];
+	bool pending;
+} GPUFrame;
+
+typedef struct {
+	float samples[GPU_TIMER_HISTORY];
+	int   count;
+	int   next;
+	float sum;
+
+	double total; // Since the last reset
+	int    total_count;
+} GPUZoneHistory;
+
+static const char *zone_names[GPU_ZONE_COUNT] = {
+	[GPU_ZONE_SHADOW]         = "shadow pass",
+	[GPU_ZONE_MAIN]           = "main pass",
+	[GPU_ZONE_SKYBOX]         = "skybox",
+	[GPU_ZONE_IBL_CUBEMAP]    = "IBL cubemap",
+	[GPU_ZONE_IBL_IRRADIANCE] = "IBL irradiance",
+	[GPU_ZONE_IBL_PREFILTER]  = "IBL prefilter",
+	[GPU_ZONE_IBL_BRDF]       = "IBL BRDF LUT",
+};
+
+static GPUFrame frames[GPU_TIMER_FRAMES];
+static int current;
+static GPUZoneHistory history[GPU_ZONE_COUNT];
+
+// GPU timestamps are converted to the clock of the CPU profiler by
+// sampling both at the same moment
+static int64_t gpu_to_cpu_offset;
+
+// Row of the GPU events in the trace
+#define GPU_TRACK 1
+
+void init_gpu_timers(void)
+{
+	for (int i = 0; i < GPU_TIMER_FRAMES; i++) {
+		glGenQueries(2 * GPU_ZONE_COUNT, &frames[i].queries[0][0]);
+		memset(frames[i].used, 0, sizeof(frames[i].used));
+		frames[i].pending = false;
+	}
+	current = 0;
+	memset(history, 0, sizeof(history));
+
+	GLint64 gpu_now;
+	glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+	gpu_to_cpu_offset = (int64_t) profile_time() - gpu_now;
+
+	if (profiler_enabled)
+		profile_track_name(GPU_TRACK, "GPU");
+}
+
+static void add_sample(GPUZone zone, float ms)
+{
+	GPUZoneHistory *h = &history[zone];
+	if (h->count == GPU_TIMER_HISTORY)
+		h->sum -= h->samples[h->next];
+	else
+		h->count++;
+	h->samples[h->next] = ms;
+	h->sum += ms;
+	h->next = (h->next + 1) % GPU_TIMER_HISTORY;
+
+	h->total += ms;
+	h->total_count++;
+}
+
+// Reads the results of a frame. Blocks if they aren't ready, which
+// only happens if the GPU is more than GPU_TIMER_FRAMES frames behind.
+static void collect_frame(GPUFrame *frame)
+{
+	if (!frame->pending)
+		return;
+
+	for (int zone = 0; zone < GPU_ZONE_COUNT; zone++) {
+		if (!frame->used[zone])
+			continue;
+
+		GLuint64 start, end;
+		glGetQueryObjectui64v(frame->queries[zone][0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(frame->queries[zone][1], GL_QUERY_RESULT, &end);
+
+		add_sample(zone, (end - start) / 1000000.0f);
+		profile_event(zone_names[zone], start + gpu_to_cpu_offset, end + gpu_to_cpu_offset, GPU_TRACK);
+
+		frame->used[zone] = false;
+	}
+	frame->pending = false;
+}
+
+void begin_gpu_frame(void)
+{
+	collect_frame(&frames[current]);
+}
+
+void end_gpu_frame(void)
+{
+	frames[current].pending = true;
+	current = (current + 1) % GPU_TIMER_FRAMES;
+}
+
+void begin_gpu_zone(GPUZone zone)
+{
+	glQueryCounter(frames[current].queries[zone][0], GL_TIMESTAMP);
+}
+
+void end_gpu_zone(GPUZone zone)
+{
+	glQueryCounter(frames[current].queries[zone][1], GL_TIMESTAMP);
+	frames[current].used[zone] = true;
+}
+
+void flush_gpu_timers(void)
+{
+	// Oldest first, so that the trace stays in order
+	for (int i = 0; i < GPU_TIMER_FRAMES; i++)
+		collect_frame(&frames[(current + i) % GPU_TIMER_FRAMES]);
+}
+
+float get_gpu_zone_time(GPUZone zone)
+{
+	GPUZoneHistory *h = &history[zone];
+	if (h->count == 0)
+		return 0;
+	return h->sum / h->count;
+}
+
+const char *get_gpu_zone_name(GPUZone zone)
+{
+	return zone_names[zone];
+}
+
+float get_gpu_zone_mean(GPUZone zone)
+{
+	GPUZoneHistory *h = &history[zone];
+	if (h->total_count == 0)
+		return 0;
+	return h->total / h->total_count;
+}
+
+void reset_gpu_timer_stats(void)
+{
+	flush_gpu_timers();
+	memset(history, 0, sizeof(history));
+}
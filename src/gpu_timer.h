@@ -0,0 +1,49 @@
+#ifndef GPU_TIMER_INCLUDED
+#define GPU_TIMER_INCLUDED
+
+#include <stdbool.h>
+
+// Measures how long the GPU spends on each pass with timestamp queries.
+// Results are read GPU_TIMER_FRAMES frames later, when they are normally
+// available, so measuring never stalls the pipeline. Times are averaged
+// over the last GPU_TIMER_HISTORY frames and, when the CPU profiler is
+// enabled, also added to its trace.
+
+#define GPU_TIMER_FRAMES  4
+#define GPU_TIMER_HISTORY 60
+
+typedef enum {
+	GPU_ZONE_SHADOW,
+	GPU_ZONE_MAIN,
+	GPU_ZONE_SKYBOX,
+	GPU_ZONE_IBL_CUBEMAP,
+	GPU_ZONE_IBL_IRRADIANCE,
+	GPU_ZONE_IBL_PREFILTER,
+	GPU_ZONE_IBL_BRDF,
+	GPU_ZONE_COUNT,
+} GPUZone;
+
+void init_gpu_timers(void);
+
+void begin_gpu_frame(void);
+void end_gpu_frame(void);
+
+// A zone can be measured once per frame
+void begin_gpu_zone(GPUZone zone);
+void end_gpu_zone(GPUZone zone);
+
+// Waits for all pending results
+void flush_gpu_timers(void);
+
+// Average time in milliseconds, or 0 if the zone was never measured
+float       get_gpu_zone_time(GPUZone zone);
+const char *get_gpu_zone_name(GPUZone zone);
+
+// Like get_gpu_zone_time, but averaged over all the frames since the
+// last reset instead of the recent ones
+float get_gpu_zone_mean(GPUZone zone);
+
+// Waits for pending results and forgets all measurements
+void reset_gpu_timer_stats(void);
+
+#endif
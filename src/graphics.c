@@ -1,5 +1,9 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -8,22 +12,150 @@
 
 #include "utils.h"
 #include "mesh.h"
+#include "shapes.h"
+#include "stream.h"
+#include "encoder.h"
+#include "profiler.h"
+#include "gpu_timer.h"
+#include "pool.h"
 #include "camera.h"
 #include "vector.h"
 #include "graphics.h"
 
+#define COMMAND_QUEUE_SIZE 1024
+
+// Meshes are stored with vertices half the size of Vertex: positions as
+// 16-bit unsigned normalized coordinates in the bounding box of the mesh,
+// normals as 10-bit signed normalized and texture coordinates as half
+// floats. The box is folded into the model matrix of the draw calls, so
+// shaders see positions in the usual space. Set to 0 to store vertices
+// as they are.
+#define QUANTIZE_VERTICES 1
+
+#if QUANTIZE_VERTICES
+typedef struct {
+	uint16_t pos[4]; // The fourth is padding
+} GPUPosition;
+
+typedef struct {
+	uint32_t normal; // GL_INT_2_10_10_10_REV
+	uint16_t tex[2];
+} GPUAttributes;
+#else
+typedef struct {
+	float x, y, z;
+} GPUPosition;
+
 typedef struct {
-	unsigned int vao;
-	unsigned int vbo;
-	int num_vertices;
+	float nx, ny, nz;
+	float tx, ty;
+} GPUAttributes;
+#endif
+
+typedef struct {
+	uint32_t first_vertex;
+	uint32_t num_vertices;
+	uint32_t first_index;
+	uint32_t num_indices;
+	Vector3  box_min;  // Bounding box the positions are quantized in
+	Vector3  box_size;
+	Vector3  center;   // Bounding sphere
+	float    radius;
+	bool     placeholder; // Still loading or failed to load (see load_3d_model_async)
+
+	// Given by the file the mesh was loaded from, if any
+	MeshMaterial material;
+
+	// Ranges of triangles the lit pass culls one by one. Meshes that
+	// fit in one meshlet have none.
+	Meshlet *meshlets;
+	int      num_meshlets;
+
+	// Simplified versions of the mesh, stored as meshes of their own
+	// with the same bounding box. The error of level 0 is 0.
+	int      num_lods;
+	ModelID  lods[MAX_MESH_LODS-1];
+	float    lod_error[MAX_MESH_LODS];
 } GPUMeshBuffer;
 
-#define MAX_MESH_BUFFERS 128
-static GPUMeshBuffer mesh_buffers[MAX_MESH_BUFFERS];
+// All meshes share the same vertex buffers and index buffer described by
+// a single VAO, so switching model between draw calls doesn't switch
+// vertex arrays. Ranges of the buffers are handed out by free-lists and
+// the buffers are grown when they are full.
+//
+// Vertices are split in two streams at the same offsets: the positions,
+// which are all the shadow pass reads, and the other attributes. The
+// shadow pass uses a VAO of its own with just the positions and the
+// same index buffer.
+#define INITIAL_MESH_VERTICES (64 * 1024)
+#define INITIAL_MESH_INDICES  (192 * 1024)
+
+enum {
+	STREAM_POSITIONS,
+	STREAM_ATTRIBUTES,
+	NUM_VERTEX_STREAMS,
+};
+
+static const size_t vertex_stream_size[NUM_VERTEX_STREAMS] = {sizeof(GPUPosition), sizeof(GPUAttributes)};
+static const size_t index_size = sizeof(uint32_t);
+
+static unsigned int mesh_vao;
+static unsigned int shadow_vao;
+static unsigned int mesh_vbos[NUM_VERTEX_STREAMS];
+static unsigned int mesh_ibo;
+static RangePool vertex_pool;
+static RangePool index_pool;
+
+static GPUMeshBuffer *mesh_buffers;
+static int num_mesh_buffers;
+static int cap_mesh_buffers;
+
+// Layout of the "Object" uniform block (std140) shared by the
+// lit and shadow programs
+typedef struct {
+	Matrix4 model;
+	Matrix4 norm;
+	Vector3 baseColor;
+	float   perceptualRoughness;
+	float   metallic;
+	float   reflectance;
+	float   padding[2]; // std140 rounds the block size to 16 bytes
+} ObjectData;
+
+#define OBJECT_BINDING 0
+
+static StreamBuffer object_stream;
+static size_t object_align;
 
 #define SHADOW_WIDTH  1024
 #define SHADOW_HEIGHT 1024
 
+// The view frustum up to SHADOW_DISTANCE is split in NUM_CASCADES
+// slices, each with its own shadow map layer fitted around it. Must
+// not be greater than MAX_CASCADES in fragment.glsl.
+#define NUM_CASCADES 3
+#define SHADOW_DISTANCE 60.0f
+
+// Blend between logarithmic (1) and uniform (0) split distances
+#define CASCADE_SPLIT_LAMBDA 0.75f
+
+// How far beyond a slice, towards the light, casters are included
+#define SHADOW_CASTER_MARGIN 50.0f
+
+// Number of PCF taps (up to MAX_SHADOW_TAPS in fragment.glsl) and the
+// radius of the kernel in shadow map texels
+#define SHADOW_PCF_TAPS   4
+#define SHADOW_PCF_RADIUS 1.5f
+
+#define CAMERA_FOV  30.0f
+#define CAMERA_NEAR 0.1f
+#define CAMERA_FAR  1000.0f
+
+// A coarser level of detail is drawn when its error, projected on the
+// screen or shadow map, is within this many pixels or texels
+#define LOD_PIXEL_ERROR        1.0f
+#define SHADOW_LOD_TEXEL_ERROR 1.0f
+
 static unsigned int envCubemap;
 static unsigned int captureFBO;
 static unsigned int captureRBO;
@@ -42,48 +174,59 @@ static unsigned int skybox_program;
 
 static GLFWwindow *window_;
 
+// Framebuffer the frames are rendered into when there is no window
+static unsigned int offscreen_fbo;
+static unsigned int offscreen_color;
+static unsigned int offscreen_depth;
+static int offscreen_w;
+static int offscreen_h;
+
 static unsigned int
 compile_shader(const char *vertex_file, const char *fragment_file)
 {
 	int  success;
 	char infolog[512];
 
-	char *vertex_str = load_file(vertex_file, NULL);
-	if (vertex_str == NULL) {
+	MappedFile vertex_src;
+	if (!map_file(vertex_file, &vertex_src)) {
 		fprintf(stderr, "Couldn't load file '%s'\n", vertex_file);
 		return 0;
 	}
 
-	char *fragment_str = load_file(fragment_file, NULL);
-	if (fragment_str == NULL) {
+	MappedFile fragment_src;
+	if (!map_file(fragment_file, &fragment_src)) {
 		fprintf(stderr, "Couldn't load file '%s'\n", fragment_file);
-		free(vertex_str);
+		unmap_file(&vertex_src);
 		return 0;
 	}
 
 	unsigned int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex_shader, 1, &vertex_str, NULL);
+	const char *vertex_str = vertex_src.data;
+	int vertex_len = vertex_src.size; // The mapping isn't null-terminated
+	glShaderSource(vertex_shader, 1, &vertex_str, &vertex_len);
 	glCompileShader(vertex_shader);
 
 	glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
 	if(!success) {
 		glGetShaderInfoLog(vertex_shader, sizeof(infolog), NULL, infolog);
 		fprintf(stderr, "Couldn't compile vertex shader '%s' (%s)\n", vertex_file, infolog);
-		free(vertex_str);
-		free(fragment_str);
+		unmap_file(&vertex_src);
+		unmap_file(&fragment_src);
 		return 0;
 	}
 
 	unsigned int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment_shader, 1, &fragment_str, NULL);
+	const char *fragment_str = fragment_src.data;
+	int fragment_len = fragment_src.size;
+	glShaderSource(fragment_shader, 1, &fragment_str, &fragment_len);
 	glCompileShader(fragment_shader);
 
 	glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
 	if(!success) {
 		glGetShaderInfoLog(fragment_shader, sizeof(infolog), NULL, infolog);
 		fprintf(stderr, "Couldn't compile fragment shader '%s' (%s)\n", fragment_file, infolog);
-		free(vertex_str);
-		free(fragment_str);
+		unmap_file(&vertex_src);
+		unmap_file(&fragment_src);
 		return 0;
 	}
 
@@ -96,18 +239,111 @@ compile_shader(const char *vertex_file, const char *fragment_file)
 	if(!success) {
 		glGetProgramInfoLog(shader_program, sizeof(infolog), NULL, infolog);
 		fprintf(stderr, "Couldn't link shader program (%s)\n", infolog);
-		free(vertex_str);
-		free(fragment_str);
+		unmap_file(&vertex_src);
+		unmap_file(&fragment_src);
 		return 0;
 	}
 
 	glDeleteShader(vertex_shader);
 	glDeleteShader(fragment_shader);
-	free(vertex_str);
-	free(fragment_str);
+	unmap_file(&vertex_src);
+	unmap_file(&fragment_src);
 	return shader_program;
 }
 
+/*
+ * Frame statistics
+ *
+ * The counters are reset at the start of every rendered frame, so state
+ * changes and draws done at startup aren't included. State changes made
+ * by the frame go through the helpers below to be counted.
+ */
+
+static FrameStats frame_stats;
+static FrameStats last_frame_stats;
+static size_t gpu_memory[GPU_MEMORY_COUNT];
+
+static float    frame_times[FRAME_TIME_HISTORY];
+static int      num_frame_times;
+static int      next_frame_time;
+static uint64_t last_frame_start;
+
+static void use_program(unsigned int program)
+{
+	glUseProgram(program);
+	frame_stats.program_binds++;
+}
+
+static void bind_vao(unsigned int vao)
+{
+	glBindVertexArray(vao);
+	frame_stats.vao_binds++;
+}
+
+static void bind_texture(GLenum target, unsigned int texture)
+{
+	glBindTexture(target, texture);
+	frame_stats.texture_binds++;
+}
+
+static void count_draw(int triangles)
+{
+	frame_stats.draw_calls++;
+	frame_stats.triangles += triangles;
+}
+
+// Called at the start of every rendered frame
+static void add_frame_time(void)
+{
+	uint64_t now = profile_time();
+	if (last_frame_start) {
+		frame_times[next_frame_time] = (now - last_frame_start) / 1000000.0f;
+		next_frame_time = (next_frame_time + 1) % FRAME_TIME_HISTORY;
+		if (num_frame_times < FRAME_TIME_HISTORY)
+			num_frame_times++;
+	}
+	last_frame_start = now;
+}
+
+// Publishes the counters of the frame and starts counting the next one
+static void finish_frame_stats(void)
+{
+	memcpy(frame_stats.gpu_memory, gpu_memory, sizeof(gpu_memory));
+	last_frame_stats = frame_stats;
+	memset(&frame_stats, 0, sizeof(frame_stats));
+}
+
+FrameStats get_frame_stats(void)
+{
+	FrameStats stats = last_frame_stats;
+	stats.frame_count = num_frame_times;
+
+	if (num_frame_times > 0) {
+		float sorted[FRAME_TIME_HISTORY];
+		memcpy(sorted, frame_times, num_frame_times * sizeof(float));
+
+		TimeSummary summary = summarize_times(sorted, num_frame_times);
+		stats.frame_time_avg = summary.avg;
+		stats.frame_time_p50 = summary.p50;
+		stats.frame_time_p95 = summary.p95;
+		stats.frame_time_p99 = summary.p99;
+		stats.frame_time_max = summary.max;
+	}
+	return stats;
+}
+
+const char *get_gpu_memory_category_name(GPUMemoryCategory category)
+{
+	static const char *names[GPU_MEMORY_COUNT] = {
+		[GPU_MEMORY_MESHES]     = "meshes",
+		[GPU_MEMORY_TEXTURES]   = "textures",
+		[GPU_MEMORY_SHADOW_MAP] = "shadow map",
+		[GPU_MEMORY_TARGETS]    = "targets",
+		[GPU_MEMORY_STREAMING]  = "streaming",
+	};
+	return names[category];
+}
+
 static void set_uniform_m4(unsigned int program, const char *name, Matrix4 value)
 {
 	int location = glGetUniformLocation(program, name);
@@ -116,6 +352,7 @@ static void set_uniform_m4(unsigned int program, const char *name, Matrix4 value
 		abort();
 	}
 	glUniformMatrix4fv(location, 1, GL_FALSE, (float*) &value);
+	frame_stats.uniforms_set++;
 }
 
 static void set_uniform_v3(unsigned int program, const char *name, Vector3 value)
@@ -126,6 +363,29 @@ static void set_uniform_v3(unsigned int program, const char *name, Vector3 value
 		abort();
 	}
 	glUniform3f(location, value.x, value.y, value.z);
+	frame_stats.uniforms_set++;
+}
+
+static void set_uniform_m4v(unsigned int program, const char *name, const Matrix4 *values, int count)
+{
+	int location = glGetUniformLocation(program, name);
+	if (location < 0) {
+		printf("Can't set uniform '%s'\n", name);
+		abort();
+	}
+	glUniformMatrix4fv(location, count, GL_FALSE, (float*) values);
+	frame_stats.uniforms_set++;
+}
+
+static void set_uniform_fv(unsigned int program, const char *name, const float *values, int count)
+{
+	int location = glGetUniformLocation(program, name);
+	if (location < 0) {
+		printf("Can't set uniform '%s'\n", name);
+		abort();
+	}
+	glUniform1fv(location, count, values);
+	frame_stats.uniforms_set++;
 }
 
 static void set_uniform_i(unsigned int program, const char *name, int value)
@@ -136,6 +396,7 @@ static void set_uniform_i(unsigned int program, const char *name, int value)
 		abort();
 	}
 	glUniform1i(location, value);
+	frame_stats.uniforms_set++;
 }
 
 static void set_uniform_f(unsigned int program, const char *name, float value)
@@ -146,607 +407,2524 @@ static void set_uniform_f(unsigned int program, const char *name, float value)
 		abort();
 	}
 	glUniform1f(location, value);
+	frame_stats.uniforms_set++;
 }
 
-static GPUMeshBuffer create_gpu_mesh_buffer(VertexArray vertices)
+static void setup_position_attribute(void)
 {
-	GPUMeshBuffer buffer;
+	glBindBuffer(GL_ARRAY_BUFFER, mesh_vbos[STREAM_POSITIONS]);
+#if QUANTIZE_VERTICES
+	glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(GPUPosition), (void*) 0);
+#else
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GPUPosition), (void*) 0);
+#endif
+	glEnableVertexAttribArray(0);
+}
 
-	glGenVertexArrays(1, &buffer.vao);
-	glGenBuffers(1, &buffer.vbo);
+// Must be called again whenever the buffers are replaced
+static void setup_mesh_vao(void)
+{
+	glBindVertexArray(mesh_vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_ibo);
 
-	glBindVertexArray(buffer.vao);
+	// positions
+	setup_position_attribute();
 
-	glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size, vertices.data, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh_vbos[STREAM_ATTRIBUTES]);
 
-	// positions
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-	glEnableVertexAttribArray(0);
+#if QUANTIZE_VERTICES
+	// normals
+	glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(GPUAttributes), (void*) offsetof(GPUAttributes, normal));
+	glEnableVertexAttribArray(1);
 
+	// texture coordinates
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(GPUAttributes), (void*) offsetof(GPUAttributes, tex));
+	glEnableVertexAttribArray(2);
+#else
 	// normals
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) (offsetof(Vertex, nx)));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GPUAttributes), (void*) offsetof(GPUAttributes, nx));
 	glEnableVertexAttribArray(1);
 
 	// texture coordinates
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) (offsetof(Vertex, tx)));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(GPUAttributes), (void*) offsetof(GPUAttributes, tx));
 	glEnableVertexAttribArray(2);
+#endif
 
-	buffer.num_vertices = vertices.size;
+	glBindVertexArray(shadow_vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_ibo);
+	setup_position_attribute();
 
-	return buffer;
+	glBindVertexArray(0);
 }
 
-ModelID load_3d_model(const char *file)
+static void init_mesh_storage(void)
 {
-	// Look for a free struct
-	int i = 0;
-	while (i < MAX_MESH_BUFFERS && mesh_buffers[i].num_vertices != 0)
-		i++;
-	if (i == MAX_MESH_BUFFERS)
-		return MODEL_INVALID; // No free structs
+	glGenVertexArrays(1, &mesh_vao);
+	glGenVertexArrays(1, &shadow_vao);
+	glGenBuffers(NUM_VERTEX_STREAMS, mesh_vbos);
+	glGenBuffers(1, &mesh_ibo);
+
+	for (int i = 0; i < NUM_VERTEX_STREAMS; i++) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mesh_vbos[i]);
+		glBufferData(GL_COPY_WRITE_BUFFER, INITIAL_MESH_VERTICES * vertex_stream_size[i], NULL, GL_STATIC_DRAW);
+		gpu_memory[GPU_MEMORY_MESHES] += INITIAL_MESH_VERTICES * vertex_stream_size[i];
+	}
 
-	VertexArray vertices;
-	if (!load_mesh_from_file(file, &vertices))
-		return MODEL_INVALID;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mesh_ibo);
+	glBufferData(GL_COPY_WRITE_BUFFER, INITIAL_MESH_INDICES * index_size, NULL, GL_STATIC_DRAW);
+	gpu_memory[GPU_MEMORY_MESHES] += INITIAL_MESH_INDICES * index_size;
 
-	mesh_buffers[i] = create_gpu_mesh_buffer(vertices);
-	free(vertices.data);
+	init_range_pool(&vertex_pool, INITIAL_MESH_VERTICES);
+	init_range_pool(&index_pool,  INITIAL_MESH_INDICES);
 
-	assert(mesh_buffers[i].num_vertices > 0);
-	return i+1;
+	setup_mesh_vao();
 }
 
-void free_3d_model(ModelID id)
+// Replaces the buffer with a bigger one holding the same data
+static void grow_gl_buffer(unsigned int *buffer, size_t old_size, size_t new_size)
 {
-	if (id == 0 || id == MODEL_SPHERE || id == MODEL_CUBE)
-		return;
-	// TODO: Free mesh_buffers[id-1]
+	unsigned int new_buffer;
+	glGenBuffers(1, &new_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, new_size, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+	glDeleteBuffers(1, buffer);
+	*buffer = new_buffer;
+
+	gpu_memory[GPU_MEMORY_MESHES] += new_size - old_size;
 }
 
-static void draw_mesh_for_shadow_map(GPUMeshBuffer buffer, Matrix4 model)
+// The pool hands out ranges of all "buffers" at once, which hold
+// elements of the given sizes
+static uint32_t alloc_mesh_range(RangePool *pool, unsigned int *buffers, const size_t *elem_sizes, int num_buffers, uint32_t count)
 {
-	glUseProgram(shadow_program);
-	set_uniform_m4(shadow_program, "model", model);
-	glBindVertexArray(buffer.vao);
-	glDrawArrays(GL_TRIANGLES, 0, buffer.num_vertices);
+	uint32_t offset;
+	while (!alloc_range(pool, count, &offset)) {
+		uint32_t capacity = 2 * pool->capacity;
+		for (int i = 0; i < num_buffers; i++)
+			grow_gl_buffer(&buffers[i], pool->capacity * elem_sizes[i], capacity * elem_sizes[i]);
+		grow_range_pool(pool, capacity);
+		setup_mesh_vao();
+	}
+	return offset;
 }
 
-static void draw_mesh(GPUMeshBuffer buffer, Matrix4 model, Material material)
+#if QUANTIZE_VERTICES
+
+static uint16_t float_to_half(float f)
 {
-	Matrix4 temp;
-	assert(invert(model, &temp));
-	Matrix4 normal = transpose(temp);
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+
+	uint32_t sign = (x >> 16) & 0x8000;
+	int      exp  = (int) ((x >> 23) & 0xFF) - 127 + 15;
+	uint32_t mant = x & 0x7FFFFF;
+
+	if (exp >= 31) // Too big, infinity or NaN
+		return sign | 0x7C00 | (((x & 0x7FFFFFFF) > 0x7F800000) ? 0x200 : 0);
+	if (exp <= 0) {
+		if (exp < -10) // Too small even for a denormal
+			return sign;
+		mant |= 0x800000;
+		uint32_t shift = 14 - exp;
+		uint32_t h = mant >> shift;
+		if ((mant >> (shift - 1)) & 1) h++; // Round
+		return sign | h;
+	}
+	uint32_t h = sign | (exp << 10) | (mant >> 13);
+	if (mant & 0x1000) h++; // Round, a carry into the exponent is fine
+	return h;
+}
 
-	glUseProgram(shader_program);
+static float half_to_float(uint16_t h)
+{
+	uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+	uint32_t exp  = (h >> 10) & 0x1F;
+	uint32_t mant = h & 0x3FF;
+
+	uint32_t x;
+	if (exp == 0) {
+		if (mant == 0)
+			x = sign;
+		else {
+			// Denormal, normalize it
+			exp = 127 - 15 + 1;
+			while (!(mant & 0x400)) {
+				mant <<= 1;
+				exp--;
+			}
+			x = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+		}
+	} else if (exp == 31)
+		x = sign | 0x7F800000 | (mant << 13);
+	else
+		x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
 
-	set_uniform_f(shader_program,  "perceptualRoughness", material.perceptualRoughness);
-	set_uniform_f(shader_program,  "metallic",    material.metallic);
-	set_uniform_f(shader_program,  "reflectance", material.reflectance);
-	set_uniform_v3(shader_program, "baseColor",   material.baseColor);
-	set_uniform_m4(shader_program, "model", model);
-	set_uniform_m4(shader_program, "norm",  normal);
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
 
-	glBindVertexArray(buffer.vao);
-	glDrawArrays(GL_TRIANGLES, 0, buffer.num_vertices);
+static int snorm10(float f)
+{
+	if (f > 1)  f = 1;
+	if (f < -1) f = -1;
+	return (int) (f * 511 + (f < 0 ? -0.5f : 0.5f));
 }
 
-unsigned int cubeVAO = 0;
-unsigned int cubeVBO = 0;
-void renderCube()
+// Plain x, y and z rather than octahedral, since GL unpacks this format
+// itself and the shaders read the same vec3 as with float vertices. It
+// is off by at most about 0.1 degree.
+static uint32_t pack_normal(float x, float y, float z)
 {
-	// initialize (if necessary)
-	if (cubeVAO == 0) {
-		float vertices[] = {
-
-			// back face
-			-1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-			1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
-			1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 0.0f, // bottom-right
-			1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 1.0f, 1.0f, // top-right
-			-1.0f, -1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-			-1.0f,  1.0f, -1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 1.0f, // top-left
-
-			// front face
-			-1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-			1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f, // bottom-right
-			1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-			1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-			-1.0f,  1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f, // top-left
-			-1.0f, -1.0f,  1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-
-			// left face
-			-1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-			-1.0f,  1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-left
-			-1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-			-1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-			-1.0f, -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-			-1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-
-			// right face
-			1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-			1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-			1.0f,  1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-right
-			1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-			1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-			1.0f, -1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-left
-
-			// bottom face
-			-1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-			1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f, // top-left
-			1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-			1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-			-1.0f, -1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-			-1.0f, -1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-
-			// top face
-			-1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-			1.0f,  1.0f , 1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-			1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 1.0f, // top-right
-			1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-			-1.0f,  1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-			-1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left
-		};
+	float len = sqrtf(x*x + y*y + z*z);
+	if (len > 0) {
+		x /= len;
+		y /= len;
+		z /= len;
+	}
+	return ((uint32_t) snorm10(x) & 0x3FF)
+		| (((uint32_t) snorm10(y) & 0x3FF) << 10)
+		| (((uint32_t) snorm10(z) & 0x3FF) << 20);
+}
 
-		glGenVertexArrays(1, &cubeVAO);
-		glGenBuffers(1, &cubeVBO);
+static float unpack_snorm10(uint32_t bits)
+{
+	int v = bits & 0x3FF;
+	if (v & 0x200) v -= 0x400;
+	float f = v / 511.0f;
+	return f < -1 ? -1 : f;
+}
 
-		// fill buffer
-		glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+static uint16_t unorm16(float f)
+{
+	if (f < 0) f = 0;
+	if (f > 1) f = 1;
+	return (uint16_t) (f * 65535 + 0.5f);
+}
 
-		// link vertex attributes
-		glBindVertexArray(cubeVAO);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindVertexArray(0);
+// Positions outside the box, which simplified meshes may have, are
+// clamped to it
+static void quantize_vertices(VertexArray vertices, GPUPosition *positions, GPUAttributes *attributes, Vector3 lo, Vector3 size)
+{
+	for (int i = 0; i < vertices.size; i++) {
+		Vertex v = vertices.data[i];
+		positions[i].pos[0] = unorm16((v.x - lo.x) / size.x);
+		positions[i].pos[1] = unorm16((v.y - lo.y) / size.y);
+		positions[i].pos[2] = unorm16((v.z - lo.z) / size.z);
+		positions[i].pos[3] = 0;
+		attributes[i].normal = pack_normal(v.nx, v.ny, v.nz);
+		attributes[i].tex[0] = float_to_half(v.tx);
+		attributes[i].tex[1] = float_to_half(v.ty);
 	}
+}
 
-	// render Cube
-	glBindVertexArray(cubeVAO);
-	glDrawArrays(GL_TRIANGLES, 0, 36);
-	glBindVertexArray(0);
+static Vertex dequantize_vertex(GPUPosition p, GPUAttributes a, Vector3 box_min, Vector3 box_size)
+{
+	Vertex r;
+	r.x  = box_min.x + box_size.x * p.pos[0] / 65535.0f;
+	r.y  = box_min.y + box_size.y * p.pos[1] / 65535.0f;
+	r.z  = box_min.z + box_size.z * p.pos[2] / 65535.0f;
+	r.nx = unpack_snorm10(a.normal);
+	r.ny = unpack_snorm10(a.normal >> 10);
+	r.nz = unpack_snorm10(a.normal >> 20);
+	r.tx = half_to_float(a.tex[0]);
+	r.ty = half_to_float(a.tex[1]);
+	return r;
 }
 
-// renderQuad() renders a 1x1 XY quad in NDC
-// -----------------------------------------
-unsigned int quadVAO = 0;
-unsigned int quadVBO;
-void renderQuad()
+#else
+
+static Vertex dequantize_vertex(GPUPosition p, GPUAttributes a, Vector3 box_min, Vector3 box_size)
 {
-	if (quadVAO == 0) {
+	(void) box_min;
+	(void) box_size;
+	return (Vertex) {p.x, p.y, p.z, a.nx, a.ny, a.nz, a.tx, a.ty};
+}
 
-		float quadVertices[] = {
-			// positions        // texture Coords
-			-1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
-			-1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
-			1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
-			1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-		};
+#endif
 
-		// setup plane VAO
+// Maps the stored positions of the mesh to the space of its model
+static Matrix4 dequantize_matrix(GPUMeshBuffer buffer)
+{
+	return dotm(translate_matrix(buffer.box_min, 1), scale_matrix(buffer.box_size));
+}
 
-		glGenVertexArrays(1, &quadVAO);
-		glGenBuffers(1, &quadVBO);
+static void compute_bounds(VertexArray vertices, Vector3 *lo, Vector3 *hi)
+{
+	*lo = (Vector3) {0, 0, 0};
+	*hi = (Vector3) {0, 0, 0};
+	for (int i = 0; i < vertices.size; i++) {
+		Vertex v = vertices.data[i];
+		if (i == 0 || v.x < lo->x) lo->x = v.x;
+		if (i == 0 || v.y < lo->y) lo->y = v.y;
+		if (i == 0 || v.z < lo->z) lo->z = v.z;
+		if (i == 0 || v.x > hi->x) hi->x = v.x;
+		if (i == 0 || v.y > hi->y) hi->y = v.y;
+		if (i == 0 || v.z > hi->z) hi->z = v.z;
+	}
+}
 
-		glBindVertexArray(quadVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+// Levels of detail pass the buffer of the full mesh as "base", so that
+// all levels are quantized in the same box and can be drawn with the
+// same object data
+static GPUMeshBuffer create_gpu_mesh_buffer(VertexArray vertices, const uint32_t *indices, int num_indices, const GPUMeshBuffer *base)
+{
+	Vector3 lo, hi;
+	compute_bounds(vertices, &lo, &hi);
 
-		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+	GPUMeshBuffer buffer = {0};
+	buffer.center = (Vector3) {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2};
+	buffer.radius = norm_of(combine(hi, lo, 1, -1)) / 2;
+	buffer.num_vertices = vertices.size;
+	buffer.num_indices  = num_indices;
+	buffer.first_vertex = alloc_mesh_range(&vertex_pool, mesh_vbos, vertex_stream_size, NUM_VERTEX_STREAMS, buffer.num_vertices);
+	buffer.first_index  = alloc_mesh_range(&index_pool, &mesh_ibo, &index_size, 1, buffer.num_indices);
+	buffer.placeholder  = false;
+
+	GPUPosition   *positions  = malloc(vertices.size * sizeof(GPUPosition));
+	GPUAttributes *attributes = malloc(vertices.size * sizeof(GPUAttributes));
+	if ((!positions || !attributes) && vertices.size > 0) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
 
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+#if QUANTIZE_VERTICES
+	if (base) {
+		buffer.box_min  = base->box_min;
+		buffer.box_size = base->box_size;
+	} else {
+		// Flat meshes would divide by zero
+		Vector3 size = {hi.x - lo.x, hi.y - lo.y, hi.z - lo.z};
+		if (size.x <= 0) size.x = 1;
+		if (size.y <= 0) size.y = 1;
+		if (size.z <= 0) size.z = 1;
+		buffer.box_min  = lo;
+		buffer.box_size = size;
+	}
+	quantize_vertices(vertices, positions, attributes, buffer.box_min, buffer.box_size);
+#else
+	(void) base;
+	for (int i = 0; i < vertices.size; i++) {
+		Vertex v = vertices.data[i];
+		positions[i]  = (GPUPosition)   {v.x, v.y, v.z};
+		attributes[i] = (GPUAttributes) {v.nx, v.ny, v.nz, v.tx, v.ty};
+	}
+	buffer.box_min  = (Vector3) {0, 0, 0};
+	buffer.box_size = (Vector3) {1, 1, 1};
+#endif
 
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mesh_vbos[STREAM_POSITIONS]);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, buffer.first_vertex * sizeof(GPUPosition), buffer.num_vertices * sizeof(GPUPosition), positions);
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mesh_vbos[STREAM_ATTRIBUTES]);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, buffer.first_vertex * sizeof(GPUAttributes), buffer.num_vertices * sizeof(GPUAttributes), attributes);
+
+	free(positions);
+	free(attributes);
+
+	if (num_indices > 0) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mesh_ibo);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, buffer.first_index * index_size, buffer.num_indices * index_size, indices);
 	}
 
-	glBindVertexArray(quadVAO);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
+	return buffer;
 }
 
-void init_graphics(void *window)
+static void free_gpu_mesh_buffer(GPUMeshBuffer buffer)
 {
-	window_ = window;
-
-	// Compile the main shaders
-	shader_program = compile_shader(
-		"assets/shaders/vertex.glsl",
-		"assets/shaders/fragment.glsl");
-
-	// The program which calculates the shadow map
-	shadow_program = compile_shader(
-		"assets/shaders/shadow_vertex.glsl",
-		"assets/shaders/shadow_fragment.glsl");
+	free(buffer.meshlets);
+	release_range(&vertex_pool, buffer.first_vertex, buffer.num_vertices);
+	release_range(&index_pool,  buffer.first_index,  buffer.num_indices);
+}
 
-	// Program to compute a cubemap from an image (only necessary at startup)
-	unsigned int equirectangular_to_cubemap_program = compile_shader(
-		"assets/shaders/cubemap_vertex.glsl",
-		"assets/shaders/equirectangular_to_cubemap_fragment.glsl");
+static ModelID add_mesh_buffer(GPUMeshBuffer buffer)
+{
+	// Look for a free struct
+	int i = 0;
+	while (i < num_mesh_buffers && (mesh_buffers[i].num_vertices != 0 || mesh_buffers[i].placeholder))
+		i++;
 
-	// Apply a low pass filter on the cubemap based on the roughness
-	// parameter (only necessary at startup)
-	unsigned int irradiance_convolution_program = compile_shader(
-		"assets/shaders/cubemap_vertex.glsl",
-		"assets/shaders/irradiance_convolution_fragment.glsl");
+	if (i == num_mesh_buffers) {
+		if (num_mesh_buffers == cap_mesh_buffers) {
+			cap_mesh_buffers = cap_mesh_buffers ? 2 * cap_mesh_buffers : 16;
+			mesh_buffers = realloc(mesh_buffers, cap_mesh_buffers * sizeof(GPUMeshBuffer));
+			if (!mesh_buffers) {
+				printf("OUT OF MEMORY\n");
+				abort();
+			}
+		}
+		num_mesh_buffers++;
+	}
 
-	// Render the high resolution cubemap
-	background_program = compile_shader(
-		"assets/shaders/background_vertex.glsl",
-		"assets/shaders/background_fragment.glsl");
+	mesh_buffers[i] = buffer;
+	return i+1;
+}
 
-	// Load the sphere mesh from memory
-	{
-		VertexArray vertices = make_sphere_mesh(0.5);
-		mesh_buffers[MODEL_SPHERE-1] = create_gpu_mesh_buffer(vertices);
-		free(vertices.data);
+// Gives the buffer its own copy of the meshlets of a level
+static void attach_meshlets(GPUMeshBuffer *buffer, MeshLOD lod)
+{
+	if (lod.num_meshlets == 0)
+		return;
+	buffer->meshlets = malloc(lod.num_meshlets * sizeof(Meshlet));
+	if (!buffer->meshlets) {
+		printf("OUT OF MEMORY\n");
+		abort();
 	}
+	memcpy(buffer->meshlets, lod.meshlets, lod.num_meshlets * sizeof(Meshlet));
+	buffer->num_meshlets = lod.num_meshlets;
+}
 
-	// Load the cube mesh from memory
-	{
-		VertexArray vertices = make_cube_mesh();
-		mesh_buffers[MODEL_CUBE-1] = create_gpu_mesh_buffer(vertices);
-		free(vertices.data);
+// Uploads the levels of detail of a mesh into the slot "id", which was
+// reserved by the caller. The coarser levels get IDs of their own that
+// are only reachable through the full mesh. The indices, if any, are
+// those of the full mesh.
+static void upload_model(ModelID id, const MeshLOD *lods, int num_lods, const uint32_t *indices, int num_indices)
+{
+	GPUMeshBuffer buffer = create_gpu_mesh_buffer(lods[0].vertices, indices, num_indices, NULL);
+	attach_meshlets(&buffer, lods[0]);
+	buffer.num_lods = num_lods;
+	for (int i = 1; i < num_lods; i++) {
+		GPUMeshBuffer level = create_gpu_mesh_buffer(lods[i].vertices, NULL, 0, &buffer);
+		attach_meshlets(&level, lods[i]);
+		buffer.lods[i-1] = add_mesh_buffer(level);
+		buffer.lod_error[i] = lods[i].error;
 	}
 
-	{
-		glGenFramebuffers(1, &captureFBO);
-		glGenRenderbuffers(1, &captureRBO);
+	// Adding the levels may have moved the array
+	mesh_buffers[id-1] = buffer;
+}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-		glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
+// Builds the levels of detail of a mesh and the meshlets of each level,
+// which reorders the triangles of "vertices" or "indices". Also called
+// by the loader threads.
+static int prepare_model(VertexArray vertices, uint32_t *indices, int num_indices, MeshLOD *lods)
+{
+	PROFILE_BEGIN("simplify mesh");
+	int num_lods = build_mesh_lods(vertices, indices, num_indices, lods);
+	PROFILE_END();
+
+	PROFILE_BEGIN("build meshlets");
+	for (int i = 0; i < num_lods; i++) {
+		if (i == 0)
+			lods[i].num_meshlets = build_meshlets(lods[i].vertices, indices, num_indices, &lods[i].meshlets);
+		else
+			lods[i].num_meshlets = build_meshlets(lods[i].vertices, NULL, 0, &lods[i].meshlets);
 	}
+	PROFILE_END();
 
-	{
-		stbi_set_flip_vertically_on_load(true);
-		int width, height, nrComponents;
-		float *data = stbi_loadf("assets/spruit_sunrise_4k.hdr", &width, &height, &nrComponents, 0);
-		if (!data) {
-			fprintf(stderr, "Couldn't load map\n");
-			abort();
-		}
+	return num_lods;
+}
 
-		glGenTextures(1, &hdrTexture);
-		glBindTexture(GL_TEXTURE_2D, hdrTexture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data); // note how we specify the texture's data value to be float
+static void build_model(ModelID id, VertexArray vertices, uint32_t *indices, int num_indices)
+{
+	MeshLOD lods[MAX_MESH_LODS];
+	int num_lods = prepare_model(vertices, indices, num_indices, lods);
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	PROFILE_BEGIN("upload mesh");
+	upload_model(id, lods, num_lods, indices, num_indices);
+	PROFILE_END();
 
-		stbi_image_free(data);
+	free_mesh_lods(lods, num_lods);
+}
+
+// Tessellation of MODEL_SPHERE
+#define SPHERE_SEGMENTS 32
+#define SPHERE_RINGS    32
+
+static void alloc_shape(ShapeSize size, VertexArray *vertices, uint32_t **indices)
+{
+	vertices->data = malloc(size.num_vertices * sizeof(Vertex));
+	vertices->size = size.num_vertices;
+	vertices->capacity = size.num_vertices;
+	*indices = malloc(size.num_indices * sizeof(uint32_t));
+	if (!vertices->data || !*indices) {
+		printf("OUT OF MEMORY\n");
+		abort();
 	}
+}
 
-	// Set up projection and view matrices for capturing data onto the 6 cubemap face directions
-	Matrix4 captureProjection = perspective_matrix(deg2rad(90.0f), 1.0f, 0.1f, 10.0f);
-	Matrix4 captureViews[] = {
-		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {1.0f,  0.0f,  0.0f}, (Vector3) {0.0f, -1.0f,  0.0f}),
-		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {-1.0f,  0.0f,  0.0f}, (Vector3) {0.0f, -1.0f,  0.0f}),
-		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {0.0f,  1.0f,  0.0f}, (Vector3) {0.0f,  0.0f,  1.0f}),
-		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {0.0f, -1.0f,  0.0f}, (Vector3) {0.0f,  0.0f, -1.0f}),
-		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {0.0f,  0.0f,  1.0f}, (Vector3) {0.0f, -1.0f,  0.0f}),
-		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {0.0f,  0.0f, -1.0f}, (Vector3) {0.0f, -1.0f,  0.0f})
-	};
-	{
-		glGenTextures(1, &envCubemap);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+ModelID load_3d_model(const char *file)
+{
+	PROFILE_BEGIN("parse mesh");
+	MeshData data;
+	bool ok = load_mesh_from_file(file, 0, &data);
+	PROFILE_END();
+
+	if (!ok)
+		return MODEL_INVALID;
+
+	if (data.vertices.size == 0 || (data.indices && data.num_indices == 0)) {
+		free_mesh_data(&data);
+		return MODEL_INVALID;
+	}
+
+	ModelID id = add_mesh_buffer((GPUMeshBuffer) {.placeholder = true});
+	build_model(id, data.vertices, data.indices, data.num_indices);
+	mesh_buffers[id-1].material = data.material;
+	free_mesh_data(&data);
+	return id;
+}
+
+/*
+ * Asynchronous model loading
+ *
+ * The ID of the model is reserved right away and the file is read and
+ * parsed by a thread of its own, since only a handful of models are
+ * loaded at once. The GL thread uploads the vertices when it collects
+ * the results in update_graphics. Until then draw calls with that ID
+ * are turned into spheres.
+ */
+
+typedef struct {
+	ModelID     id;
+	char       *file;
+	pthread_t   thread;
+	bool        done;    // Set by the worker, under load_mutex
+	bool        ok;
+	bool        discard; // The model was freed while loading
+	MeshData    data;
+	MeshLOD     lods[MAX_MESH_LODS];
+	int         num_lods;
+} ModelLoad;
+
+static ModelLoad **model_loads;
+static int num_model_loads;
+static int cap_model_loads;
+
+static pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *model_load_thread(void *arg)
+{
+	ModelLoad *load = arg;
+
+	PROFILE_BEGIN("parse mesh");
+	MeshData data;
+	bool ok = load_mesh_from_file(load->file, 1, &data);
+	PROFILE_END();
+
+	if (data.vertices.size == 0 || (data.indices && data.num_indices == 0))
+		ok = false;
+
+	int num_lods = 0;
+	if (ok)
+		num_lods = prepare_model(data.vertices, data.indices, data.num_indices, load->lods);
+
+	pthread_mutex_lock(&load_mutex);
+	load->ok = ok;
+	load->data = data;
+	load->num_lods = num_lods;
+	load->done = true;
+	pthread_mutex_unlock(&load_mutex);
+	return NULL;
+}
+
+// Only for the threads spawned by load_3d_model_async, since the ring
+// of the main thread must outlive a load it runs itself
+static void *model_load_thread_main(void *arg)
+{
+	model_load_thread(arg);
+	profile_thread_exit();
+	return NULL;
+}
+
+static void invalidate_static_batches_using(ModelID id);
+
+ModelID load_3d_model_async(const char *file)
+{
+	size_t len = strlen(file);
+	ModelLoad *load = malloc(sizeof(ModelLoad) + len + 1);
+	if (!load) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+	*load = (ModelLoad) {.file = (char*) (load + 1)};
+	memcpy(load->file, file, len + 1);
+
+	if (num_model_loads == cap_model_loads) {
+		cap_model_loads = cap_model_loads ? 2 * cap_model_loads : 8;
+		model_loads = realloc(model_loads, cap_model_loads * sizeof(ModelLoad*));
+		if (!model_loads) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+	}
+
+	load->id = add_mesh_buffer((GPUMeshBuffer) {.placeholder = true});
+
+	if (pthread_create(&load->thread, NULL, model_load_thread_main, load)) {
+		// Parse it here then, it will be uploaded all the same
+		model_load_thread(load);
+		load->thread = pthread_self();
+	}
+
+	model_loads[num_model_loads++] = load;
+	return load->id;
+}
+
+static bool finish_model_load(ModelLoad *load)
+{
+	if (!pthread_equal(load->thread, pthread_self()))
+		pthread_join(load->thread, NULL);
+
+	bool ok = load->ok;
+
+	if (load->discard) {
+		mesh_buffers[load->id-1] = (GPUMeshBuffer) {0};
+	} else if (ok) {
+		PROFILE_BEGIN("upload mesh");
+		upload_model(load->id, load->lods, load->num_lods, load->data.indices, load->data.num_indices);
+		mesh_buffers[load->id-1].material = load->data.material;
+		PROFILE_END();
+		invalidate_static_batches_using(load->id);
+		request_redraw();
+	} else {
+		printf("Couldn't load model '%s'\n", load->file);
+	}
+
+	free_mesh_lods(load->lods, load->num_lods);
+	free_mesh_data(&load->data);
+	free(load);
+	return ok;
+}
+
+// Uploads the models that finished loading, or all of them if "wait"
+// is set. Returns false if any of the collected ones failed.
+static bool collect_model_loads(bool wait)
+{
+	bool ok = true;
+	int i = 0;
+	while (i < num_model_loads) {
+
+		ModelLoad *load = model_loads[i];
+
+		pthread_mutex_lock(&load_mutex);
+		bool done = load->done;
+		pthread_mutex_unlock(&load_mutex);
+
+		if (!done && !wait) {
+			i++;
+			continue;
+		}
+
+		if (!finish_model_load(load))
+			ok = false;
+		model_loads[i] = model_loads[--num_model_loads];
+	}
+	return ok;
+}
+
+bool wait_for_models(void)
+{
+	PROFILE_BEGIN("wait for models");
+	bool ok = collect_model_loads(true);
+	PROFILE_END();
+	return ok;
+}
+
+bool get_model_material(ModelID id, Material *mat)
+{
+	if (id == MODEL_INVALID || id > (ModelID) num_mesh_buffers)
+		return false;
+
+	MeshMaterial material = mesh_buffers[id-1].material;
+	if (!material.present)
+		return false;
+
+	mat->baseColor = (Vector3) {material.base_color[0], material.base_color[1], material.base_color[2]};
+	mat->metallic = material.metallic;
+	mat->perceptualRoughness = material.roughness;
+	mat->reflectance = 0.5f; // Not part of the metallic-roughness model
+	return true;
+}
+
+bool is_model_loading(ModelID id)
+{
+	for (int i = 0; i < num_model_loads; i++)
+		if (model_loads[i]->id == id)
+			return true;
+	return false;
+}
+
+// The ID that is actually drawn in place of "id"
+static ModelID resident_model(ModelID id)
+{
+	if (id != MODEL_INVALID && id <= (ModelID) num_mesh_buffers && mesh_buffers[id-1].placeholder)
+		return MODEL_SPHERE;
+	return id;
+}
+
+void free_3d_model(ModelID id)
+{
+	if (id == 0 || id == MODEL_SPHERE || id == MODEL_CUBE || id > (ModelID) num_mesh_buffers)
+		return;
+
+	if (mesh_buffers[id-1].placeholder) {
+		for (int i = 0; i < num_model_loads; i++)
+			if (model_loads[i]->id == id) {
+				// The slot is released when the thread is done
+				model_loads[i]->discard = true;
+				return;
+			}
+		mesh_buffers[id-1] = (GPUMeshBuffer) {0};
+		return;
+	}
+
+	GPUMeshBuffer buffer = mesh_buffers[id-1];
+	for (int i = 1; i < buffer.num_lods; i++) {
+		free_gpu_mesh_buffer(mesh_buffers[buffer.lods[i-1]-1]);
+		mesh_buffers[buffer.lods[i-1]-1] = (GPUMeshBuffer) {0};
+	}
+	free_gpu_mesh_buffer(buffer);
+	mesh_buffers[id-1] = (GPUMeshBuffer) {0};
+
+	// The ID may be reused by a different mesh
+	invalidate_shadow_map();
+}
+
+MeshMemoryStats get_mesh_memory_stats(void)
+{
+	MeshMemoryStats stats;
+	stats.vertices = get_range_pool_stats(&vertex_pool);
+	stats.indices  = get_range_pool_stats(&index_pool);
+	return stats;
+}
+
+static void bind_object_data(size_t offset)
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BINDING, object_stream.buffer, offset, sizeof(ObjectData));
+}
+
+static void draw_mesh_buffer(GPUMeshBuffer buffer)
+{
+	if (buffer.num_indices > 0) {
+		glDrawElementsBaseVertex(GL_TRIANGLES, buffer.num_indices, GL_UNSIGNED_INT,
+			(void*) (buffer.first_index * sizeof(uint32_t)), buffer.first_vertex);
+		count_draw(buffer.num_indices / 3);
+	} else {
+		glDrawArrays(GL_TRIANGLES, buffer.first_vertex, buffer.num_vertices);
+		count_draw(buffer.num_vertices / 3);
+	}
+}
+
+unsigned int cubeVAO = 0;
+unsigned int cubeVBO = 0;
+unsigned int cubeEBO = 0;
+void renderCube()
+{
+	ShapeSize size = cube_size();
+
+	// initialize (if necessary)
+	if (cubeVAO == 0) {
+
+		glGenVertexArrays(1, &cubeVAO);
+		glGenBuffers(1, &cubeVBO);
+		glGenBuffers(1, &cubeEBO);
+
+		glBindVertexArray(cubeVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+		glBufferData(GL_ARRAY_BUFFER, size.num_vertices * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, size.num_indices * sizeof(uint32_t), NULL, GL_STATIC_DRAW);
+
+		// The attributes are laid out like Vertex, so the cube is built
+		// straight into the buffers
+		GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+		Vertex   *vertices = glMapBufferRange(GL_ARRAY_BUFFER, 0, size.num_vertices * sizeof(Vertex), access);
+		uint32_t *indices  = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, size.num_indices * sizeof(uint32_t), access);
+		if (vertices && indices)
+			build_cube((Vector3) {-1, -1, -1}, (Vector3) {1, 1, 1}, vertices, indices);
+		else
+			printf("Couldn't map the cube buffers\n");
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+
+		// link vertex attributes
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, x));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, nx));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, tx));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	// render Cube
+	bind_vao(cubeVAO);
+	glDrawElements(GL_TRIANGLES, size.num_indices, GL_UNSIGNED_INT, NULL);
+	count_draw(size.num_indices / 3);
+	glBindVertexArray(0);
+}
+
+// renderQuad() renders a 1x1 XY quad in NDC
+// -----------------------------------------
+unsigned int quadVAO = 0;
+unsigned int quadVBO;
+void renderQuad()
+{
+	if (quadVAO == 0) {
+
+		float quadVertices[] = {
+			// positions        // texture Coords
+			-1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
+			-1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
+			1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
+			1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
+		};
+
+		// setup plane VAO
+
+		glGenVertexArrays(1, &quadVAO);
+		glGenBuffers(1, &quadVBO);
+
+		glBindVertexArray(quadVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+
+		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+	}
+
+	bind_vao(quadVAO);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	count_draw(2);
+	glBindVertexArray(0);
+}
+
+/*
+ * Stats overlay
+ *
+ * Text and graph are made of solid quads in screen pixels, rebuilt every
+ * frame and drawn with a single call. The font only covers what the
+ * overlay prints: ASCII 32 to 90, 3x5 pixels per glyph.
+ */
+
+#define OVERLAY_SCALE     2    // Screen pixels per font pixel
+#define OVERLAY_MAX_QUADS 4096
+#define OVERLAY_GRAPH_MS  33.3f // Frame time at the top of the graph
+
+typedef struct {
+	float x, y;
+	Vector4 color;
+} OverlayVertex;
+
+// One bit per pixel, the first row in the highest bits
+static const uint16_t overlay_font[] = {
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x52a5, 0x0000, 0x0000,
+	0x2922, 0x224a, 0x0000, 0x05d0, 0x0014, 0x01c0, 0x0002, 0x12a4,
+	0x7b6f, 0x2c97, 0x73e7, 0x72cf, 0x5bc9, 0x79cf, 0x79ef, 0x7292,
+	0x7bef, 0x7bcf, 0x0410, 0x0000, 0x0000, 0x0e38, 0x0000, 0x0000,
+	0x0000, 0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7, 0x79a4, 0x396b,
+	0x5bed, 0x7497, 0x126a, 0x5bad, 0x4927, 0x5fed, 0x6b6d, 0x2b6a,
+	0x6ba4, 0x2b73, 0x6bad, 0x388e, 0x7492, 0x5b6f, 0x5b6a, 0x5bfd,
+	0x5aad, 0x5a92, 0x72a7,
+};
+
+static bool stats_overlay = false;
+static unsigned int overlay_program;
+static unsigned int overlay_vao;
+static unsigned int overlay_vbo;
+static OverlayVertex overlay_vertices[OVERLAY_MAX_QUADS * 6];
+static int overlay_num_quads;
+
+void show_stats_overlay(bool yes)
+{
+	stats_overlay = yes;
+	request_redraw();
+}
+
+static void init_overlay(void)
+{
+	overlay_program = compile_shader(
+		"assets/shaders/overlay_vertex.glsl",
+		"assets/shaders/overlay_fragment.glsl");
+
+	glGenVertexArrays(1, &overlay_vao);
+	glGenBuffers(1, &overlay_vbo);
+
+	glBindVertexArray(overlay_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, overlay_vbo);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void*) offsetof(OverlayVertex, x));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void*) offsetof(OverlayVertex, color));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+static void overlay_rect(float x, float y, float w, float h, Vector4 color)
+{
+	if (overlay_num_quads == OVERLAY_MAX_QUADS)
+		return;
+
+	OverlayVertex *v = &overlay_vertices[overlay_num_quads * 6];
+	v[0] = (OverlayVertex) {x,     y,     color};
+	v[1] = (OverlayVertex) {x + w, y,     color};
+	v[2] = (OverlayVertex) {x + w, y + h, color};
+	v[3] = (OverlayVertex) {x,     y,     color};
+	v[4] = (OverlayVertex) {x + w, y + h, color};
+	v[5] = (OverlayVertex) {x,     y + h, color};
+	overlay_num_quads++;
+}
+
+// Draws a line of text with its top-left corner at (x, y)
+static void overlay_text(float x, float y, Vector4 color, const char *fmt, ...)
+{
+	char line[128];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	for (int i = 0; line[i]; i++) {
+		int c = line[i];
+		if (c >= 'a' && c <= 'z')
+			c = c - 'a' + 'A';
+		if (c < 32 || c > 90)
+			c = ' ';
+
+		uint16_t glyph = overlay_font[c - 32];
+		for (int row = 0; row < 5; row++)
+			for (int col = 0; col < 3; col++)
+				if (glyph & (1 << (14 - row * 3 - col)))
+					overlay_rect(x + (i * 4 + col) * OVERLAY_SCALE, y + row * OVERLAY_SCALE, OVERLAY_SCALE, OVERLAY_SCALE, color);
+	}
+}
+
+static void draw_stats_overlay(int width, int height)
+{
+	FrameStats stats = get_frame_stats();
+
+	Vector4 background = {0, 0, 0, 0.6f};
+	Vector4 white      = {1, 1, 1, 1};
+	Vector4 gray       = {0.6f, 0.6f, 0.6f, 1};
+	float line_height = 7 * OVERLAY_SCALE;
+	float x = 10 + 2 * OVERLAY_SCALE;
+	float y = 10 + 2 * OVERLAY_SCALE;
+
+	overlay_num_quads = 0;
+
+	float graph_h = 64;
+	int num_lines = 5 + (GPU_MEMORY_COUNT + 1) / 2 + 1;
+	float panel_w = 52 * 4 * OVERLAY_SCALE;
+	float panel_h = num_lines * line_height + graph_h + 4 * OVERLAY_SCALE;
+	overlay_rect(10, 10, panel_w, panel_h, background);
+
+	overlay_text(x, y, white, "FRAME %.2f MS  P50 %.2f  P95 %.2f  P99 %.2f",
+		stats.frame_time_avg, stats.frame_time_p50, stats.frame_time_p95, stats.frame_time_p99);
+	y += line_height;
+	overlay_text(x, y, white, "GPU SHADOW %.2f  MAIN %.2f  SKYBOX %.2f MS",
+		get_gpu_zone_time(GPU_ZONE_SHADOW), get_gpu_zone_time(GPU_ZONE_MAIN), get_gpu_zone_time(GPU_ZONE_SKYBOX));
+	y += line_height;
+	overlay_text(x, y, white, "DRAWS %d  TRIANGLES %d  CULLED MESHLETS %d", stats.draw_calls, stats.triangles, stats.meshlets_culled);
+	y += line_height;
+	overlay_text(x, y, white, "BINDS: PROGRAM %d  VAO %d  TEXTURE %d  UNIFORMS %d",
+		stats.program_binds, stats.vao_binds, stats.texture_binds, stats.uniforms_set);
+	y += line_height;
+	overlay_text(x, y, white, "COMMANDS %d  DROPPED %d  SHADOWS %s",
+		stats.commands_queued, stats.commands_dropped, stats.shadow_map_cached ? "CACHED" : "RENDERED");
+	y += line_height;
+	for (int i = 0; i < GPU_MEMORY_COUNT; i += 2) {
+		char line[128];
+		int len = 0;
+		for (int j = i; j < i + 2 && j < GPU_MEMORY_COUNT; j++)
+			len += snprintf(line + len, sizeof(line) - len, "%s %.1f MB  ",
+				get_gpu_memory_category_name(j), stats.gpu_memory[j] / (1024.0f * 1024.0f));
+		overlay_text(x, y, gray, "%s", line);
+		y += line_height;
+	}
+	y += line_height;
+
+	// Frame time graph, newest on the right, with a line at 60 FPS
+	float bar_w = panel_w / FRAME_TIME_HISTORY;
+	overlay_rect(10, y + graph_h * (1 - 16.7f / OVERLAY_GRAPH_MS), panel_w, 1, gray);
+	for (int i = 0; i < num_frame_times; i++) {
+		float ms = frame_times[(next_frame_time - num_frame_times + i + FRAME_TIME_HISTORY) % FRAME_TIME_HISTORY];
+		float h = graph_h * (ms < OVERLAY_GRAPH_MS ? ms : OVERLAY_GRAPH_MS) / OVERLAY_GRAPH_MS;
+
+		Vector4 color = {0.2f, 0.9f, 0.2f, 1};
+		if (ms > 16.7f) color = (Vector4) {0.9f, 0.8f, 0.2f, 1};
+		if (ms > 33.3f) color = (Vector4) {0.9f, 0.2f, 0.2f, 1};
+
+		float bar_x = 10 + panel_w - (num_frame_times - i) * bar_w;
+		overlay_rect(bar_x, y + graph_h - h, bar_w, h, color);
+	}
+
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(overlay_program);
+	glUniform2f(glGetUniformLocation(overlay_program, "screen_size"), width, height);
+
+	glBindBuffer(GL_ARRAY_BUFFER, overlay_vbo);
+	glBufferData(GL_ARRAY_BUFFER, overlay_num_quads * 6 * sizeof(OverlayVertex), overlay_vertices, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindVertexArray(overlay_vao);
+	glDrawArrays(GL_TRIANGLES, 0, overlay_num_quads * 6);
+	glBindVertexArray(0);
+
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+}
+
+void init_graphics(void *window)
+{
+	window_ = window;
+
+	PROFILE_BEGIN("init_graphics");
+
+	// The precomputation below is measured as if it was a frame
+	init_gpu_timers();
+	begin_gpu_frame();
+
+	PROFILE_BEGIN("compile shaders");
+
+	// Compile the main shaders
+	shader_program = compile_shader(
+		"assets/shaders/vertex.glsl",
+		"assets/shaders/fragment.glsl");
+
+	// The program which calculates the shadow map
+	shadow_program = compile_shader(
+		"assets/shaders/shadow_vertex.glsl",
+		"assets/shaders/shadow_fragment.glsl");
+
+	// Per-object data is streamed through a uniform buffer instead of
+	// being set uniform by uniform for each draw call
+	{
+		glUniformBlockBinding(shader_program, glGetUniformBlockIndex(shader_program, "Object"), OBJECT_BINDING);
+		glUniformBlockBinding(shadow_program, glGetUniformBlockIndex(shadow_program, "Object"), OBJECT_BINDING);
+
+		int align;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		object_align = align;
+
+		size_t stride = (sizeof(ObjectData) + object_align - 1) / object_align * object_align;
+		if (!init_stream_buffer(&object_stream, GL_UNIFORM_BUFFER, stride * COMMAND_QUEUE_SIZE)) {
+			fprintf(stderr, "Couldn't create the object stream buffer\n");
+			abort();
+		}
+		gpu_memory[GPU_MEMORY_STREAMING] += stride * COMMAND_QUEUE_SIZE * STREAM_FRAMES;
+	}
+
+	// Program to compute a cubemap from an image (only necessary at startup)
+	unsigned int equirectangular_to_cubemap_program = compile_shader(
+		"assets/shaders/cubemap_vertex.glsl",
+		"assets/shaders/equirectangular_to_cubemap_fragment.glsl");
+
+	// Apply a low pass filter on the cubemap based on the roughness
+	// parameter (only necessary at startup)
+	unsigned int irradiance_convolution_program = compile_shader(
+		"assets/shaders/cubemap_vertex.glsl",
+		"assets/shaders/irradiance_convolution_fragment.glsl");
+
+	// Render the high resolution cubemap
+	background_program = compile_shader(
+		"assets/shaders/background_vertex.glsl",
+		"assets/shaders/background_fragment.glsl");
+
+	PROFILE_END();
+	PROFILE_BEGIN("mesh storage");
+
+	init_mesh_storage();
+
+	// Reserve the IDs of the builtin meshes before their levels of
+	// detail take others
+	{
+		ModelID sphere = add_mesh_buffer((GPUMeshBuffer) {.placeholder = true});
+		ModelID cube   = add_mesh_buffer((GPUMeshBuffer) {.placeholder = true});
+		assert(sphere == MODEL_SPHERE);
+		assert(cube == MODEL_CUBE);
+	}
+
+	{
+		ShapeSize size = sphere_size(SPHERE_SEGMENTS, SPHERE_RINGS);
+		VertexArray vertices;
+		uint32_t *indices;
+		alloc_shape(size, &vertices, &indices);
+		build_sphere(0.5, SPHERE_SEGMENTS, SPHERE_RINGS, vertices.data, indices);
+		build_model(MODEL_SPHERE, vertices, indices, size.num_indices);
+		free(vertices.data);
+		free(indices);
+	}
+
+	{
+		ShapeSize size = cube_size();
+		VertexArray vertices;
+		uint32_t *indices;
+		alloc_shape(size, &vertices, &indices);
+		build_cube((Vector3) {0, 0, 0}, (Vector3) {1, 1, 1}, vertices.data, indices);
+		build_model(MODEL_CUBE, vertices, indices, size.num_indices);
+		free(vertices.data);
+		free(indices);
+	}
+
+	{
+		glGenFramebuffers(1, &captureFBO);
+		glGenRenderbuffers(1, &captureRBO);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
+
+		// Resized by the IBL passes, but it ends up at 512x512 again
+		gpu_memory[GPU_MEMORY_TARGETS] += 512 * 512 * 4;
+	}
+
+	PROFILE_END();
+	PROFILE_BEGIN("load environment map");
+
+	{
+		stbi_set_flip_vertically_on_load(true);
+		int width, height, nrComponents;
+		float *data = NULL;
+		MappedFile file;
+		if (map_file("assets/spruit_sunrise_4k.hdr", &file)) {
+			data = stbi_loadf_from_memory((unsigned char*) file.data, file.size, &width, &height, &nrComponents, 0);
+			unmap_file(&file);
+		}
+		if (!data) {
+			fprintf(stderr, "Couldn't load map\n");
+			abort();
+		}
+
+		glGenTextures(1, &hdrTexture);
+		glBindTexture(GL_TEXTURE_2D, hdrTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data); // note how we specify the texture's data value to be float
+		gpu_memory[GPU_MEMORY_TEXTURES] += (size_t) width * height * 6;
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		stbi_image_free(data);
+	}
+
+	// Set up projection and view matrices for capturing data onto the 6 cubemap face directions
+	Matrix4 captureProjection = perspective_matrix(deg2rad(90.0f), 1.0f, 0.1f, 10.0f);
+	Matrix4 captureViews[] = {
+		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {1.0f,  0.0f,  0.0f}, (Vector3) {0.0f, -1.0f,  0.0f}),
+		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {-1.0f,  0.0f,  0.0f}, (Vector3) {0.0f, -1.0f,  0.0f}),
+		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {0.0f,  1.0f,  0.0f}, (Vector3) {0.0f,  0.0f,  1.0f}),
+		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {0.0f, -1.0f,  0.0f}, (Vector3) {0.0f,  0.0f, -1.0f}),
+		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {0.0f,  0.0f,  1.0f}, (Vector3) {0.0f, -1.0f,  0.0f}),
+		lookat_matrix((Vector3) {0.0f, 0.0f, 0.0f}, (Vector3) {0.0f,  0.0f, -1.0f}, (Vector3) {0.0f, -1.0f,  0.0f})
+	};
+	{
+		glGenTextures(1, &envCubemap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 		for (unsigned int i = 0; i < 6; ++i)
 			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 512, 512, 0, GL_RGB, GL_FLOAT, NULL);
+		gpu_memory[GPU_MEMORY_TEXTURES] += 6 * 512 * 512 * 6;
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		PROFILE_END();
+		PROFILE_BEGIN("IBL cubemap");
+		begin_gpu_zone(GPU_ZONE_IBL_CUBEMAP);
+
+		// pbr: convert HDR equirectangular environment map to cubemap equivalent
+		// ----------------------------------------------------------------------
+		glUseProgram(equirectangular_to_cubemap_program);
+		glUniform1i(glGetUniformLocation(equirectangular_to_cubemap_program, "equirectangularMap"), 0);
+		glUniformMatrix4fv(glGetUniformLocation(equirectangular_to_cubemap_program, "projection"), 1, false, (float*) &captureProjection);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, hdrTexture);
+
+		glViewport(0, 0, 512, 512); // don't forget to configure the viewport to the capture dimensions.
+		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+		for (unsigned int i = 0; i < 6; i++) {
+			glUniformMatrix4fv(glGetUniformLocation(equirectangular_to_cubemap_program, "view"), 1, false, (float*) &captureViews[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			renderCube();
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	end_gpu_zone(GPU_ZONE_IBL_CUBEMAP);
+	PROFILE_END();
+	PROFILE_BEGIN("IBL irradiance");
+	begin_gpu_zone(GPU_ZONE_IBL_IRRADIANCE);
+
+	{
+		// pbr: create an irradiance cubemap, and re-scale capture FBO to irradiance scale.
+		glGenTextures(1, &irradianceMap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+		for (unsigned int i = 0; i < 6; ++i)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0, GL_RGB, GL_FLOAT, NULL);
+		gpu_memory[GPU_MEMORY_TEXTURES] += 6 * 32 * 32 * 6;
+
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-		// pbr: convert HDR equirectangular environment map to cubemap equivalent
-		// ----------------------------------------------------------------------
-		glUseProgram(equirectangular_to_cubemap_program);
-		glUniform1i(glGetUniformLocation(equirectangular_to_cubemap_program, "equirectangularMap"), 0);
-		glUniformMatrix4fv(glGetUniformLocation(equirectangular_to_cubemap_program, "projection"), 1, false, (float*) &captureProjection);
+		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
+	}
+
+	{
+		glUseProgram(irradiance_convolution_program);
+		glUniform1i(glGetUniformLocation(irradiance_convolution_program, "environmentMap"), 0);
+		glUniformMatrix4fv(glGetUniformLocation(irradiance_convolution_program, "projection"), 1, GL_FALSE, (float*) &captureProjection);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+
+		glViewport(0, 0, 32, 32); // don't forget to configure the viewport to the capture dimensions.
+		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			glUniformMatrix4fv(glGetUniformLocation(irradiance_convolution_program, "view"), 1, GL_FALSE, (float*) &captureViews[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			renderCube();
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	end_gpu_zone(GPU_ZONE_IBL_IRRADIANCE);
+	PROFILE_END();
+
+	{
+		glGenFramebuffers(1, &depth_map_fbo);
+
+		// One layer per cascade
+		glGenTextures(1, &depth_map);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, depth_map);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, SHADOW_WIDTH, SHADOW_HEIGHT, NUM_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		gpu_memory[GPU_MEMORY_SHADOW_MAP] += SHADOW_WIDTH * SHADOW_HEIGHT * NUM_CASCADES * 4;
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+		// Outside of the map nothing is in shadow
+		float border[] = {1, 1, 1, 1};
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+
+		// Lookups return the filtered result of the depth comparison
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_map, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	PROFILE_BEGIN("IBL prefilter");
+	begin_gpu_zone(GPU_ZONE_IBL_PREFILTER);
+
+	{
+		glGenTextures(1, &prefilterMap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, NULL);
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+		size_t texels = 0;
+		for (int size = 128; size > 0; size /= 2)
+			texels += size * size;
+		gpu_memory[GPU_MEMORY_TEXTURES] += 6 * texels * 6;
+	}
+
+	unsigned int prefilter_program = compile_shader("assets/shaders/cubemap_vertex.glsl", "assets/shaders/prefilter_fragment.glsl");
+
+	{
+		glUseProgram(prefilter_program);
+		glUniform1i(glGetUniformLocation(prefilter_program, "environmentMap"), 0);
+		glUniformMatrix4fv(glGetUniformLocation(prefilter_program, "projection"), 1, false, (float*) &captureProjection);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+		unsigned int maxMipLevels = 5;
+		for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
+		{
+			// reisze framebuffer according to mip-level size.
+			unsigned int mipWidth  = 128 * pow(0.5, mip);
+			unsigned int mipHeight = 128 * pow(0.5, mip);
+			glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
+			glViewport(0, 0, mipWidth, mipHeight);
+
+			float roughness = (float)mip / (float)(maxMipLevels - 1);
+
+			glUniform1f(glGetUniformLocation(prefilter_program, "roughness"), roughness);
+
+			for (unsigned int i = 0; i < 6; ++i)
+			{
+				glUniformMatrix4fv(glGetUniformLocation(prefilter_program, "view"), 1, false, (float*) &captureViews[i]);
+
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
+									GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, mip);
+
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				renderCube();
+			}
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);  
+	}
+
+	end_gpu_zone(GPU_ZONE_IBL_PREFILTER);
+	PROFILE_END();
+	PROFILE_BEGIN("IBL BRDF LUT");
+
+	unsigned int brdf_program = compile_shader("assets/shaders/brdf_vertex.glsl", "assets/shaders/brdf_fragment.glsl");
+
+	{
+		glGenTextures(1, &brdfLUTTexture);
+
+		// pre-allocate enough memory for the LUT texture.
+		glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
+		gpu_memory[GPU_MEMORY_TEXTURES] += 512 * 512 * 4;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUTTexture, 0);
+
+		glViewport(0, 0, 512, 512);
+		glUseProgram(brdf_program);
+		begin_gpu_zone(GPU_ZONE_IBL_BRDF);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		renderQuad();
+		end_gpu_zone(GPU_ZONE_IBL_BRDF);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);  
+	}
+
+	unsigned int rect_program = compile_shader("assets/shaders/brdf_vertex.glsl", "assets/shaders/rect_fragment.glsl");
+
+	unsigned int depth_render_buffer;
+
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+
+	init_overlay();
+
+	// Wait for the precomputation so that its cost isn't attributed to
+	// the first frame
+	glFinish();
+	end_gpu_frame();
+	flush_gpu_timers();
+
+	// Don't attribute the startup work to the first frame
+	memset(&frame_stats, 0, sizeof(frame_stats));
+
+	PROFILE_END();
+	PROFILE_END();
+}
+
+typedef struct {
+	ModelID  model_id;
+	Matrix4  model;
+	Matrix4  normal;
+	Material mat;
+	size_t   object_offset;
+} DrawCommand;
+static DrawCommand command_queue[COMMAND_QUEUE_SIZE];
+static int command_queue_head;
+static int command_queue_used;
+
+static void clear_commands(void)
+{
+	command_queue_head = 0;
+	command_queue_used = 0;
+}
+
+
+// Writes the model matrices and materials of all queued commands to the
+// stream buffer. Both the shadow and lit passes read the same copy.
+static void upload_object_data(void)
+{
+	begin_stream_frame(&object_stream);
+
+	for (int i = 0; i < command_queue_used; i++) {
+
+		DrawCommand *command = &command_queue[(command_queue_head + i) % COMMAND_QUEUE_SIZE];
+
+		ObjectData *data = alloc_stream_data(&object_stream, sizeof(ObjectData), object_align, &command->object_offset);
+		if (data == NULL) {
+			frame_stats.commands_dropped += command_queue_used - i;
+			command_queue_used = i;
+			break;
+		}
+		data->model = dotm(command->model, dequantize_matrix(mesh_buffers[command->model_id-1]));
+		data->norm  = command->normal;
+		data->baseColor = command->mat.baseColor;
+		data->perceptualRoughness = command->mat.perceptualRoughness;
+		data->metallic    = command->mat.metallic;
+		data->reflectance = command->mat.reflectance;
+	}
+
+	flush_stream_buffer(&object_stream);
+}
+
+// How a pass maps object space errors to pixels. Orthographic passes
+// have the same scale everywhere, perspective ones divide it by the
+// distance from the eye. Passes that cull meshlets also set the matrix
+// they project with.
+typedef struct {
+	bool    perspective;
+	Vector3 eye;
+	float   pixels_per_unit;
+	float   max_error;
+	bool    cull_meshlets;
+	Matrix4 view_projection;
+} PassView;
+
+static ModelID select_lod(ModelID id, Matrix4 model, PassView view)
+{
+	GPUMeshBuffer *buffer = &mesh_buffers[id-1];
+	if (buffer->num_lods < 2)
+		return id;
+
+	float max_scale = 0;
+	for (int i = 0; i < 3; i++) {
+		Vector3 axis = {model.data[i][0], model.data[i][1], model.data[i][2]};
+		float s = norm_of(axis);
+		if (s > max_scale) max_scale = s;
+	}
+
+	float pixels_per_unit = view.pixels_per_unit * max_scale;
+	if (view.perspective) {
+		Vector4 center = rdotv(model, (Vector4) {buffer->center.x, buffer->center.y, buffer->center.z, 1});
+		Vector3 offset = {center.x - view.eye.x, center.y - view.eye.y, center.z - view.eye.z};
+		float distance = norm_of(offset) - buffer->radius * max_scale;
+		if (distance <= CAMERA_NEAR)
+			return id;
+		pixels_per_unit /= distance;
+	}
+
+	int level = 0;
+	while (level+1 < buffer->num_lods && buffer->lod_error[level+1] * pixels_per_unit <= view.max_error)
+		level++;
+
+	return level == 0 ? id : buffer->lods[level-1];
+}
+
+// Ranges passed to the multi-draw calls
+static GLint   *meshlet_firsts;
+static GLsizei *meshlet_counts;
+static void   **meshlet_offsets;
+static GLint   *meshlet_base_vertices;
+static int      cap_meshlet_ranges;
+
+static void reserve_meshlet_ranges(int count)
+{
+	if (count <= cap_meshlet_ranges)
+		return;
+	cap_meshlet_ranges = count;
+	meshlet_firsts        = realloc(meshlet_firsts,        count * sizeof(GLint));
+	meshlet_counts        = realloc(meshlet_counts,        count * sizeof(GLsizei));
+	meshlet_offsets       = realloc(meshlet_offsets,       count * sizeof(void*));
+	meshlet_base_vertices = realloc(meshlet_base_vertices, count * sizeof(GLint));
+	if (!meshlet_firsts || !meshlet_counts || !meshlet_offsets || !meshlet_base_vertices) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+}
+
+// Draws the meshlets of a mesh that are in the frustum and face the
+// eye, merging neighboring ones in one range. Both tests are done in
+// object space, so non-uniform scales need no special care.
+static void draw_meshlets(GPUMeshBuffer buffer, Matrix4 model, PassView view)
+{
+	Matrix4 inverse;
+	if (!invert(model, &inverse)) {
+		draw_mesh_buffer(buffer);
+		return;
+	}
+	Vector4 eye = rdotv(inverse, (Vector4) {view.eye.x, view.eye.y, view.eye.z, 1});
+
+	// Frustum planes of the model-view-projection matrix, pointing in
+	Matrix4 m = dotm(view.view_projection, model);
+	Vector4 planes[6];
+	for (int i = 0; i < 3; i++)
+		for (int sign = 0; sign < 2; sign++) {
+			float f = sign ? -1 : 1;
+			Vector4 p = {
+				m.data[0][3] + f * m.data[0][i],
+				m.data[1][3] + f * m.data[1][i],
+				m.data[2][3] + f * m.data[2][i],
+				m.data[3][3] + f * m.data[3][i],
+			};
+			float len = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+			if (len > 0) {
+				p.x /= len;
+				p.y /= len;
+				p.z /= len;
+				p.w /= len;
+			}
+			planes[2 * i + sign] = p;
+		}
+
+	reserve_meshlet_ranges(buffer.num_meshlets);
+
+	int num_ranges = 0;
+	int triangles = 0;
+	int range_end = -1;
+	for (int i = 0; i < buffer.num_meshlets; i++) {
+
+		Meshlet meshlet = buffer.meshlets[i];
+
+		bool visible = true;
+		for (int j = 0; j < 6 && visible; j++) {
+			Vector4 p = planes[j];
+			Vector3 c = meshlet.center;
+			if (p.x * c.x + p.y * c.y + p.z * c.z + p.w < -meshlet.radius)
+				visible = false;
+		}
+
+		if (visible && meshlet.cone_cutoff <= 1) {
+			Vector3 d = {meshlet.cone_apex.x - eye.x, meshlet.cone_apex.y - eye.y, meshlet.cone_apex.z - eye.z};
+			Vector3 a = meshlet.cone_axis;
+			float len = norm_of(d);
+			if (a.x * d.x + a.y * d.y + a.z * d.z >= meshlet.cone_cutoff * len)
+				visible = false;
+		}
+
+		if (!visible) {
+			frame_stats.meshlets_culled++;
+			continue;
+		}
+
+		triangles += meshlet.num_triangles;
+		if (meshlet.first_triangle == range_end) {
+			meshlet_counts[num_ranges-1] += 3 * meshlet.num_triangles;
+		} else {
+			meshlet_firsts[num_ranges] = 3 * meshlet.first_triangle;
+			meshlet_counts[num_ranges] = 3 * meshlet.num_triangles;
+			num_ranges++;
+		}
+		range_end = meshlet.first_triangle + meshlet.num_triangles;
+	}
+
+	if (num_ranges == 0)
+		return;
+
+	if (buffer.num_indices > 0) {
+		for (int i = 0; i < num_ranges; i++) {
+			meshlet_offsets[i] = (void*) ((buffer.first_index + meshlet_firsts[i]) * sizeof(uint32_t));
+			meshlet_base_vertices[i] = buffer.first_vertex;
+		}
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, meshlet_counts, GL_UNSIGNED_INT,
+			(const void* const*) meshlet_offsets, num_ranges, meshlet_base_vertices);
+	} else {
+		for (int i = 0; i < num_ranges; i++)
+			meshlet_firsts[i] += buffer.first_vertex;
+		glMultiDrawArrays(GL_TRIANGLES, meshlet_firsts, meshlet_counts, num_ranges);
+	}
+	count_draw(triangles);
+}
+
+static void apply_commands(bool shadow_map, PassView view)
+{
+	use_program(shadow_map ? shadow_program : shader_program);
+	bind_vao(shadow_map ? shadow_vao : mesh_vao);
+
+	for (int i = 0; i < command_queue_used; i++) {
+		DrawCommand command = command_queue[(command_queue_head + i) % COMMAND_QUEUE_SIZE];
+		bind_object_data(command.object_offset);
+		GPUMeshBuffer buffer = mesh_buffers[select_lod(command.model_id, command.model, view)-1];
+		if (view.cull_meshlets && buffer.num_meshlets > 0)
+			draw_meshlets(buffer, command.model, view);
+		else
+			draw_mesh_buffer(buffer);
+	}
+}
+
+static void push_command(DrawCommand command)
+{
+	if (command_queue_used == COMMAND_QUEUE_SIZE) {
+		printf("Command queue full.. Ignoring draw call\n");
+		frame_stats.commands_dropped++;
+		return;
+	}
+	command_queue[(command_queue_head + command_queue_used) % COMMAND_QUEUE_SIZE] = command;
+	command_queue_used++;
+}
+
+void draw_model_matrix(ModelID id, Matrix4 model, Matrix4 normal, Material mat)
+{
+	if (id == 0)
+		return;
+	id = resident_model(id);
+	push_command((DrawCommand) {.model_id = id, .model = model, .normal = normal, .mat = mat});
+}
+
+void draw_model(ModelID id, Vector3 pos, Vector3 scale, Vector3 rotate, Material mat)
+{
+	Matrix4 model = transform_matrix(pos, scale, rotate);
+	draw_model_matrix(id, model, normal_matrix(model), mat);
+}
+
+void draw_sphere(float x, float y, float z, float radius, Material mat)
+{
+	draw_model(MODEL_SPHERE, (Vector3) {x, y, z}, (Vector3) {radius, radius, radius}, (Vector3) {0, 0, 0}, mat);
+}
+
+void draw_cube(float x, float y, float z, float w, float h, float d, Material mat)
+{
+	draw_model(MODEL_CUBE, (Vector3) {x, y, z}, (Vector3) {w, h, d}, (Vector3) {0, 0, 0}, mat);
+}
+
+/*
+ * Static batches
+ *
+ * Geometry that doesn't change between frames is added to a batch once.
+ * The first time the batch is drawn its models are pre-transformed to
+ * world space and merged into one mesh per material, so drawing it costs
+ * one command per material instead of one per model. The merged meshes
+ * are only rebuilt when the batch is modified or invalidated.
+ */
+
+typedef struct {
+	ModelID  model_id;
+	Matrix4  model;
+	Material mat;
+} StaticItem;
+
+typedef struct {
+	Material mat;
+	ModelID  merged;
+} StaticGroup;
+
+typedef struct {
+	bool used;
+	bool dirty;
+	StaticItem  *items;
+	int          num_items;
+	int          cap_items;
+	StaticGroup *groups;
+	int          num_groups;
+} StaticBatch;
+
+static StaticBatch *static_batches;
+static int num_static_batches;
+
+static bool same_material(Material a, Material b)
+{
+	return a.perceptualRoughness == b.perceptualRoughness
+		&& a.metallic    == b.metallic
+		&& a.reflectance == b.reflectance
+		&& a.baseColor.x == b.baseColor.x
+		&& a.baseColor.y == b.baseColor.y
+		&& a.baseColor.z == b.baseColor.z;
+}
+
+static StaticBatch *get_static_batch(StaticBatchID id)
+{
+	if (id == STATIC_BATCH_INVALID || id > (StaticBatchID) num_static_batches)
+		return NULL;
+	StaticBatch *batch = &static_batches[id-1];
+	if (!batch->used)
+		return NULL;
+	return batch;
+}
+
+static void free_static_groups(StaticBatch *batch)
+{
+	for (int i = 0; i < batch->num_groups; i++)
+		free_3d_model(batch->groups[i].merged);
+	free(batch->groups);
+	batch->groups = NULL;
+	batch->num_groups = 0;
+}
+
+// Appends the vertices of a mesh transformed by "model" to "vertices",
+// and the indices that refer to them to "indices"
+static void append_transformed_mesh(GPUMeshBuffer buffer, Matrix4 model, VertexArray *vertices, uint32_t **indices, int *num_indices, int *cap_indices)
+{
+	Matrix4 normal = normal_matrix(model);
+
+	GPUPosition   *src_positions  = malloc(buffer.num_vertices * sizeof(GPUPosition));
+	GPUAttributes *src_attributes = malloc(buffer.num_vertices * sizeof(GPUAttributes));
+	uint32_t *src_indices = malloc(buffer.num_indices * sizeof(uint32_t));
+	if (!src_positions || !src_attributes || (buffer.num_indices > 0 && !src_indices)) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+
+	// Static batches are only baked when they change, so reading the
+	// source mesh back from the GPU is cheaper than keeping a CPU copy
+	// of every model around.
+	glBindBuffer(GL_COPY_READ_BUFFER, mesh_vbos[STREAM_POSITIONS]);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, buffer.first_vertex * sizeof(GPUPosition), buffer.num_vertices * sizeof(GPUPosition), src_positions);
+	glBindBuffer(GL_COPY_READ_BUFFER, mesh_vbos[STREAM_ATTRIBUTES]);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, buffer.first_vertex * sizeof(GPUAttributes), buffer.num_vertices * sizeof(GPUAttributes), src_attributes);
+	if (buffer.num_indices > 0) {
+		glBindBuffer(GL_COPY_READ_BUFFER, mesh_ibo);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, buffer.first_index * sizeof(uint32_t), buffer.num_indices * sizeof(uint32_t), src_indices);
+	}
+
+	uint32_t base = vertices->size;
+	for (uint32_t i = 0; i < buffer.num_vertices; i++) {
+		Vertex v = dequantize_vertex(src_positions[i], src_attributes[i], buffer.box_min, buffer.box_size);
+		Vector4 p = rdotv(model,  (Vector4) {v.x, v.y, v.z, 1});
+		Vector4 n = rdotv(normal, (Vector4) {v.nx, v.ny, v.nz, 0});
+		Vector3 n3 = normalize((Vector3) {n.x, n.y, n.z});
+		v.x  = p.x;  v.y  = p.y;  v.z  = p.z;
+		v.nx = n3.x; v.ny = n3.y; v.nz = n3.z;
+		append_vertex(vertices, v);
+	}
+
+	uint32_t count = buffer.num_indices > 0 ? buffer.num_indices : buffer.num_vertices;
+	if (*num_indices + (int) count > *cap_indices) {
+		while (*num_indices + (int) count > *cap_indices)
+			*cap_indices = *cap_indices ? 2 * *cap_indices : 1024;
+		*indices = realloc(*indices, *cap_indices * sizeof(uint32_t));
+		if (!*indices) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+	}
+	for (uint32_t i = 0; i < count; i++)
+		(*indices)[(*num_indices)++] = base + (buffer.num_indices > 0 ? src_indices[i] : i);
+
+	free(src_positions);
+	free(src_attributes);
+	free(src_indices);
+}
+
+static void bake_static_batch(StaticBatch *batch)
+{
+	free_static_groups(batch);
+
+	bool *baked = calloc(batch->num_items, sizeof(bool));
+	batch->groups = malloc(batch->num_items * sizeof(StaticGroup));
+	if ((!baked || !batch->groups) && batch->num_items > 0) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+
+	for (int i = 0; i < batch->num_items; i++) {
+
+		if (baked[i])
+			continue;
+
+		Material mat = batch->items[i].mat;
+
+		VertexArray vertices = {0, 0, 0};
+		uint32_t *indices = NULL;
+		int num_indices = 0;
+		int cap_indices = 0;
+
+		for (int j = i; j < batch->num_items; j++) {
+			StaticItem item = batch->items[j];
+			if (baked[j] || !same_material(item.mat, mat))
+				continue;
+			baked[j] = true;
+			ModelID model_id = resident_model(item.model_id);
+			if (model_id == MODEL_INVALID || model_id > (ModelID) num_mesh_buffers)
+				continue;
+			append_transformed_mesh(mesh_buffers[model_id-1], item.model, &vertices, &indices, &num_indices, &cap_indices);
+		}
+
+		if (vertices.size > 0) {
+			ModelID merged = add_mesh_buffer(create_gpu_mesh_buffer(vertices, indices, num_indices, NULL));
+			batch->groups[batch->num_groups++] = (StaticGroup) {.mat = mat, .merged = merged};
+		}
+		free(vertices.data);
+		free(indices);
+	}
+
+	free(baked);
+	batch->dirty = false;
+}
+
+// Batches holding placeholders are baked again once the model is loaded
+static void invalidate_static_batches_using(ModelID id)
+{
+	for (int i = 0; i < num_static_batches; i++) {
+		StaticBatch *batch = &static_batches[i];
+		if (!batch->used)
+			continue;
+		for (int j = 0; j < batch->num_items; j++)
+			if (batch->items[j].model_id == id) {
+				batch->dirty = true;
+				break;
+			}
+	}
+}
+
+StaticBatchID create_static_batch(void)
+{
+	int i = 0;
+	while (i < num_static_batches && static_batches[i].used)
+		i++;
+
+	if (i == num_static_batches) {
+		static_batches = realloc(static_batches, (num_static_batches + 1) * sizeof(StaticBatch));
+		if (!static_batches) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+		num_static_batches++;
+	}
+
+	static_batches[i] = (StaticBatch) {.used = true, .dirty = true};
+	return i+1;
+}
+
+void free_static_batch(StaticBatchID id)
+{
+	StaticBatch *batch = get_static_batch(id);
+	if (batch == NULL)
+		return;
+	free_static_groups(batch);
+	free(batch->items);
+	*batch = (StaticBatch) {0};
+}
+
+void add_static_model(StaticBatchID id, ModelID model_id, Vector3 pos, Vector3 scale, Vector3 rotate, Material mat)
+{
+	StaticBatch *batch = get_static_batch(id);
+	if (batch == NULL || model_id == MODEL_INVALID)
+		return;
+
+	if (batch->num_items == batch->cap_items) {
+		batch->cap_items = batch->cap_items ? 2 * batch->cap_items : 64;
+		batch->items = realloc(batch->items, batch->cap_items * sizeof(StaticItem));
+		if (!batch->items) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+	}
+	batch->items[batch->num_items++] = (StaticItem) {
+		.model_id = model_id,
+		.model = transform_matrix(pos, scale, rotate),
+		.mat = mat,
+	};
+	batch->dirty = true;
+}
+
+void add_static_cube(StaticBatchID id, float x, float y, float z, float w, float h, float d, Material mat)
+{
+	add_static_model(id, MODEL_CUBE, (Vector3) {x, y, z}, (Vector3) {w, h, d}, (Vector3) {0, 0, 0}, mat);
+}
+
+void clear_static_batch(StaticBatchID id)
+{
+	StaticBatch *batch = get_static_batch(id);
+	if (batch == NULL)
+		return;
+	batch->num_items = 0;
+	batch->dirty = true;
+}
+
+void invalidate_static_batch(StaticBatchID id)
+{
+	StaticBatch *batch = get_static_batch(id);
+	if (batch == NULL)
+		return;
+	batch->dirty = true;
+}
+
+void draw_static_batch(StaticBatchID id)
+{
+	StaticBatch *batch = get_static_batch(id);
+	if (batch == NULL)
+		return;
+
+	if (batch->dirty)
+		bake_static_batch(batch);
+
+	for (int i = 0; i < batch->num_groups; i++)
+		draw_model_matrix(batch->groups[i].merged, identity_matrix(), identity_matrix(), batch->groups[i].mat);
+}
+
+static Vector3 light_color = {1, 1, 1};
+static Vector3 light_dir   = {1, 1, 1};
+
+void set_light(Vector3 dir, Vector3 color)
+{
+	light_dir = dir;
+	light_color = color;
+}
+
+static bool environment = true;
+void show_environment(bool yes)
+{
+	environment = yes;
+}
+
+static Vector3 clear_color = {1, 1, 1};
+
+void set_clear_color(Vector3 color)
+{
+	clear_color = color;
+}
+
+/*
+ * On-demand rendering
+ *
+ * Everything that affects the rendered image (camera, light, queued
+ * commands, window size..) is hashed every frame. When rendering on
+ * demand and the hash didn't change since the last frame, the frame
+ * is skipped and the previous image is left on screen.
+ */
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, hdrTexture);
+static bool render_on_demand = false;
+static bool redraw_requested = true;
+static uint64_t last_frame_hash;
 
-		glViewport(0, 0, 512, 512); // don't forget to configure the viewport to the capture dimensions.
-		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-		for (unsigned int i = 0; i < 6; i++) {
-			glUniformMatrix4fv(glGetUniformLocation(equirectangular_to_cubemap_program, "view"), 1, false, (float*) &captureViews[i]);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void set_render_on_demand(bool yes)
+{
+	render_on_demand = yes;
+	redraw_requested = true;
+}
 
-			renderCube();
-		}
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	}
+void request_redraw(void)
+{
+	redraw_requested = true;
+}
 
-	{
-		// pbr: create an irradiance cubemap, and re-scale capture FBO to irradiance scale.
-		glGenTextures(1, &irradianceMap);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-		for (unsigned int i = 0; i < 6; ++i)
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0, GL_RGB, GL_FLOAT, NULL);
+// FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211u;
+	}
+	return hash;
+}
 
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+static uint64_t hash_frame_state(int w, int h)
+{
+	uint64_t hash = 14695981039346656037u;
 
-		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-		glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
+	Matrix4 view = camera_pov();
+	Vector3 camera_pos = get_camera_pos();
+	hash = hash_bytes(hash, &view, sizeof(view));
+	hash = hash_bytes(hash, &camera_pos, sizeof(camera_pos));
+
+	hash = hash_bytes(hash, &light_dir,   sizeof(light_dir));
+	hash = hash_bytes(hash, &light_color, sizeof(light_color));
+	hash = hash_bytes(hash, &clear_color, sizeof(clear_color));
+	hash = hash_bytes(hash, &environment, sizeof(environment));
+	hash = hash_bytes(hash, &w, sizeof(w));
+	hash = hash_bytes(hash, &h, sizeof(h));
+
+	hash = hash_bytes(hash, &command_queue_used, sizeof(command_queue_used));
+	for (int i = 0; i < command_queue_used; i++) {
+		DrawCommand *command = &command_queue[(command_queue_head + i) % COMMAND_QUEUE_SIZE];
+		hash = hash_bytes(hash, &command->model_id, sizeof(command->model_id));
+		hash = hash_bytes(hash, &command->model,    sizeof(command->model));
+		hash = hash_bytes(hash, &command->mat,      sizeof(command->mat));
 	}
 
-	{
-		glUseProgram(irradiance_convolution_program);
-		glUniform1i(glGetUniformLocation(irradiance_convolution_program, "environmentMap"), 0);
-		glUniformMatrix4fv(glGetUniformLocation(irradiance_convolution_program, "projection"), 1, GL_FALSE, (float*) &captureProjection);
+	return hash;
+}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+/*
+ * Shadow map caching
+ *
+ * The shadow map only depends on the light space matrix and on the
+ * transforms and meshes of the queued commands, so it's kept from the
+ * previous frame when none of them changed. Changes the hash can't see,
+ * like a model being replaced by another with the same ID, must be
+ * signaled with invalidate_shadow_map.
+ */
 
-		glViewport(0, 0, 32, 32); // don't forget to configure the viewport to the capture dimensions.
-		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-		for (unsigned int i = 0; i < 6; ++i)
-		{
-			glUniformMatrix4fv(glGetUniformLocation(irradiance_convolution_program, "view"), 1, GL_FALSE, (float*) &captureViews[i]);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+static bool shadow_map_valid = false;
+static uint64_t shadow_map_hash;
 
-			renderCube();
-		}
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void invalidate_shadow_map(void)
+{
+	shadow_map_valid = false;
+}
+
+static uint64_t hash_shadow_casters(const Matrix4 *light_space_matrices)
+{
+	uint64_t hash = 14695981039346656037u;
+	hash = hash_bytes(hash, light_space_matrices, NUM_CASCADES * sizeof(Matrix4));
+	hash = hash_bytes(hash, &command_queue_used, sizeof(command_queue_used));
+	for (int i = 0; i < command_queue_used; i++) {
+		DrawCommand *command = &command_queue[(command_queue_head + i) % COMMAND_QUEUE_SIZE];
+		hash = hash_bytes(hash, &command->model_id, sizeof(command->model_id));
+		hash = hash_bytes(hash, &command->model,    sizeof(command->model));
 	}
+	return hash;
+}
 
-	{
-		int w, h;
-		glfwGetWindowSize(window, &w, &h);
+/*
+ * Offscreen target
+ */
 
-		Matrix4 projection = perspective_matrix(deg2rad(30.0f), (float) w / (float) h, 0.1f, 100.0f);
-		glUseProgram(background_program);
-		glUniformMatrix4fv(glGetUniformLocation(background_program, "projection"), 1, false, (float*) &projection);
+bool set_offscreen_target(int width, int height)
+{
+	if (offscreen_fbo) {
+		glDeleteFramebuffers(1, &offscreen_fbo);
+		glDeleteRenderbuffers(1, &offscreen_color);
+		glDeleteRenderbuffers(1, &offscreen_depth);
+		offscreen_fbo = 0;
+		gpu_memory[GPU_MEMORY_TARGETS] -= (size_t) offscreen_w * offscreen_h * 8;
 	}
 
-	{
-		glGenFramebuffers(1, &depth_map_fbo);
+	glGenFramebuffers(1, &offscreen_fbo);
+	glGenRenderbuffers(1, &offscreen_color);
+	glGenRenderbuffers(1, &offscreen_depth);
 
-		glGenTextures(1, &depth_map);
-		glBindTexture(GL_TEXTURE_2D, depth_map);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glBindRenderbuffer(GL_RENDERBUFFER, offscreen_color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_map, 0);
-		glDrawBuffer(GL_NONE);
-		glReadBuffer(GL_NONE);
+	glBindRenderbuffer(GL_RENDERBUFFER, offscreen_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen_color);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, offscreen_depth);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Offscreen framebuffer is not complete\n");
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &offscreen_fbo);
+		glDeleteRenderbuffers(1, &offscreen_color);
+		glDeleteRenderbuffers(1, &offscreen_depth);
+		offscreen_fbo = 0;
+		return false;
 	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	{
-		glGenTextures(1, &prefilterMap);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
-		for (unsigned int i = 0; i < 6; ++i)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, NULL);
-		}
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	offscreen_w = width;
+	offscreen_h = height;
+	gpu_memory[GPU_MEMORY_TARGETS] += (size_t) width * height * 8;
+	request_redraw();
+	return true;
+}
 
-		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+void get_frame_size(int *width, int *height)
+{
+	if (offscreen_fbo) {
+		*width  = offscreen_w;
+		*height = offscreen_h;
+	} else
+		glfwGetWindowSize(window_, width, height);
+}
+
+// Copies the last rendered frame into "dst" as tightly packed RGB rows,
+// top to bottom. The buffer must hold width*height*3 bytes.
+void read_frame_pixels(unsigned char *dst)
+{
+	int w, h;
+	get_frame_size(&w, &h);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, offscreen_fbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, dst);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+	// OpenGL returns the bottom row first
+	size_t stride = 3 * w;
+	unsigned char *tmp = malloc(stride);
+	if (tmp == NULL)
+		return;
+	for (int y = 0; y < h/2; y++) {
+		unsigned char *a = dst + y * stride;
+		unsigned char *b = dst + (h - y - 1) * stride;
+		memcpy(tmp, a, stride);
+		memcpy(a, b, stride);
+		memcpy(b, tmp, stride);
 	}
+	free(tmp);
+}
 
-	unsigned int prefilter_program = compile_shader("assets/shaders/cubemap_vertex.glsl", "assets/shaders/prefilter_fragment.glsl");
+/*
+ * Asynchronous readback
+ *
+ * glReadPixels into a pixel buffer object returns immediately and the
+ * copy happens on the GPU timeline. The result is collected a frame or
+ * two later, behind a fence, so neither the CPU nor the GPU wait on the
+ * transfer. Frames are read as RGBA, which is the fast path of most
+ * drivers, and converted to RGB rows when they are collected.
+ *
+ * Slots are either collected by the caller through a ticket (see
+ * begin_frame_readback) or, for screenshots and recordings, handed to
+ * the encoder threads as soon as their fence is signaled.
+ */
+
+#define READBACK_SLOTS 3
+
+typedef enum {
+	READBACK_FREE,
+	READBACK_TICKET,
+	READBACK_SCREENSHOT,
+	READBACK_RECORDING,
+} ReadbackUse;
 
-	{
-		glUseProgram(prefilter_program);
-		glUniform1i(glGetUniformLocation(prefilter_program, "environmentMap"), 0);
-		glUniformMatrix4fv(glGetUniformLocation(prefilter_program, "projection"), 1, false, (float*) &captureProjection);
+typedef struct {
+	unsigned int pbo;
+	size_t size;
+	int    width;
+	int    height;
+	GLsync fence;
+	ReadbackUse use;
+	int    frame;     // Frame number of a recording
+	char   file[256]; // Destination of a screenshot
+} ReadbackSlot;
+
+static ReadbackSlot readback_slots[READBACK_SLOTS];
+static int readback_next; // Also the oldest slot
+
+static bool recording;
+static char recording_path[256];
+static int  recording_frame;
+static VideoFile *recording_video;
+
+static bool screenshot_requested;
+static char screenshot_file[256];
+
+static unsigned char *finish_readback(ReadbackSlot *slot, int *width, int *height)
+{
+	GLenum status;
+	do
+		status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+	while (status == GL_TIMEOUT_EXPIRED);
+	glDeleteSync(slot->fence);
+	slot->fence = NULL;
+	slot->use = READBACK_FREE;
+
+	int w = slot->width;
+	int h = slot->height;
+
+	unsigned char *dst = malloc((size_t) w * h * 3);
+	if (dst == NULL)
+		return NULL;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	unsigned char *src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot->size, GL_MAP_READ_BIT);
+	if (src == NULL) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		free(dst);
+		return NULL;
+	}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+	// OpenGL returns the bottom row first
+	for (int y = 0; y < h; y++) {
+		unsigned char *in  = src + (size_t) (h - y - 1) * w * 4;
+		unsigned char *out = dst + (size_t) y * w * 3;
+		for (int x = 0; x < w; x++) {
+			out[3*x+0] = in[4*x+0];
+			out[3*x+1] = in[4*x+1];
+			out[3*x+2] = in[4*x+2];
+		}
+	}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-		unsigned int maxMipLevels = 5;
-		for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
-		{
-			// reisze framebuffer according to mip-level size.
-			unsigned int mipWidth  = 128 * pow(0.5, mip);
-			unsigned int mipHeight = 128 * pow(0.5, mip);
-			glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-			glViewport(0, 0, mipWidth, mipHeight);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
-			float roughness = (float)mip / (float)(maxMipLevels - 1);
+	*width  = w;
+	*height = h;
+	return dst;
+}
 
-			glUniform1f(glGetUniformLocation(prefilter_program, "roughness"), roughness);
+// Hands a screenshot or recording frame to the encoder
+static void dispatch_readback(ReadbackSlot *slot)
+{
+	ReadbackUse use = slot->use;
+	int frame = slot->frame;
 
-			for (unsigned int i = 0; i < 6; ++i)
-			{
-				glUniformMatrix4fv(glGetUniformLocation(prefilter_program, "view"), 1, false, (float*) &captureViews[i]);
+	int w, h;
+	unsigned char *pixels = finish_readback(slot, &w, &h);
+	if (pixels == NULL) {
+		fprintf(stderr, "Couldn't read back frame\n");
+		return;
+	}
 
-				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 
-									GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, mip);
+	if (use == READBACK_SCREENSHOT) {
+		encode_image(slot->file, pixels, w, h);
+		return;
+	}
 
-				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-				renderCube();
-			}
+	if (recording_video)
+		encode_video_frame(recording_video, pixels, w, h);
+	else {
+		char file[sizeof(recording_path) + 16];
+		snprintf(file, sizeof(file), recording_path, frame);
+		encode_image(file, pixels, w, h);
+	}
+}
+
+// Dispatches the screenshots and recording frames that are ready,
+// oldest first, or all of them if "wait" is set
+static void collect_readbacks(bool wait)
+{
+	for (int i = 0; i < READBACK_SLOTS; i++) {
+		ReadbackSlot *slot = &readback_slots[(readback_next + i) % READBACK_SLOTS];
+		if (slot->use != READBACK_SCREENSHOT && slot->use != READBACK_RECORDING)
+			continue;
+		if (!wait) {
+			GLenum status = glClientWaitSync(slot->fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break; // Later slots can't be ready either
 		}
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);  
+		dispatch_readback(slot);
 	}
+}
 
-	unsigned int brdf_program = compile_shader("assets/shaders/brdf_vertex.glsl", "assets/shaders/brdf_fragment.glsl");
+static ReadbackSlot *start_readback(ReadbackUse use)
+{
+	ReadbackSlot *slot = &readback_slots[readback_next];
+	if (slot->use == READBACK_TICKET) {
+		fprintf(stderr, "All readback slots are in use\n");
+		return NULL;
+	}
+	if (slot->use != READBACK_FREE)
+		dispatch_readback(slot); // The ring is full, wait for the oldest
+	readback_next = (readback_next + 1) % READBACK_SLOTS;
 
-	{
-		glGenTextures(1, &brdfLUTTexture);
+	int w, h;
+	get_frame_size(&w, &h);
+
+	size_t size = (size_t) w * h * 4;
+	if (slot->pbo == 0)
+		glGenBuffers(1, &slot->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	if (slot->size != size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		gpu_memory[GPU_MEMORY_STREAMING] += size - slot->size;
+		slot->size = size;
+	}
 
-		// pre-allocate enough memory for the LUT texture.
-		glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, offscreen_fbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-		glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUTTexture, 0);
+	slot->width  = w;
+	slot->height = h;
+	slot->use    = use;
+	slot->fence  = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
-		glViewport(0, 0, 512, 512);
-		glUseProgram(brdf_program);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		renderQuad();
+	// Make sure the copy is submitted even if no other work follows
+	glFlush();
+	return slot;
+}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);  
+// Called at the end of every rendered frame
+static void capture_frame(void)
+{
+	if (screenshot_requested) {
+		screenshot_requested = false;
+		ReadbackSlot *slot = start_readback(READBACK_SCREENSHOT);
+		if (slot)
+			memcpy(slot->file, screenshot_file, sizeof(slot->file));
 	}
 
-	unsigned int rect_program = compile_shader("assets/shaders/brdf_vertex.glsl", "assets/shaders/rect_fragment.glsl");
+	if (recording) {
+		ReadbackSlot *slot = start_readback(READBACK_RECORDING);
+		if (slot)
+			slot->frame = recording_frame++;
+	}
 
-	unsigned int depth_render_buffer;
+	collect_readbacks(false);
+}
 
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LEQUAL);
+// Starts copying the last rendered frame. Returns a ticket for
+// end_frame_readback or -1 if all slots are waiting to be collected.
+int begin_frame_readback(void)
+{
+	int ticket = readback_next;
+	if (start_readback(READBACK_TICKET) == NULL)
+		return -1;
+	return ticket;
 }
 
-typedef struct {
-	ModelID  model_id;
-	Matrix4  model;
-	Material mat;
-} DrawCommand;
+// Waits for the copy started by begin_frame_readback and returns the
+// frame as RGB rows, top to bottom, in a buffer allocated with malloc.
+unsigned char *end_frame_readback(int ticket, int *width, int *height)
+{
+	if (ticket < 0 || ticket >= READBACK_SLOTS)
+		return NULL;
 
-#define COMMAND_QUEUE_SIZE 1024
-static DrawCommand command_queue[COMMAND_QUEUE_SIZE];
-static int command_queue_head;
-static int command_queue_used;
+	ReadbackSlot *slot = &readback_slots[ticket];
+	if (slot->use != READBACK_TICKET)
+		return NULL;
 
-static void clear_commands(void)
-{
-	command_queue_head = 0;
-	command_queue_used = 0;
+	return finish_readback(slot, width, height);
 }
 
-static void apply_single_command(DrawCommand command, bool shadow_map)
+void take_screenshot(const char *file)
 {
-	if (!shadow_map)
-		draw_mesh(mesh_buffers[command.model_id-1], command.model, command.mat);
-	else
-		draw_mesh_for_shadow_map(mesh_buffers[command.model_id-1], command.model);
+	snprintf(screenshot_file, sizeof(screenshot_file), "%s", file);
+	screenshot_requested = true;
+	request_redraw();
 }
 
-static void apply_commands(bool shadow_map)
+// True if "pattern" has exactly one integer conversion, with optional
+// flags and width, and no other conversions except "%%"
+bool is_frame_pattern(const char *pattern)
 {
-	for (int i = 0; i < command_queue_used; i++)
-		apply_single_command(command_queue[(command_queue_head + i) % COMMAND_QUEUE_SIZE], shadow_map);
+	int conversions = 0;
+	for (const char *p = pattern; *p; p++) {
+		if (*p != '%')
+			continue;
+		p++;
+		if (*p == '%')
+			continue;
+		while (*p && strchr("-+ 0#", *p))
+			p++;
+		while (*p >= '0' && *p <= '9')
+			p++;
+		if (*p != 'd' && *p != 'i')
+			return false;
+		conversions++;
+	}
+	return conversions == 1;
 }
 
-static void push_command(DrawCommand command)
+// For CAPTURE_PNG the path is a printf format that receives the frame
+// number, like "frames/%05d.png" (see is_frame_pattern). The other
+// formats write to a single file. Only rendered frames are captured, so
+// with on-demand rendering the frames aren't evenly spaced in time.
+bool start_recording(const char *path, CaptureFormat format, int fps)
 {
-	if (command_queue_used == COMMAND_QUEUE_SIZE) {
-		printf("Command queue full.. Ignoring draw call\n");
-		return;
+	if (strlen(path) >= sizeof(recording_path))
+		return false;
+	if (format == CAPTURE_PNG && !is_frame_pattern(path))
+		return false;
+
+	if (recording)
+		stop_recording();
+
+	if (format == CAPTURE_RAW || format == CAPTURE_Y4M) {
+		int w, h;
+		get_frame_size(&w, &h);
+		recording_video = open_video(path, format == CAPTURE_Y4M ? VIDEO_Y4M : VIDEO_RAW, w, h, fps);
+		if (recording_video == NULL)
+			return false;
 	}
-	command_queue[(command_queue_head + command_queue_used) % COMMAND_QUEUE_SIZE] = command;
-	command_queue_used++;
+
+	snprintf(recording_path, sizeof(recording_path), "%s", path);
+	recording_frame = 0;
+	recording = true;
+	return true;
 }
 
-void draw_model(ModelID id, Vector3 pos, Vector3 scale, Vector3 rotate, Material mat)
+// Also waits for pending screenshots
+void stop_recording(void)
 {
-	if (id == 0)
+	collect_readbacks(true);
+
+	if (!recording)
 		return;
-	Matrix4 model = identity_matrix();
-	model = dotm(model, translate_matrix(pos, 1));
-	model = dotm(model, scale_matrix(scale));
-	model = dotm(model, rotate_matrix_x(rotate.x));
-	model = dotm(model, rotate_matrix_y(rotate.y));
-	model = dotm(model, rotate_matrix_z(rotate.z));
-	push_command((DrawCommand) {.model_id = id, .model = model, .mat = mat});
-}
+	recording = false;
 
-void draw_sphere(float x, float y, float z, float radius, Material mat)
-{
-	draw_model(MODEL_SPHERE, (Vector3) {x, y, z}, (Vector3) {radius, radius, radius}, (Vector3) {0, 0, 0}, mat);
+	if (recording_video) {
+		if (!close_video(recording_video))
+			fprintf(stderr, "Couldn't write recording '%s'\n", recording_path);
+		recording_video = NULL;
+	}
 }
 
-void draw_cube(float x, float y, float z, float w, float h, float d, Material mat)
+/*
+ * Cascaded shadow maps
+ */
+
+// Distances from the camera at which each cascade ends, using the
+// "practical" split scheme
+static void compute_cascade_splits(float near, float far, float *splits)
 {
-	draw_model(MODEL_CUBE, (Vector3) {x, y, z}, (Vector3) {w, h, d}, (Vector3) {0, 0, 0}, mat);
+	for (int i = 0; i < NUM_CASCADES; i++) {
+		float t = (float) (i + 1) / NUM_CASCADES;
+		float log_split = near * powf(far / near, t);
+		float uniform_split = near + (far - near) * t;
+		splits[i] = CASCADE_SPLIT_LAMBDA * log_split + (1 - CASCADE_SPLIT_LAMBDA) * uniform_split;
+	}
 }
 
-static Vector3 light_color = {1, 1, 1};
-static Vector3 light_dir   = {1, 1, 1};
-
-void set_light(Vector3 dir, Vector3 color)
+// Light space matrix of an orthographic projection that contains the
+// slice of the camera frustum between "near" and "far". The projection
+// is sized from the bounding sphere of the slice, which doesn't change
+// as the camera rotates, and its bounds are snapped to whole texels so
+// that the shadow edges don't shimmer as the camera moves.
+static Matrix4 fit_cascade(Matrix4 camera_view, float aspect, float near, float far, Matrix4 light_view)
 {
-	light_dir = dir;
-	light_color = color;
+	Matrix4 slice_projection = perspective_matrix(deg2rad(CAMERA_FOV), aspect, near, far);
+
+	Matrix4 slice_to_world;
+	invert(dotm(slice_projection, camera_view), &slice_to_world);
+
+	Vector3 corners[8];
+	Vector3 center = {0, 0, 0};
+	for (int i = 0; i < 8; i++) {
+		Vector4 corner = {
+			(i & 1) ? 1 : -1,
+			(i & 2) ? 1 : -1,
+			(i & 4) ? 1 : -1,
+			1,
+		};
+		corner = rdotv(slice_to_world, corner);
+		corners[i] = (Vector3) {corner.x / corner.w, corner.y / corner.w, corner.z / corner.w};
+		center = combine(center, corners[i], 1, 1.0f / 8);
+	}
+
+	float radius = 0;
+	for (int i = 0; i < 8; i++)
+		radius = fmaxf(radius, norm_of(combine(corners[i], center, 1, -1)));
+
+	// Round the radius up so that rounding errors don't change the
+	// texel size from one frame to the next
+	radius = ceilf(radius * 16) / 16;
+
+	Vector4 c = rdotv(light_view, (Vector4) {center.x, center.y, center.z, 1});
+
+	// With the center on a texel corner, both bounds are too
+	float texel_w = 2 * radius / SHADOW_WIDTH;
+	float texel_h = 2 * radius / SHADOW_HEIGHT;
+	float cx = floorf(c.x / texel_w) * texel_w;
+	float cy = floorf(c.y / texel_h) * texel_h;
+	float min_x = cx - texel_w * (SHADOW_WIDTH  / 2);
+	float max_x = cx + texel_w * (SHADOW_WIDTH  / 2);
+	float min_y = cy - texel_h * (SHADOW_HEIGHT / 2);
+	float max_y = cy + texel_h * (SHADOW_HEIGHT / 2);
+
+	// The light looks down -z, so the slice spans the distances [-c.z - radius, -c.z + radius]
+	Matrix4 projection = ortho_matrix(min_x, max_x, min_y, max_y, -c.z - radius - SHADOW_CASTER_MARGIN, -c.z + radius);
+	return dotm(projection, light_view);
 }
 
-static bool environment = true;
-void show_environment(bool yes)
+// Returns false if the frame was skipped because nothing changed since
+// the last one (only when rendering on demand), in which case there is
+// nothing new to present.
+bool update_graphics(void)
 {
-	environment = yes;
-}
+	collect_model_loads(false);
 
-static Vector3 clear_color = {1, 1, 1};
+	int w, h;
+	get_frame_size(&w, &h);
+
+	if (render_on_demand) {
+		uint64_t hash = hash_frame_state(w, h);
+		bool changed = redraw_requested || hash != last_frame_hash;
+		last_frame_hash = hash;
+		redraw_requested = false;
+		if (!changed) {
+			memset(&frame_stats, 0, sizeof(frame_stats));
+			clear_commands();
+			return false;
+		}
+	}
 
-void set_clear_color(Vector3 color)
-{
-	clear_color = color;
-}
+	add_frame_time();
+	begin_gpu_frame();
+	frame_stats.commands_queued = command_queue_used;
 
-void update_graphics(void)
-{
-	// Just an approximation for directional lighting
-	Vector3 light_pos = scale(light_dir, 50);
+	PROFILE_BEGIN("upload objects");
+	upload_object_data();
+	PROFILE_END();
+
+	float aspect = (float) w / (float) h;
+	Matrix4 view = camera_pov();
+	Matrix4 projection = perspective_matrix(deg2rad(CAMERA_FOV), aspect, CAMERA_NEAR, CAMERA_FAR);
 
 	/*
 	 * First render to depth map
 	 */
-	Matrix4 light_space_matrix;
+	float cascade_splits[NUM_CASCADES];
+	Matrix4 light_space_matrices[NUM_CASCADES];
 	{
+		// Just an approximation for directional lighting
+		Vector3 light_pos = scale(normalize(light_dir), 50);
+		Matrix4 light_view = lookat_matrix(light_pos, (Vector3) {0, 0, 0}, (Vector3) {0, 1, 0});
+
+		compute_cascade_splits(CAMERA_NEAR, SHADOW_DISTANCE, cascade_splits);
+
+		float near = CAMERA_NEAR;
+		for (int i = 0; i < NUM_CASCADES; i++) {
+			light_space_matrices[i] = fit_cascade(view, aspect, near, cascade_splits[i], light_view);
+			near = cascade_splits[i];
+		}
+	}
+
+	PROFILE_BEGIN("shadow pass");
+	uint64_t shadow_hash = hash_shadow_casters(light_space_matrices);
+	frame_stats.shadow_map_cached = shadow_map_valid && shadow_hash == shadow_map_hash;
+	if (!frame_stats.shadow_map_cached) {
+
+		shadow_map_valid = true;
+		shadow_map_hash = shadow_hash;
+
+		begin_gpu_zone(GPU_ZONE_SHADOW);
+
 		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
 		glBindFramebuffer(GL_FRAMEBUFFER, depth_map_fbo);
-		glClear(GL_DEPTH_BUFFER_BIT);
 
-		Matrix4 view = lookat_matrix(light_pos, (Vector3) {0, 0, 0}, (Vector3) {0, 1, 0});
-		Matrix4 projection = ortho_matrix(-15, 15, -20, 10, 1, 100);
-		light_space_matrix = dotm(projection, view);
+		for (int i = 0; i < NUM_CASCADES; i++) {
 
-		glUseProgram(shadow_program);
-		set_uniform_m4(shadow_program, "light_space_matrix", light_space_matrix);
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_map, 0, i);
+			glClear(GL_DEPTH_BUFFER_BIT);
 
-		apply_commands(true);
+			use_program(shadow_program);
+			set_uniform_m4(shadow_program, "light_space_matrix", light_space_matrices[i]);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			// The light space matrix is orthographic, so its first row
+			// tells how many units of clip space a world unit spans
+			Matrix4 m = light_space_matrices[i];
+			Vector3 row = {m.data[0][0], m.data[1][0], m.data[2][0]};
+
+			PassView pass_view = {
+				.perspective = false,
+				.pixels_per_unit = norm_of(row) * SHADOW_WIDTH / 2,
+				.max_error = SHADOW_LOD_TEXEL_ERROR,
+			};
+			apply_commands(true, pass_view);
+		}
+
+		end_gpu_zone(GPU_ZONE_SHADOW);
 	}
+	PROFILE_END();
 
-	int w, h;
-	glfwGetWindowSize(window_, &w, &h);
+	PROFILE_BEGIN("main pass");
+	begin_gpu_zone(GPU_ZONE_MAIN);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
 	glViewport(0, 0, w, h);
 	glClearColor(clear_color.x, clear_color.y, clear_color.z, 1.0f);
 	glClearStencil(0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-	Matrix4 view = camera_pov();
-	Matrix4 projection = perspective_matrix(deg2rad(30.0f), (float) w / (float) h, 0.1f, 1000.0f);
-
 	{
-		glUseProgram(shader_program);
+		use_program(shader_program);
 
 		set_uniform_v3(shader_program, "lightDir",   light_dir);
 		set_uniform_v3(shader_program, "lightColor", light_color);
@@ -754,37 +2932,75 @@ void update_graphics(void)
 
 		set_uniform_m4(shader_program, "view", view);
 		set_uniform_m4(shader_program, "projection", projection);
-		set_uniform_m4(shader_program, "light_space_matrix", light_space_matrix);
+		set_uniform_m4v(shader_program, "light_space_matrices", light_space_matrices, NUM_CASCADES);
+		set_uniform_fv(shader_program, "cascade_splits", cascade_splits, NUM_CASCADES);
+		set_uniform_i(shader_program, "num_cascades", NUM_CASCADES);
+		set_uniform_i(shader_program, "shadow_taps", SHADOW_PCF_TAPS);
+		set_uniform_f(shader_program, "shadow_radius", SHADOW_PCF_RADIUS);
 
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+		bind_texture(GL_TEXTURE_CUBE_MAP, irradianceMap);
 		set_uniform_i(shader_program, "irradianceMap", 0);
 
 		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+		bind_texture(GL_TEXTURE_CUBE_MAP, prefilterMap);
 		set_uniform_i(shader_program, "prefilterMap", 1);
 
 		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
+		bind_texture(GL_TEXTURE_2D, brdfLUTTexture);
 		set_uniform_i(shader_program, "brdfLUT", 2);
 
 		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, depth_map);
+		bind_texture(GL_TEXTURE_2D_ARRAY, depth_map);
 		set_uniform_i(shader_program, "shadow_map", 3);
 
-		apply_commands(false);
+		PassView pass_view = {
+			.perspective = true,
+			.eye = get_camera_pos(),
+			.pixels_per_unit = h / (2 * tanf(deg2rad(CAMERA_FOV) / 2)),
+			.max_error = LOD_PIXEL_ERROR,
+			.cull_meshlets = true,
+			.view_projection = dotm(projection, view),
+		};
+		apply_commands(false, pass_view);
 	}
 
+	end_gpu_zone(GPU_ZONE_MAIN);
+	PROFILE_END();
+
+	PROFILE_BEGIN("skybox");
 	if (environment) {
-		glUseProgram(background_program);
+		begin_gpu_zone(GPU_ZONE_SKYBOX);
+		use_program(background_program);
 		set_uniform_m4(background_program, "view", view);
+		set_uniform_m4(background_program, "projection", projection);
 		set_uniform_i(background_program, "environmentMap", 0);
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+		bind_texture(GL_TEXTURE_CUBE_MAP, envCubemap);
 		//glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
 		//glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap); // display irradiance map
 		renderCube();
+		end_gpu_zone(GPU_ZONE_SKYBOX);
+	}
+	PROFILE_END();
+
+	finish_frame_stats();
+
+	PROFILE_BEGIN("capture");
+	capture_frame();
+	PROFILE_END();
+
+	// Drawn after the counters are published, so it isn't counted
+	// itself, and after the capture, so it stays out of screenshots and
+	// recordings
+	if (stats_overlay) {
+		PROFILE_BEGIN("stats overlay");
+		draw_stats_overlay(w, h);
+		PROFILE_END();
 	}
 
+	end_gpu_frame();
+	end_stream_frame(&object_stream);
 	clear_commands();
+	return true;
 }
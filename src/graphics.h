@@ -1,4 +1,9 @@
+#ifndef GRAPHICS_INCLUDED
+#define GRAPHICS_INCLUDED
+
+#include <stddef.h>
 #include "vector.h"
+#include "pool.h"
 
 typedef struct {
     float perceptualRoughness;
@@ -15,13 +20,121 @@ typedef uint32_t ModelID;
 ModelID load_3d_model(const char *file);
 void    free_3d_model(ModelID id);
 
+// Returns the ID right away and parses the file on another thread. The
+// mesh is uploaded by update_graphics once it's ready, and until then
+// the model is drawn as MODEL_SPHERE. So it stays if loading fails.
+ModelID load_3d_model_async(const char *file);
+bool    is_model_loading(ModelID id);
+
+// Stores the material given by the file of a model, for formats that
+// have one (glTF). Returns false if there's none or it's still loading.
+bool    get_model_material(ModelID id, Material *mat);
+
+// Blocks until all models being loaded are uploaded. Returns false if
+// any of them couldn't be loaded.
+bool    wait_for_models(void);
+
+typedef struct {
+	PoolStats vertices;
+	PoolStats indices;
+} MeshMemoryStats;
+
+MeshMemoryStats get_mesh_memory_stats(void);
+
+typedef enum {
+	GPU_MEMORY_MESHES,
+	GPU_MEMORY_TEXTURES,   // Environment map and IBL precomputations
+	GPU_MEMORY_SHADOW_MAP,
+	GPU_MEMORY_TARGETS,    // Offscreen and capture framebuffers
+	GPU_MEMORY_STREAMING,  // Per-frame object data and readback buffers
+	GPU_MEMORY_COUNT,
+} GPUMemoryCategory;
+
+// Counters of the last rendered frame. Memory is what was requested
+// from the driver, which may round it up.
+typedef struct {
+	int  draw_calls;
+	int  triangles;
+	int  program_binds;
+	int  vao_binds;
+	int  texture_binds;
+	int  uniforms_set;
+	int  commands_queued;
+	int  commands_dropped; // Because the command queue or stream buffer was full
+	int  meshlets_culled;  // Off screen or facing away, in the lit pass
+	bool shadow_map_cached;
+	size_t gpu_memory[GPU_MEMORY_COUNT];
+
+	// Milliseconds between rendered frames, over the last
+	// FRAME_TIME_HISTORY frames
+	int   frame_count;
+	float frame_time_avg;
+	float frame_time_p50;
+	float frame_time_p95;
+	float frame_time_p99;
+	float frame_time_max;
+} FrameStats;
+
+#define FRAME_TIME_HISTORY 240
+
+FrameStats  get_frame_stats(void);
+const char *get_gpu_memory_category_name(GPUMemoryCategory category);
+
+// Draws the frame stats and a frame time graph over the frame
+void show_stats_overlay(bool yes);
+
 void init_graphics(void *window);
-void update_graphics(void);
+bool update_graphics(void);
+
+// Once an offscreen target is set, frames are rendered into a
+// framebuffer of that size instead of the window, which may be NULL.
+bool set_offscreen_target(int width, int height);
+void get_frame_size(int *width, int *height);
+void read_frame_pixels(unsigned char *dst);
+
+// Asynchronous version of read_frame_pixels. The copy is started after
+// update_graphics and collected one frame later, without stalling.
+int            begin_frame_readback(void);
+unsigned char *end_frame_readback(int ticket, int *width, int *height);
+
+// Screenshots and recordings are read back asynchronously and saved
+// by the encoder threads, which must be running (see init_encoder).
+typedef enum {
+	CAPTURE_PNG, // One file per frame
+	CAPTURE_RAW, // Concatenated RGB frames
+	CAPTURE_Y4M, // YUV4MPEG2 video
+} CaptureFormat;
+
+void take_screenshot(const char *file);
+bool is_frame_pattern(const char *pattern);
+bool start_recording(const char *path, CaptureFormat format, int fps);
+void stop_recording(void);
+
+void set_render_on_demand(bool yes);
+void request_redraw(void);
+void invalidate_shadow_map(void);
 
 void set_clear_color(Vector3 color);
 void set_light(Vector3 dir, Vector3 color);
 void show_environment(bool yes);
 
 void draw_model(ModelID id, Vector3 pos, Vector3 scale, Vector3 rotate, Material mat);
+void draw_model_matrix(ModelID id, Matrix4 model, Matrix4 normal, Material mat);
 void draw_sphere(float x, float y, float z, float radius, Material mat);
-void draw_cube(float x, float y, float z, float w, float h, float d, Material mat);
\ No newline at end of file
+void draw_cube(float x, float y, float z, float w, float h, float d, Material mat);
+
+// Static batches hold geometry that is drawn every frame but rarely
+// changes. It's merged once and re-uploaded only after the batch is
+// modified or invalidated.
+typedef uint32_t StaticBatchID;
+#define STATIC_BATCH_INVALID ((StaticBatchID) 0)
+
+StaticBatchID create_static_batch(void);
+void free_static_batch(StaticBatchID batch);
+void add_static_model(StaticBatchID batch, ModelID id, Vector3 pos, Vector3 scale, Vector3 rotate, Material mat);
+void add_static_cube(StaticBatchID batch, float x, float y, float z, float w, float h, float d, Material mat);
+void clear_static_batch(StaticBatchID batch);
+void invalidate_static_batch(StaticBatchID batch);
+void draw_static_batch(StaticBatchID batch);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "headless.h"
+
+#ifdef _WIN32
+
+bool init_headless_context(void)
+{
+	fprintf(stderr, "Headless rendering is only supported on Linux\n");
+	return false;
+}
+
+void free_headless_context(void)
+{
+}
+
+#else
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+/*
+ * The context is created through EGL. Mesa exposes a "surfaceless"
+ * platform that needs no display at all, which is tried first. Other
+ * drivers get the default display. In both cases the context is made
+ * current without a surface (EGL_KHR_surfaceless_context) or, if that
+ * isn't supported, with a 1x1 pbuffer. The default framebuffer is never
+ * used anyway.
+ */
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLSurface surface = EGL_NO_SURFACE;
+
+static EGLDisplay get_display(void)
+{
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display) {
+		EGLDisplay d = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (d != EGL_NO_DISPLAY && eglInitialize(d, NULL, NULL))
+			return d;
+	}
+#endif
+	EGLDisplay d = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (d != EGL_NO_DISPLAY && eglInitialize(d, NULL, NULL))
+		return d;
+	return EGL_NO_DISPLAY;
+}
+
+bool init_headless_context(void)
+{
+	display = get_display();
+	if (display == EGL_NO_DISPLAY) {
+		fprintf(stderr, "Couldn't initialize EGL display\n");
+		return false;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "EGL doesn't support desktop OpenGL\n");
+		free_headless_context();
+		return false;
+	}
+
+	EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE,
+	};
+	EGLConfig config;
+	EGLint num_configs = 0;
+	eglChooseConfig(display, config_attribs, &config, 1, &num_configs);
+
+	const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+	bool surfaceless = extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+
+	if (num_configs == 0 && !surfaceless) {
+		fprintf(stderr, "No EGL config with pbuffer support\n");
+		free_headless_context();
+		return false;
+	}
+
+	EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE,
+	};
+	context = eglCreateContext(display, num_configs ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attribs);
+	if (context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Couldn't create EGL context (0x%x)\n", eglGetError());
+		free_headless_context();
+		return false;
+	}
+
+	if (!surfaceless) {
+		EGLint pbuffer_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+		surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+		if (surface == EGL_NO_SURFACE) {
+			fprintf(stderr, "Couldn't create EGL pbuffer (0x%x)\n", eglGetError());
+			free_headless_context();
+			return false;
+		}
+	}
+
+	if (!eglMakeCurrent(display, surface, surface, context)) {
+		fprintf(stderr, "Couldn't make EGL context current (0x%x)\n", eglGetError());
+		free_headless_context();
+		return false;
+	}
+
+	if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+		fprintf(stderr, "Failed to initialize GLAD\n");
+		free_headless_context();
+		return false;
+	}
+
+	return true;
+}
+
+void free_headless_context(void)
+{
+	if (display == EGL_NO_DISPLAY)
+		return;
+
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+	if (surface != EGL_NO_SURFACE)
+		eglDestroySurface(display, surface);
+	if (context != EGL_NO_CONTEXT)
+		eglDestroyContext(display, context);
+	eglTerminate(display);
+
+	display = EGL_NO_DISPLAY;
+	context = EGL_NO_CONTEXT;
+	surface = EGL_NO_SURFACE;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef HEADLESS_INCLUDED
+#define HEADLESS_INCLUDED
+
+#include <stdbool.h>
+
+// OpenGL 3.3 core context that isn't tied to any window or display
+// server, so the renderer can run on servers without X11. Rendering
+// must go to an offscreen target (see set_offscreen_target). Also loads
+// the GL functions through glad.
+bool init_headless_context(void);
+void free_headless_context(void);
+
+#endif
@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <string.h>
+#include "image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+bool save_ppm(const char *file, const unsigned char *pixels, int width, int height)
+{
+	FILE *stream = fopen(file, "wb");
+	if (stream == NULL)
+		return false;
+
+	fprintf(stream, "P6\n%d %d\n255\n", width, height);
+	fwrite(pixels, 3, (size_t) width * height, stream);
+
+	bool ok = !ferror(stream);
+	if (fclose(stream))
+		ok = false;
+	return ok;
+}
+
+bool save_png(const char *file, const unsigned char *pixels, int width, int height)
+{
+	return stbi_write_png(file, width, height, 3, pixels, 3 * width) != 0;
+}
+
+// Picks the format from the extension of the file, PNG by default
+bool save_image(const char *file, const unsigned char *pixels, int width, int height)
+{
+	const char *dot = strrchr(file, '.');
+	if (dot && !strcmp(dot, ".ppm"))
+		return save_ppm(file, pixels, width, height);
+	return save_png(file, pixels, width, height);
+}
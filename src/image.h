@@ -0,0 +1,11 @@
+#ifndef IMAGE_INCLUDED
+#define IMAGE_INCLUDED
+
+#include <stdbool.h>
+
+// Pixels are tightly packed RGB rows, top to bottom
+bool save_ppm(const char *file, const unsigned char *pixels, int width, int height);
+bool save_png(const char *file, const unsigned char *pixels, int width, int height);
+bool save_image(const char *file, const unsigned char *pixels, int width, int height);
+
+#endif
@@ -1,11 +1,20 @@
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <glad/glad.h>
 //#define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
 #include "camera.h"
+#include "encoder.h"
 #include "graphics.h"
+#include "headless.h"
+#include "image.h"
+#include "profiler.h"
+#include "gpu_timer.h"
+#include "scene.h"
+#include "utils.h"
 #include "vector.h"
 #include "mesh.h"
 
@@ -14,10 +23,24 @@ static void error_callback(int error, const char* description)
 	fprintf(stderr, "Error: %s\n", description);
 }
 
+static bool stats_overlay = false;
+
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GLFW_TRUE);
+
+	if (key == GLFW_KEY_F12 && action == GLFW_PRESS) {
+		static int count = 0;
+		char file[64];
+		snprintf(file, sizeof(file), "screenshot_%03d.png", count++);
+		take_screenshot(file);
+	}
+
+	if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+		stats_overlay = !stats_overlay;
+		show_stats_overlay(stats_overlay);
+	}
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -30,6 +53,12 @@ void cursor_pos_callback(GLFWwindow *window, double x, double y)
 	rotate_camera(x, y);
 }
 
+void window_refresh_callback(GLFWwindow *window)
+{
+	(void) window;
+	request_redraw();
+}
+
 typedef enum {
 	PIECE_PAWN,
 	PIECE_KING,
@@ -90,8 +119,709 @@ void init_board(Board *board)
 	*/
 }
 
-int main(void)
+// Parses the piece placement field of a FEN string, which lists the
+// ranks from 8 to 1. The other fields are ignored. Rank 8 is at j=0,
+// like the black pieces of init_board, and the a-file is at i=0.
+static bool parse_fen(const char *fen, Board *board)
+{
+	for (int i = 0; i < 8; i++)
+		for (int j = 0; j < 8; j++)
+			board->pieces[i][j] = (Piece) {false, PIECE_VOID};
+
+	int rank = 0;
+	int file = 0;
+	for (const char *p = fen; *p && *p != ' '; p++) {
+
+		if (*p == '/') {
+			if (file != 8)
+				return false;
+			rank++;
+			file = 0;
+			continue;
+		}
+
+		if (*p >= '1' && *p <= '8') {
+			file += *p - '0';
+			if (file > 8)
+				return false;
+			continue;
+		}
+
+		PieceType type;
+		switch (*p | 0x20) {
+			case 'p': type = PIECE_PAWN;   break;
+			case 'n': type = PIECE_KNIGHT; break;
+			case 'b': type = PIECE_BISHOP; break;
+			case 'r': type = PIECE_ROOK;   break;
+			case 'q': type = PIECE_QUEEN;  break;
+			case 'k': type = PIECE_KING;   break;
+			default: return false;
+		}
+		if (rank > 7 || file > 7)
+			return false;
+
+		bool is_black = (*p >= 'a' && *p <= 'z');
+		board->pieces[file][rank] = (Piece) {is_black, type};
+		file++;
+	}
+
+	return rank == 7 && file == 8;
+}
+
+static float cell_w = 1.5;
+static float cell_d = 1.5;
+static float board_h = 0.5;
+
+static ModelID piece_models[PIECE_VOID+1];
+
+static void load_piece_models(void)
+{
+	PROFILE_BEGIN("load models");
+
+	// Pieces are drawn as spheres until their model is loaded, or if
+	// it can't be
+	piece_models[PIECE_PAWN]   = load_3d_model_async("assets/pieces/pawn.obj");
+	piece_models[PIECE_BISHOP] = load_3d_model_async("assets/pieces/bishop.obj");
+	piece_models[PIECE_KING]   = load_3d_model_async("assets/pieces/king.obj");
+	piece_models[PIECE_KNIGHT] = load_3d_model_async("assets/pieces/knight.obj");
+	piece_models[PIECE_QUEEN]  = load_3d_model_async("assets/pieces/queen.obj");
+	piece_models[PIECE_ROOK]   = load_3d_model_async("assets/pieces/rook.obj");
+	piece_models[PIECE_VOID]   = MODEL_INVALID;
+
+	PROFILE_END();
+}
+
+// The squares never move, so they're baked once instead of being
+// pushed as 64 separate cubes every frame
+static StaticBatchID build_squares(void)
+{
+	StaticBatchID batch = create_static_batch();
+	for (int i = 0; i < 8; i++)
+		for (int j = 0; j < 8; j++) {
+			Material material;
+			if ((i + j) & 1) material = (Material) {.baseColor={0, 0, 0}, .metallic=0, .perceptualRoughness=0};
+			else             material = (Material) {.baseColor={1, 1, 1}, .metallic=0, .perceptualRoughness=0};
+			add_static_cube(batch, cell_w * i, -board_h, cell_d * j, cell_w, board_h, cell_d, material);
+		}
+	return batch;
+}
+
+// Black or white, with the surface of the model's file if it has a
+// material. Its color is ignored, since a file is shared by both sides.
+// Models that are still loading have no material yet.
+static Material get_piece_material(Piece piece)
+{
+	Material mat = piece.is_black
+		? (Material) {.baseColor={0, 0, 0}, .metallic=0.0, .perceptualRoughness=0}
+		: (Material) {.baseColor={1, 1, 1}, .metallic=0.0, .perceptualRoughness=0};
+
+	Material file;
+	if (get_model_material(piece_models[piece.type], &file)) {
+		mat.metallic = file.metallic;
+		mat.perceptualRoughness = file.perceptualRoughness;
+	}
+	return mat;
+}
+
+static bool are_piece_models_loading(void)
+{
+	for (int i = 0; i < PIECE_VOID; i++)
+		if (is_model_loading(piece_models[i]))
+			return true;
+	return false;
+}
+
+// Pieces are nodes of the scene, so their matrices are only
+// recomputed when they are moved. Returns the parent of all pieces.
+static NodeID build_pieces(const Board *board)
+{
+	NodeID board_node = create_node(NODE_INVALID);
+	for (int i = 0; i < 8; i++)
+		for (int j = 0; j < 8; j++) {
+
+			if (board->pieces[i][j].type == PIECE_VOID)
+				continue;
+
+			Material piece_material = get_piece_material(board->pieces[i][j]);
+
+			float rotation = board->pieces[i][j].is_black ? -3.14/2 : 3.14/2;
+
+			NodeID node = create_node(board_node);
+			set_node_transform(node, (Vector3) {cell_w * (i + 0.5), 0, cell_d * (j + 0.5)}, (Vector3) {1, 1, 1}, (Vector3) {0, rotation, 0});
+			set_node_model(node, piece_models[board->pieces[i][j].type], piece_material);
+		}
+	return board_node;
+}
+
+// Loads the models and builds the board. Returns the static batch
+// of the squares, which must be drawn every frame. The pieces get the
+// default materials while their models load, so the caller rebuilds
+// them from "board" and "pieces" once they are in.
+static StaticBatchID setup_scene(Board *board, NodeID *pieces)
+{
+	PROFILE_BEGIN("setup scene");
+
+	set_light((Vector3) {0.6f, 1.0f, 0.3f}, (Vector3) {1, 1, 1});
+
+	load_piece_models();
+
+	init_board(board);
+
+	StaticBatchID board_batch = build_squares();
+	*pieces = build_pieces(board);
+
+	// Not part of the board, so they are kept when the pieces are rebuilt
+	NodeID kings = create_node(NODE_INVALID);
+
+	{
+		Material material = {.baseColor={1, 1, 1}, .metallic=1.0, .perceptualRoughness=0, .reflectance=0};
+		Vector3 pos =  {cell_w * (4 + 0.5), 0, cell_d * (4 + 0.5)};
+		NodeID node = create_node(kings);
+		set_node_transform(node, pos, (Vector3) {1, 1, 1}, (Vector3) {0, 0, 0});
+		set_node_model(node, piece_models[PIECE_KING], material);
+	}
+
+	{
+		Material material = {.baseColor={0, 0, 0}, .metallic=1.0, .perceptualRoughness=0, .reflectance=0};
+		Vector3 pos =  {cell_w * (5 + 0.5), 0, cell_d * (4 + 0.5)};
+		NodeID node = create_node(kings);
+		set_node_transform(node, pos, (Vector3) {1, 1, 1}, (Vector3) {0, 0, 0});
+		set_node_model(node, piece_models[PIECE_KING], material);
+	}
+
+	show_environment(true);
+	set_clear_color((Vector3) {0.2, 0.5, 0.1});
+
+	PROFILE_END();
+	return board_batch;
+}
+
+// Renders a single frame into an offscreen framebuffer and saves it to
+// "output". Doesn't need a display server.
+static int run_headless(int width, int height, const char *output)
+{
+	if (!init_headless_context())
+		return -1;
+
+	init_graphics(NULL);
+	if (!set_offscreen_target(width, height)) {
+		free_headless_context();
+		return -1;
+	}
+
+	Board board;
+	NodeID pieces;
+	StaticBatchID board_batch = setup_scene(&board, &pieces);
+	wait_for_models();
+
+	free_node(pieces);
+	pieces = build_pieces(&board);
+
+	draw_static_batch(board_batch);
+	draw_scene();
+	update_graphics();
+
+	unsigned char *pixels = malloc((size_t) width * height * 3);
+	if (pixels == NULL) {
+		free_headless_context();
+		return -1;
+	}
+	read_frame_pixels(pixels);
+	flush_gpu_timers();
+
+	int result = 0;
+	if (!save_image(output, pixels, width, height)) {
+		fprintf(stderr, "Couldn't write '%s'\n", output);
+		result = -1;
+	}
+
+	free(pixels);
+	free_headless_context();
+	return result;
+}
+
+typedef struct {
+	const char *name;
+	Vector3 pos;
+	Vector3 target;
+} CameraPreset;
+
+static const CameraPreset camera_presets[] = {
+	{"default", {4.027637, 17.071016, 10.351642}, {4.025907, 16.127215, 10.021133}},
+	{"white",   {6, 17, 25}, {6, 0, 6}},
+	{"black",   {6, 17, -13}, {6, 0, 6}},
+	{"top",     {6, 28, 6.5}, {6, 0, 6}},
+};
+
+static const CameraPreset *find_camera_preset(const char *name)
+{
+	for (size_t i = 0; i < sizeof(camera_presets) / sizeof(camera_presets[0]); i++)
+		if (!strcmp(camera_presets[i].name, name))
+			return &camera_presets[i];
+	return NULL;
+}
+
+// Hands the frame of a previous job to the encoder threads
+static bool finish_job(int ticket, const char *output)
+{
+	int w, h;
+	unsigned char *pixels = end_frame_readback(ticket, &w, &h);
+	if (pixels == NULL) {
+		fprintf(stderr, "Couldn't read back frame for '%s'\n", output);
+		return false;
+	}
+	encode_image(output, pixels, w, h);
+	return true;
+}
+
+// Renders a sequence of jobs read from "jobs_file" ("-" for stdin) in
+// a single process, so that the shaders and IBL maps are only prepared
+// once. Each line is "<output> <width>x<height> <camera> <FEN>", e.g.
+//
+//   start.png 512x512 white rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
+//
+// The readback of a frame is started after it's rendered and collected
+// while the next one is being rendered. Encoding happens on a pool of
+// threads.
+static int run_batch(const char *jobs_file, int num_threads)
+{
+	FILE *stream = strcmp(jobs_file, "-") ? fopen(jobs_file, "r") : stdin;
+	if (stream == NULL) {
+		fprintf(stderr, "Couldn't open '%s'\n", jobs_file);
+		return -1;
+	}
+
+	if (!init_headless_context()) {
+		if (stream != stdin) fclose(stream);
+		return -1;
+	}
+
+	init_graphics(NULL);
+
+	if (!init_encoder(num_threads)) {
+		free_headless_context();
+		if (stream != stdin) fclose(stream);
+		return -1;
+	}
+
+	set_light((Vector3) {0.6f, 1.0f, 0.3f}, (Vector3) {1, 1, 1});
+	show_environment(true);
+	set_clear_color((Vector3) {0.2, 0.5, 0.1});
+
+	load_piece_models();
+	StaticBatchID board_batch = build_squares();
+	NodeID pieces = NODE_INVALID;
+
+	// Offscreen frames must not show placeholders
+	wait_for_models();
+
+	int target_w = 0;
+	int target_h = 0;
+
+	int  pending = -1;
+	char pending_output[1024];
+
+	int failed = 0;
+	int line_no = 0;
+	char line[4096];
+	while (fgets(line, sizeof(line), stream)) {
+
+		line_no++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		const char *p = line;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		char output[1024];
+		char preset_name[64];
+		int w, h, n;
+		if (sscanf(p, "%1023s %dx%d %63s %n", output, &w, &h, preset_name, &n) != 4 || w <= 0 || h <= 0) {
+			fprintf(stderr, "Line %d: invalid job\n", line_no);
+			failed++;
+			continue;
+		}
+
+		Board board;
+		if (!parse_fen(p + n, &board)) {
+			fprintf(stderr, "Line %d: invalid FEN\n", line_no);
+			failed++;
+			continue;
+		}
+
+		const CameraPreset *preset = find_camera_preset(preset_name);
+		if (preset == NULL) {
+			fprintf(stderr, "Line %d: unknown camera '%s'\n", line_no, preset_name);
+			failed++;
+			continue;
+		}
+
+		if (w != target_w || h != target_h) {
+			if (!set_offscreen_target(w, h)) {
+				failed++;
+				continue;
+			}
+			target_w = w;
+			target_h = h;
+		}
+
+		set_camera(preset->pos, preset->target);
+
+		PROFILE_BEGIN("job");
+
+		PROFILE_BEGIN("command build");
+		if (pieces != NODE_INVALID)
+			free_node(pieces);
+		pieces = build_pieces(&board);
+
+		draw_static_batch(board_batch);
+		draw_scene();
+		PROFILE_END();
+
+		PROFILE_BEGIN("update_graphics");
+		update_graphics();
+		PROFILE_END();
+
+		int ticket = begin_frame_readback();
+
+		// While the GPU copies this frame, collect the previous one
+		PROFILE_BEGIN("readback");
+		if (pending >= 0 && !finish_job(pending, pending_output))
+			failed++;
+		PROFILE_END();
+
+		PROFILE_END();
+
+		pending = ticket;
+		if (pending < 0)
+			failed++;
+		strcpy(pending_output, output);
+	}
+
+	if (pending >= 0 && !finish_job(pending, pending_output))
+		failed++;
+
+	if (!free_encoder())
+		failed++;
+
+	flush_gpu_timers();
+	free_headless_context();
+	if (stream != stdin) fclose(stream);
+	return failed ? -1 : 0;
+}
+
+/*
+ * Benchmark
+ *
+ * Renders a fixed number of frames offscreen while the camera follows a
+ * path and the pieces go through a fixed sequence of positions, so that
+ * two runs render exactly the same frames. Nothing waits for vertical
+ * sync since nothing is presented, which also means it runs without a
+ * display (e.g. on llvmpipe).
+ */
+
+#define BENCHMARK_WARMUP 10 // Frames rendered before measuring
+
+// The first moves of a game, played over the length of the run
+static const char *benchmark_positions[] = {
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR",
+	"rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR",
+	"rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR",
+	"rnbqkbnr/pppp1ppp/8/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R",
+	"r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R",
+	"r1bqkbnr/pppp1ppp/2n5/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R",
+	"r1bqk1nr/pppp1ppp/2n5/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQK2R",
+	"r1bqk1nr/pppp1ppp/2n5/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQ1RK1",
+	"r1bqk2r/pppp1ppp/2n2n2/2b1p3/2B1P3/5N2/PPPP1PPP/RNBQ1RK1",
+};
+
+typedef struct {
+	Vector3 pos;
+	Vector3 target;
+} CameraKey;
+
+// Reads a path saved with --save-path. Each line is a camera position
+// followed by the point it looks at.
+static CameraKey *load_camera_path(const char *file, int *count)
+{
+	FILE *stream = fopen(file, "r");
+	if (stream == NULL)
+		return NULL;
+
+	CameraKey *keys = NULL;
+	int num_keys = 0;
+	int cap_keys = 0;
+
+	char line[256];
+	while (fgets(line, sizeof(line), stream)) {
+		CameraKey key;
+		if (line[0] == '#' || sscanf(line, "%f %f %f %f %f %f",
+				&key.pos.x, &key.pos.y, &key.pos.z,
+				&key.target.x, &key.target.y, &key.target.z) != 6)
+			continue;
+
+		if (num_keys == cap_keys) {
+			cap_keys = cap_keys ? 2 * cap_keys : 64;
+			CameraKey *grown = realloc(keys, cap_keys * sizeof(CameraKey));
+			if (grown == NULL) {
+				free(keys);
+				fclose(stream);
+				return NULL;
+			}
+			keys = grown;
+		}
+		keys[num_keys++] = key;
+	}
+	fclose(stream);
+
+	if (num_keys == 0) {
+		free(keys);
+		return NULL;
+	}
+	*count = num_keys;
+	return keys;
+}
+
+// Places the camera at "t" (from 0 to 1) along the path, or along an
+// orbit around the board if there is no path
+static void follow_camera_path(const CameraKey *keys, int num_keys, float t)
+{
+	Vector3 center = {cell_w * 4, 0, cell_d * 4};
+
+	if (keys == NULL) {
+		float angle = 2 * 3.14159265f * t;
+		Vector3 pos = {
+			center.x + 18 * cosf(angle),
+			14 + 4 * sinf(2 * angle),
+			center.z + 18 * sinf(angle),
+		};
+		set_camera(pos, center);
+		return;
+	}
+
+	float u = t * (num_keys - 1);
+	int i = (int) u;
+	if (i >= num_keys - 1) {
+		set_camera(keys[num_keys-1].pos, keys[num_keys-1].target);
+		return;
+	}
+	float f = u - i;
+	set_camera(combine(keys[i].pos,    keys[i+1].pos,    1 - f, f),
+	           combine(keys[i].target, keys[i+1].target, 1 - f, f));
+}
+
+static void write_json_string(FILE *stream, const char *str)
+{
+	fputc('"', stream);
+	for (const char *p = str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			fputc('\\', stream);
+		if ((unsigned char) *p >= 0x20)
+			fputc(*p, stream);
+	}
+	fputc('"', stream);
+}
+
+static void write_json_times(FILE *stream, TimeSummary s)
+{
+	fprintf(stream, "{\"min\": %.3f, \"avg\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+		s.min, s.avg, s.p50, s.p95, s.p99, s.max);
+}
+
+static int run_benchmark(int width, int height, int num_frames, const char *path_file, const char *output)
+{
+	int num_keys = 0;
+	CameraKey *keys = NULL;
+	if (path_file) {
+		keys = load_camera_path(path_file, &num_keys);
+		if (keys == NULL) {
+			fprintf(stderr, "Couldn't load camera path '%s'\n", path_file);
+			return -1;
+		}
+	}
+
+	if (!init_headless_context()) {
+		free(keys);
+		return -1;
+	}
+
+	init_graphics(NULL);
+	if (!set_offscreen_target(width, height)) {
+		free_headless_context();
+		free(keys);
+		return -1;
+	}
+
+	set_light((Vector3) {0.6f, 1.0f, 0.3f}, (Vector3) {1, 1, 1});
+	show_environment(true);
+	set_clear_color((Vector3) {0.2, 0.5, 0.1});
+
+	load_piece_models();
+	StaticBatchID board_batch = build_squares();
+	NodeID pieces = NODE_INVALID;
+
+	// Offscreen frames must not show placeholders
+	wait_for_models();
+
+	float *frame_times = malloc(num_frames * sizeof(float));
+	float *cpu_times   = malloc(num_frames * sizeof(float));
+	if (frame_times == NULL || cpu_times == NULL) {
+		free(frame_times);
+		free(cpu_times);
+		free_headless_context();
+		free(keys);
+		return -1;
+	}
+	FrameStats totals = {0};
+	int shadow_renders = 0;
+
+	int num_positions = sizeof(benchmark_positions) / sizeof(benchmark_positions[0]);
+	int position = -1;
+
+	uint64_t last_start = 0;
+	for (int frame = -BENCHMARK_WARMUP; frame < num_frames; frame++) {
+
+		PROFILE_BEGIN("frame");
+
+		if (frame == 0)
+			reset_gpu_timer_stats();
+
+		uint64_t start = profile_time();
+		if (frame > 0)
+			frame_times[frame-1] = (start - last_start) / 1000000.0f;
+		last_start = start;
+
+		// The warmup frames render the first position from the start of the path
+		int measured = frame < 0 ? 0 : frame;
+		float t = num_frames > 1 ? (float) measured / (num_frames - 1) : 0;
+
+		PROFILE_BEGIN("command build");
+		int new_position = measured * num_positions / num_frames;
+		if (new_position != position) {
+			position = new_position;
+			Board board;
+			parse_fen(benchmark_positions[position], &board);
+			if (pieces != NODE_INVALID)
+				free_node(pieces);
+			pieces = build_pieces(&board);
+		}
+		follow_camera_path(keys, num_keys, t);
+
+		draw_static_batch(board_batch);
+		draw_scene();
+		PROFILE_END();
+
+		PROFILE_BEGIN("update_graphics");
+		update_graphics();
+		PROFILE_END();
+
+		PROFILE_END();
+
+		if (frame < 0)
+			continue;
+
+		cpu_times[frame] = (profile_time() - start) / 1000000.0f;
+
+		FrameStats stats = get_frame_stats();
+		totals.draw_calls       += stats.draw_calls;
+		totals.triangles        += stats.triangles;
+		totals.program_binds    += stats.program_binds;
+		totals.vao_binds        += stats.vao_binds;
+		totals.texture_binds    += stats.texture_binds;
+		totals.uniforms_set     += stats.uniforms_set;
+		totals.commands_queued  += stats.commands_queued;
+		totals.commands_dropped += stats.commands_dropped;
+		totals.meshlets_culled  += stats.meshlets_culled;
+		if (!stats.shadow_map_cached)
+			shadow_renders++;
+	}
+
+	// The last frame ends when the GPU is done with it
+	glFinish();
+	frame_times[num_frames-1] = (profile_time() - last_start) / 1000000.0f;
+	flush_gpu_timers();
+
+	TimeSummary frame_summary = summarize_times(frame_times, num_frames);
+	TimeSummary cpu_summary   = summarize_times(cpu_times, num_frames);
+
+	float gpu_total = 0;
+	for (int i = GPU_ZONE_SHADOW; i <= GPU_ZONE_SKYBOX; i++)
+		gpu_total += get_gpu_zone_mean(i);
+
+	printf("%d frames at %dx%d: avg %.2f ms, p99 %.2f ms (CPU %.2f ms, GPU %.2f ms)\n",
+		num_frames, width, height, frame_summary.avg, frame_summary.p99, cpu_summary.avg, gpu_total);
+
+	int result = 0;
+	FILE *stream = fopen(output, "w");
+	if (stream == NULL) {
+		fprintf(stderr, "Couldn't write '%s'\n", output);
+		result = -1;
+	} else {
+
+		FrameStats stats = get_frame_stats();
+
+		fprintf(stream, "{\n");
+		fprintf(stream, "  \"renderer\": ");
+		write_json_string(stream, (const char*) glGetString(GL_RENDERER));
+		fprintf(stream, ",\n  \"version\": ");
+		write_json_string(stream, (const char*) glGetString(GL_VERSION));
+		fprintf(stream, ",\n  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n  \"warmup_frames\": %d,\n",
+			width, height, num_frames, BENCHMARK_WARMUP);
+		fprintf(stream, "  \"camera_path\": ");
+		write_json_string(stream, path_file ? path_file : "orbit");
+		fprintf(stream, ",\n  \"frame_time_ms\": ");
+		write_json_times(stream, frame_summary);
+		fprintf(stream, ",\n  \"cpu_time_ms\": ");
+		write_json_times(stream, cpu_summary);
+
+		fprintf(stream, ",\n  \"gpu_time_ms\": {");
+		for (int i = GPU_ZONE_SHADOW; i <= GPU_ZONE_SKYBOX; i++)
+			fprintf(stream, "\"%s\": %.3f, ", get_gpu_zone_name(i), get_gpu_zone_mean(i));
+		fprintf(stream, "\"total\": %.3f}", gpu_total);
+
+		fprintf(stream, ",\n  \"counters\": {\"draw_calls\": %.1f, \"triangles\": %.1f, \"program_binds\": %.1f, "
+			"\"vao_binds\": %.1f, \"texture_binds\": %.1f, \"uniforms_set\": %.1f, \"commands_queued\": %.1f, "
+			"\"commands_dropped\": %.1f, \"meshlets_culled\": %.1f, \"shadow_map_renders\": %d}",
+			(float) totals.draw_calls / num_frames,
+			(float) totals.triangles / num_frames,
+			(float) totals.program_binds / num_frames,
+			(float) totals.vao_binds / num_frames,
+			(float) totals.texture_binds / num_frames,
+			(float) totals.uniforms_set / num_frames,
+			(float) totals.commands_queued / num_frames,
+			(float) totals.commands_dropped / num_frames,
+			(float) totals.meshlets_culled / num_frames,
+			shadow_renders);
+
+		fprintf(stream, ",\n  \"gpu_memory_bytes\": {");
+		for (int i = 0; i < GPU_MEMORY_COUNT; i++)
+			fprintf(stream, "%s\"%s\": %zu", i ? ", " : "", get_gpu_memory_category_name(i), stats.gpu_memory[i]);
+		fprintf(stream, "}\n}\n");
+		fclose(stream);
+	}
+
+	free(frame_times);
+	free(cpu_times);
+	free(keys);
+	free_headless_context();
+	return result;
+}
+
+// Interactive viewer
+static CaptureFormat record_format(const char *file)
 {
+	const char *dot = strrchr(file, '.');
+	if (dot && !strcmp(dot, ".y4m")) return CAPTURE_Y4M;
+	if (dot && !strcmp(dot, ".raw")) return CAPTURE_RAW;
+	return CAPTURE_PNG;
+}
+
+static int run_window(int width, int height, bool on_demand, const char *record_file, int record_fps, const char *save_path_file)
+{
+	PROFILE_BEGIN("startup");
+
 	glfwSetErrorCallback(error_callback);
 
 	if (!glfwInit())
@@ -101,7 +831,7 @@ int main(void)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-	GLFWwindow *window = glfwCreateWindow(2*640, 2*480, "3D Chess", NULL, NULL);
+	GLFWwindow *window = glfwCreateWindow(width, height, "3D Chess", NULL, NULL);
 	if (!window) {
 		glfwTerminate();
 		return -1;
@@ -110,6 +840,7 @@ int main(void)
 	glfwSetKeyCallback(window, key_callback);
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetCursorPosCallback(window, cursor_pos_callback);
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	glfwMakeContextCurrent(window);
@@ -122,76 +853,217 @@ int main(void)
 	glfwSwapInterval(1);
 
 	init_graphics(window);
+	set_render_on_demand(on_demand);
 
-	set_light((Vector3) {0.6f, 1.0f, 0.3f}, (Vector3) {1, 1, 1});
+	// Screenshots and recordings are saved in the background
+	init_encoder(2);
 
-	ModelID piece_models[] = {
-		[PIECE_PAWN]   = load_3d_model("assets/pieces/pawn.obj"),
-		[PIECE_BISHOP] = load_3d_model("assets/pieces/bishop.obj"),
-		[PIECE_KING]   = load_3d_model("assets/pieces/king.obj"),
-		[PIECE_KNIGHT] = load_3d_model("assets/pieces/knight.obj"),
-		[PIECE_QUEEN]  = load_3d_model("assets/pieces/queen.obj"),
-		[PIECE_ROOK]   = load_3d_model("assets/pieces/rook.obj"),
-		[PIECE_VOID]   = MODEL_INVALID,
-	};
-	for (int i = 0; i < 6; i++)
-		if (piece_models[i] == MODEL_INVALID) {
-			printf("Couldn't load model\n");
-			piece_models[i] = MODEL_SPHERE;
-		}
+	if (record_file) {
+		if (!start_recording(record_file, record_format(record_file), record_fps))
+			fprintf(stderr, "Couldn't start recording\n");
+	}
 
 	Board board;
-	init_board(&board);
+	NodeID pieces;
+	StaticBatchID board_batch = setup_scene(&board, &pieces);
+	bool pieces_loading = true;
 
-	show_environment(true);
-	set_clear_color((Vector3) {0.2, 0.5, 0.1});
+	// One line per rendered frame, to be played back by the benchmark
+	FILE *path_stream = NULL;
+	if (save_path_file) {
+		path_stream = fopen(save_path_file, "w");
+		if (path_stream == NULL)
+			fprintf(stderr, "Couldn't write '%s'\n", save_path_file);
+	}
+
+	PROFILE_END();
 
 	while (!glfwWindowShouldClose(window)) {
 
+		PROFILE_BEGIN("frame");
+
+		PROFILE_BEGIN("input");
 		float speed = 0.5;
 		if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) move_camera(UP, speed);
 		if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) move_camera(DOWN, speed);
 		if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) move_camera(LEFT, speed);
 		if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) move_camera(RIGHT, speed);
+		PROFILE_END();
 
-		float cell_w = 1.5;
-		float cell_d = 1.5;
-		float board_h = 0.5;
-
-		for (int i = 0; i < 8; i++)
-			for (int j = 0; j < 8; j++) {
-				
-				Material material;
-				if ((i + j) & 1) material = (Material) {.baseColor={0, 0, 0}, .metallic=0, .perceptualRoughness=0};
-				else             material = (Material) {.baseColor={1, 1, 1}, .metallic=0, .perceptualRoughness=0};
-				draw_cube(cell_w * i, -board_h, cell_d * j, cell_w, board_h, cell_d, material);
-
-				Material piece_material = board.pieces[i][j].is_black
-					? (Material) {.baseColor={0, 0, 0}, .metallic=0.0, .perceptualRoughness=0}
-					: (Material) {.baseColor={1, 1, 1}, .metallic=0.0, .perceptualRoughness=0};
+		PROFILE_BEGIN("command build");
+		if (pieces_loading && !are_piece_models_loading()) {
+			free_node(pieces);
+			pieces = build_pieces(&board);
+			pieces_loading = false;
+		}
+		draw_static_batch(board_batch);
+		draw_scene();
+		PROFILE_END();
 
-				float rotation = board.pieces[i][j].is_black ? -3.14/2 : 3.14/2;
-				draw_model(piece_models[board.pieces[i][j].type], (Vector3) {cell_w * (i + 0.5), 0, cell_d * (j + 0.5)}, (Vector3) {1, 1, 1}, (Vector3) {0, rotation, 0}, piece_material);
-			}
+		PROFILE_BEGIN("update_graphics");
+		bool rendered = update_graphics();
+		PROFILE_END();
 
-		{
-			Material material = {.baseColor={1, 1, 1}, .metallic=1.0, .perceptualRoughness=0, .reflectance=0};
-			Vector3 pos =  {cell_w * (4 + 0.5), 0, cell_d * (4 + 0.5)};
-			draw_model(piece_models[PIECE_KING], pos, (Vector3) {1, 1, 1}, (Vector3) {0, 0, 0}, material);
+		if (rendered && path_stream) {
+			Vector3 pos = get_camera_pos();
+			Vector3 target = combine(pos, get_camera_front(), 1, 1);
+			fprintf(path_stream, "%f %f %f %f %f %f\n", pos.x, pos.y, pos.z, target.x, target.y, target.z);
 		}
 
-		{
-			Material material = {.baseColor={0, 0, 0}, .metallic=1.0, .perceptualRoughness=0, .reflectance=0};
-			Vector3 pos =  {cell_w * (5 + 0.5), 0, cell_d * (4 + 0.5)};
-			draw_model(piece_models[PIECE_KING], pos, (Vector3) {1, 1, 1}, (Vector3) {0, 0, 0}, material);
+		if (rendered) {
+			PROFILE_BEGIN("swap");
+			glfwSwapBuffers(window);
+			PROFILE_END();
+
+			PROFILE_BEGIN("poll events");
+			glfwPollEvents();
+			PROFILE_END();
+		} else {
+			// Nothing changed, so sleep until there is some input. The
+			// timeout bounds the latency of changes not caused by events.
+			glfwWaitEventsTimeout(0.5);
 		}
 
-		update_graphics();
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		PROFILE_END();
 	}
 
+	stop_recording();
+	free_encoder();
+	flush_gpu_timers();
+
+	if (path_stream)
+		fclose(path_stream);
+
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	return 0;
 }
+
+int main(int argc, char **argv)
+{
+	// When rendering on demand, frames are only drawn when something
+	// changed and the loop sleeps waiting for input otherwise
+	bool on_demand = false;
+
+	// In headless mode a single frame is rendered offscreen and saved
+	// to a file, without opening a window
+	bool headless = false;
+	int width  = 2*640;
+	int height = 2*480;
+	const char *output = NULL;
+
+	// Batch mode renders a list of positions, see run_batch
+	const char *jobs_file = NULL;
+	int encoder_threads = 4;
+
+	// Records every rendered frame. The format depends on the extension:
+	// .y4m and .raw are single files, otherwise the path is a pattern
+	// like "frames/%05d.png".
+	const char *record_file = NULL;
+	int record_fps = 60;
+
+	// Writes a Chrome trace of the CPU zones and GPU passes on exit
+	const char *profile_file = NULL;
+
+	// Assets are read from this archive, built with "make assets.pak",
+	// instead of the loose files (see mount_archive). It isn't mounted
+	// by default, since an archive that wasn't rebuilt after editing the
+	// assets would hide the changes.
+	const char *archive_file = NULL;
+
+	// The benchmark renders a fixed number of frames following a camera
+	// path, which can be saved from the interactive viewer
+	int benchmark_frames = 0;
+	const char *path_file = NULL;
+	const char *save_path_file = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--on-demand"))
+			on_demand = true;
+		else if (!strcmp(argv[i], "--headless"))
+			headless = true;
+		else if (!strcmp(argv[i], "--size") && i+1 < argc) {
+			i++;
+			if (sscanf(argv[i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+				fprintf(stderr, "Invalid size '%s' (expected WIDTHxHEIGHT)\n", argv[i]);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--output") && i+1 < argc) {
+			i++;
+			output = argv[i];
+		} else if (!strcmp(argv[i], "--batch") && i+1 < argc) {
+			i++;
+			jobs_file = argv[i];
+		} else if (!strcmp(argv[i], "--threads") && i+1 < argc) {
+			i++;
+			encoder_threads = atoi(argv[i]);
+		} else if (!strcmp(argv[i], "--record") && i+1 < argc) {
+			i++;
+			record_file = argv[i];
+			if (record_format(record_file) == CAPTURE_PNG && !is_frame_pattern(record_file)) {
+				fprintf(stderr, "Invalid recording pattern '%s' (expected one integer conversion, like frames/%%05d.png)\n", record_file);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--fps") && i+1 < argc) {
+			i++;
+			record_fps = atoi(argv[i]);
+		} else if (!strcmp(argv[i], "--benchmark") && i+1 < argc) {
+			i++;
+			benchmark_frames = atoi(argv[i]);
+			if (benchmark_frames <= 0) {
+				fprintf(stderr, "Invalid number of frames '%s'\n", argv[i]);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--path") && i+1 < argc) {
+			i++;
+			path_file = argv[i];
+		} else if (!strcmp(argv[i], "--save-path") && i+1 < argc) {
+			i++;
+			save_path_file = argv[i];
+		} else if (!strcmp(argv[i], "--stats")) {
+			stats_overlay = true;
+		} else if (!strcmp(argv[i], "--profile") && i+1 < argc) {
+			i++;
+			profile_file = argv[i];
+		} else if (!strcmp(argv[i], "--archive") && i+1 < argc) {
+			i++;
+			archive_file = argv[i];
+		} else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			return -1;
+		}
+	}
+
+	if (profile_file) {
+		enable_profiler(true);
+		profile_thread_name("main");
+	}
+
+	if (archive_file && !mount_archive(archive_file)) {
+		fprintf(stderr, "Couldn't mount '%s'\n", archive_file);
+		return -1;
+	}
+
+	// Can also be toggled with F3
+	show_stats_overlay(stats_overlay);
+
+	int result;
+	if (benchmark_frames > 0)
+		result = run_benchmark(width, height, benchmark_frames, path_file, output ? output : "benchmark.json");
+	else if (jobs_file)
+		result = run_batch(jobs_file, encoder_threads);
+	else if (headless)
+		result = run_headless(width, height, output ? output : "frame.ppm");
+	else
+		result = run_window(width, height, on_demand, record_file, record_fps, save_path_file);
+
+	if (profile_file) {
+		if (!save_profile(profile_file))
+			fprintf(stderr, "Couldn't write '%s'\n", profile_file);
+
+		for (int i = 0; i < GPU_ZONE_COUNT; i++)
+			printf("GPU %-16s %8.3f ms\n", get_gpu_zone_name(i), get_gpu_zone_time(i));
+	}
+
+	return result;
+}
@@ -1,11 +1,12 @@
 #include <math.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "utils.h"
 #include "mesh.h"
-
-#define TINYOBJ_LOADER_C_IMPLEMENTATION
-#include "tinyobj_loader_c.h"
+#include "obj.h"
+#include "gltf.h"
 
 void append_vertex(VertexArray *array, Vertex v)
 {
@@ -25,321 +26,1221 @@ void append_vertex(VertexArray *array, Vertex v)
 	array->data[array->size++] = v;
 }
 
-static Vector3 get_sphere_point(float angle_x, float angle_y, float radius)
+/*
+ * Mesh simplification
+ *
+ * Edges are collapsed in order of quadric error (Garland and Heckbert).
+ * Every vertex accumulates the planes of the triangles around it, and
+ * collapsing an edge costs the sum of the squared distances of the new
+ * position from the planes of both endpoints. Collapses that would fold
+ * a triangle over are skipped, and the edges on the border of open
+ * meshes add planes of their own so that holes don't grow.
+ *
+ * The corners that share a position but not their attributes are kept
+ * apart as "wedges". Vertices on texture seams don't move, so that both
+ * sides of a seam keep matching, and the corners of a collapsed vertex
+ * take the wedges of the vertex it collapsed onto. The simplified
+ * levels so keep the normals and texture coordinates of the input.
+ */
+
+// Levels with fewer triangles than this aren't worth their draw call
+#define MIN_LOD_TRIANGLES 64
+
+// Weight of the planes that keep borders in place
+#define BORDER_WEIGHT 100.0
+
+// Triangles around an edge whose wedges are matched when it collapses,
+// two unless the mesh isn't manifold
+#define MAX_EDGE_TRIANGLES 8
+
+// Symmetric 4x4 matrix of the squared distance from a set of planes
+typedef struct {
+	double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+	double area; // Total weight of the planes
+} Quadric;
+
+typedef struct {
+	double   cost;
+	uint32_t a, b;
+	uint32_t version_a;
+	uint32_t version_b;
+	Vector3  target;
+} Collapse;
+
+typedef struct {
+	int *items;
+	int  count;
+	int  capacity;
+} IntList;
+
+typedef struct {
+	int       num_vertices;
+	Vector3  *positions;
+	bool     *seams;     // Positions with more than one pair of texture coordinates
+	Quadric  *quadrics;
+	uint32_t *versions;  // Incremented when a vertex moves
+	bool     *removed;
+	IntList  *triangles_of; // Triangles around each vertex
+
+	int       num_triangles;
+	int       live_triangles;
+	uint32_t (*triangles)[3];
+	uint32_t (*corners)[3]; // Wedge of each corner
+	bool     *dead;
+
+	Vertex   *wedges;       // Attributes of the corners, positions unused
+
+	Collapse *heap;
+	int       heap_count;
+	int       heap_capacity;
+} Simplifier;
+
+static void *checked_alloc(size_t size)
 {
-    Vector3 p;
-    p.x = radius * sin(angle_y) * cos(2 * angle_x);
-    p.y = radius * cos(angle_y);
-    p.z = radius * sin(angle_y) * sin(2 * angle_x);
-    return p;
+	void *p = calloc(1, size ? size : 1);
+	if (p == NULL) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+	return p;
 }
 
-typedef struct {
-    Vertex a;
-    Vertex b;
-    Vertex c;
-} Triangle;
+static void push_int(IntList *list, int value)
+{
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? 2 * list->capacity : 8;
+		list->items = realloc(list->items, list->capacity * sizeof(int));
+		if (!list->items) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+	}
+	list->items[list->count++] = value;
+}
 
-static void calculate_and_set_normals(Triangle *T)
+static Quadric plane_quadric(double nx, double ny, double nz, double d, double weight)
 {
-    #define X1 (T->b.x - T->a.x)
-    #define Y1 (T->b.y - T->a.y)
-    #define Z1 (T->b.z - T->a.z)
+	Quadric q;
+	q.xx = weight * nx * nx; q.xy = weight * nx * ny; q.xz = weight * nx * nz; q.xw = weight * nx * d;
+	q.yy = weight * ny * ny; q.yz = weight * ny * nz; q.yw = weight * ny * d;
+	q.zz = weight * nz * nz; q.zw = weight * nz * d;
+	q.ww = weight * d * d;
+	q.area = weight;
+	return q;
+}
 
-    #define X2 (T->c.x - T->a.x)
-    #define Y2 (T->c.y - T->a.y)
-    #define Z2 (T->c.z - T->a.z)
+static void add_quadric(Quadric *dst, Quadric q)
+{
+	dst->xx += q.xx; dst->xy += q.xy; dst->xz += q.xz; dst->xw += q.xw;
+	dst->yy += q.yy; dst->yz += q.yz; dst->yw += q.yw;
+	dst->zz += q.zz; dst->zw += q.zw;
+	dst->ww += q.ww;
+	dst->area += q.area;
+}
 
-    /*
-     * xnormal = y1*z2 - z1*y2
-     * ynormal = z1*x2 - x1*z2
-     * znormal = x1*y2 - y1*x2
-    */
+static double quadric_error(const Quadric *q, Vector3 v)
+{
+	double x = v.x, y = v.y, z = v.z;
+	double e = q->xx*x*x + 2*q->xy*x*y + 2*q->xz*x*z + 2*q->xw*x
+	         + q->yy*y*y + 2*q->yz*y*z + 2*q->yw*y
+	         + q->zz*z*z + 2*q->zw*z
+	         + q->ww;
+	return e > 0 ? e : 0;
+}
 
-    Vector3 n;
-    n.x = Y1 * Z2 - Z1 * Y2;
-    n.y = Z1 * X2 - X1 * Z2;
-    n.z = X1 * Y2 - Y1 * X2;
+// Position with the least error, if the planes pin one down
+static bool quadric_optimum(const Quadric *q, Vector3 *v)
+{
+	double a = q->xx, b = q->xy, c = q->xz;
+	double d = q->yy, e = q->yz, f = q->zz;
+
+	double c00 = d*f - e*e;
+	double c01 = c*e - b*f;
+	double c02 = b*e - c*d;
+	double det = a*c00 + b*c01 + c*c02;
+
+	// Relative to the scale of the matrix, else nearly flat regions
+	// would put the vertex anywhere on the plane
+	double scale = a + d + f;
+	if (fabs(det) < 1e-6 * scale * scale * scale)
+		return false;
 
-    T->a.nx = n.x;
-    T->a.ny = n.y;
-    T->a.nz = n.z;
+	double c11 = a*f - c*c;
+	double c12 = b*c - a*e;
+	double c22 = a*d - b*b;
 
-    T->b.nx = n.x;
-    T->b.ny = n.y;
-    T->b.nz = n.z;
+	double rx = -q->xw, ry = -q->yw, rz = -q->zw;
+	v->x = (c00*rx + c01*ry + c02*rz) / det;
+	v->y = (c01*rx + c11*ry + c12*rz) / det;
+	v->z = (c02*rx + c12*ry + c22*rz) / det;
+	return true;
+}
 
-    T->c.nx = n.x;
-    T->c.ny = n.y;
-    T->c.nz = n.z;
+static Vector3 sub3(Vector3 a, Vector3 b)
+{
+	return (Vector3) {a.x - b.x, a.y - b.y, a.z - b.z};
+}
 
-    #undef X1
-    #undef Y1
-    #undef Z1
-    #undef X2
-    #undef Y2
-    #undef Z2
+static float dot3(Vector3 a, Vector3 b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
-static Triangle make_triangle(Vector3 a, Vector3 b, Vector3 c)
+static Vector3 triangle_normal(Vector3 a, Vector3 b, Vector3 c)
 {
-    Triangle T;
-    T.a = (Vertex) {a.x, a.y, a.z};
-    T.b = (Vertex) {b.x, b.y, b.z};
-    T.c = (Vertex) {c.x, c.y, c.z};
-    calculate_and_set_normals(&T);
-    return T;
+	return cross(sub3(b, a), sub3(c, a)); // Twice the area long
+}
+
+static bool heap_less(const Collapse *x, const Collapse *y)
+{
+	return x->cost < y->cost;
+}
+
+static void heap_push(Simplifier *s, Collapse c)
+{
+	if (s->heap_count == s->heap_capacity) {
+		s->heap_capacity = s->heap_capacity ? 2 * s->heap_capacity : 1024;
+		s->heap = realloc(s->heap, s->heap_capacity * sizeof(Collapse));
+		if (!s->heap) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+	}
+	int i = s->heap_count++;
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!heap_less(&c, &s->heap[parent]))
+			break;
+		s->heap[i] = s->heap[parent];
+		i = parent;
+	}
+	s->heap[i] = c;
+}
+
+static Collapse heap_pop(Simplifier *s)
+{
+	Collapse top  = s->heap[0];
+	Collapse last = s->heap[--s->heap_count];
+	int i = 0;
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= s->heap_count)
+			break;
+		if (child + 1 < s->heap_count && heap_less(&s->heap[child+1], &s->heap[child]))
+			child++;
+		if (!heap_less(&s->heap[child], &last))
+			break;
+		s->heap[i] = s->heap[child];
+		i = child;
+	}
+	if (s->heap_count > 0)
+		s->heap[i] = last;
+	return top;
 }
 
-VertexArray make_sphere_mesh_2(float radius, int num_segms, bool fake_normals)
+// Queues collapsing "b" onto "a". Vertices on seams stay in place, but
+// others may collapse onto them.
+static void push_collapse(Simplifier *s, uint32_t a, uint32_t b)
 {
-    VertexArray vertices = {0, 0, 0};
+	if (s->seams[b]) {
+		if (s->seams[a])
+			return;
+		uint32_t t = a;
+		a = b;
+		b = t;
+	}
 
-    int x_num_segms = num_segms;
-    int y_num_segms = num_segms;
-    for (int i = 0; i < x_num_segms; i++)
-        for (int j = 0; j < y_num_segms; j++) {
+	Quadric q = s->quadrics[a];
+	add_quadric(&q, s->quadrics[b]);
+
+	Vector3 pa = s->positions[a];
+	Vector3 pb = s->positions[b];
+	Vector3 mid = {(pa.x + pb.x) / 2, (pa.y + pb.y) / 2, (pa.z + pb.z) / 2};
+
+	Collapse c = {.a = a, .b = b, .version_a = s->versions[a], .version_b = s->versions[b]};
+	if (s->seams[a]) {
+		c.target = pa;
+		c.cost = quadric_error(&q, pa);
+	} else if (quadric_optimum(&q, &c.target))
+		c.cost = quadric_error(&q, c.target);
+	else {
+		Vector3 candidates[3] = {pa, pb, mid};
+		c.cost = INFINITY;
+		for (int i = 0; i < 3; i++) {
+			double e = quadric_error(&q, candidates[i]);
+			if (e < c.cost) {
+				c.cost = e;
+				c.target = candidates[i];
+			}
+		}
+	}
+	heap_push(s, c);
+}
 
-            int g = j;
-            if (g == y_num_segms-1)
-                g = 0;
-
-            Vector3 p1 = get_sphere_point((i + 0) * 3.14 / x_num_segms, (g + 0) * 3.14 / y_num_segms, radius);
-            Vector3 p2 = get_sphere_point((i + 1) * 3.14 / x_num_segms, (g + 0) * 3.14 / y_num_segms, radius);
-            Vector3 p3 = get_sphere_point((i + 1) * 3.14 / x_num_segms, (g + 1) * 3.14 / y_num_segms, radius);
-            Vector3 p4 = get_sphere_point((i + 0) * 3.14 / x_num_segms, (g + 1) * 3.14 / y_num_segms, radius);
-
-            Triangle t1 = make_triangle(p1, p2, p3);
-
-            if (fake_normals) {
-                t1.a.nx = p1.x;
-                t1.a.ny = p1.y;
-                t1.a.nz = p1.z;
-
-                t1.b.nx = p2.x;
-                t1.b.ny = p2.y;
-                t1.b.nz = p2.z;
-
-                t1.c.nx = p3.x;
-                t1.c.ny = p3.y;
-                t1.c.nz = p3.z;
-            }
-
-			append_vertex(&vertices, t1.a);
-			append_vertex(&vertices, t1.b);
-			append_vertex(&vertices, t1.c);
-
-            Triangle t2 = make_triangle(p4, p1, p3);
-
-            if (fake_normals) {
-                t2.a.nx = p4.x;
-                t2.a.ny = p4.y;
-                t2.a.nz = p4.z;
-
-                t2.b.nx = p1.x;
-                t2.b.ny = p1.y;
-                t2.b.nz = p1.z;
+typedef struct {
+	uint32_t lo, hi;
+	int triangle;
+} HalfEdge;
 
-                t2.c.nx = p3.x;
-                t2.c.ny = p3.y;
-                t2.c.nz = p3.z;
-            }
+static int compare_half_edges(const void *a, const void *b)
+{
+	const HalfEdge *x = a;
+	const HalfEdge *y = b;
+	if (x->lo != y->lo) return x->lo < y->lo ? -1 : 1;
+	if (x->hi != y->hi) return x->hi < y->hi ? -1 : 1;
+	return 0;
+}
 
-			append_vertex(&vertices, t2.a);
-			append_vertex(&vertices, t2.b);
-			append_vertex(&vertices, t2.c);
-        }
-    return vertices;
+static uint32_t hash_bytes(const void *data, size_t size)
+{
+	uint32_t h = 2166136261u;
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		h ^= bytes[i];
+		h *= 16777619u;
+	}
+	return h;
 }
 
-VertexArray make_sphere_mesh(float radius)
+static Vertex corner_vertex(VertexArray vertices, const uint32_t *indices, int corner)
 {
-	return make_sphere_mesh_2(radius, 32, true);
+	return vertices.data[indices ? indices[corner] : (uint32_t) corner];
 }
 
-VertexArray make_cube_mesh(void)
+// Gives the same ID to the corners that share a position. Returns the
+// number of IDs and stores the position of each in "positions", which
+// must have room for one per corner.
+static int weld_positions(VertexArray vertices, const uint32_t *indices, int num_corners,
+	uint32_t *ids, Vector3 *positions)
 {
-    float vertices[] = {
+	int table_size = 1;
+	while (table_size < 2 * num_corners)
+		table_size *= 2;
+	int *table = checked_alloc(table_size * sizeof(int));
+	for (int i = 0; i < table_size; i++)
+		table[i] = -1;
+
+	int count = 0;
+	for (int i = 0; i < num_corners; i++) {
+		Vertex v = corner_vertex(vertices, indices, i);
+		Vector3 p = {v.x, v.y, v.z};
+
+		uint32_t slot = hash_bytes(&p, sizeof(p)) & (table_size - 1);
+		while (table[slot] >= 0) {
+			Vector3 q = positions[table[slot]];
+			if (q.x == p.x && q.y == p.y && q.z == p.z)
+				break;
+			slot = (slot + 1) & (table_size - 1);
+		}
+		if (table[slot] < 0) {
+			table[slot] = count++;
+			positions[table[slot]] = p;
+		}
+		ids[i] = table[slot];
+	}
 
-        1.0, 1.0, 0.0,   0.0, 0.0, -1.0,
-        1.0, 0.0, 0.0,   0.0, 0.0, -1.0,
-        0.0, 0.0, 0.0,   0.0, 0.0, -1.0,
-        0.0, 1.0, 0.0,   0.0, 0.0, -1.0,
-        1.0, 1.0, 0.0,   0.0, 0.0, -1.0,
-        0.0, 0.0, 0.0,   0.0, 0.0, -1.0,
+	free(table);
+	return count;
+}
 
-        0.0, 0.0, 1.0,   0.0, 0.0, 1.0,
-        1.0, 0.0, 1.0,   0.0, 0.0, 1.0,
-        1.0, 1.0, 1.0,   0.0, 0.0, 1.0,
-        0.0, 0.0, 1.0,   0.0, 0.0, 1.0,
-        1.0, 1.0, 1.0,   0.0, 0.0, 1.0,
-        0.0, 1.0, 1.0,   0.0, 0.0, 1.0,
+// Same as weld_positions, but only for corners with all of the same
+// attributes
+static int weld_wedges(VertexArray vertices, const uint32_t *indices, int num_corners,
+	uint32_t *ids, Vertex *wedges)
+{
+	int table_size = 1;
+	while (table_size < 2 * num_corners)
+		table_size *= 2;
+	int *table = checked_alloc(table_size * sizeof(int));
+	for (int i = 0; i < table_size; i++)
+		table[i] = -1;
+
+	int count = 0;
+	for (int i = 0; i < num_corners; i++) {
+		Vertex v = corner_vertex(vertices, indices, i);
+
+		uint32_t slot = hash_bytes(&v, sizeof(v)) & (table_size - 1);
+		while (table[slot] >= 0 && memcmp(&wedges[table[slot]], &v, sizeof(v)))
+			slot = (slot + 1) & (table_size - 1);
+		if (table[slot] < 0) {
+			table[slot] = count++;
+			wedges[table[slot]] = v;
+		}
+		ids[i] = table[slot];
+	}
 
-        0.0, 0.0, 0.0,   0.0, -1.0, 0.0,
-        1.0, 0.0, 0.0,   0.0, -1.0, 0.0,
-        1.0, 0.0, 1.0,   0.0, -1.0, 0.0,
-        0.0, 0.0, 0.0,   0.0, -1.0, 0.0,
-        1.0, 0.0, 1.0,   0.0, -1.0, 0.0,
-        0.0, 0.0, 1.0,   0.0, -1.0, 0.0,
+	free(table);
+	return count;
+}
 
-        1.0, 1.0, 1.0,   0.0, 1.0, 0.0,
-        1.0, 1.0, 0.0,   0.0, 1.0, 0.0,
-        0.0, 1.0, 0.0,   0.0, 1.0, 0.0,
-        0.0, 1.0, 1.0,   0.0, 1.0, 0.0,
-        1.0, 1.0, 1.0,   0.0, 1.0, 0.0,
-        0.0, 1.0, 0.0,   0.0, 1.0, 0.0,
+// Merges the corners of the triangles that share a position, keeping
+// their attributes as wedges, and finds the seams
+static void weld_vertices(Simplifier *s, VertexArray vertices, const uint32_t *indices, int num_indices)
+{
+	int num_corners = indices ? num_indices : vertices.size;
+
+	s->positions = checked_alloc(num_corners * sizeof(Vector3));
+	s->wedges    = checked_alloc(num_corners * sizeof(Vertex));
+	s->num_triangles = num_corners / 3;
+	s->triangles = checked_alloc(s->num_triangles * sizeof(*s->triangles));
+	s->corners   = checked_alloc(s->num_triangles * sizeof(*s->corners));
+
+	uint32_t *ids = checked_alloc(num_corners * sizeof(uint32_t));
+	s->num_vertices = weld_positions(vertices, indices, 3 * s->num_triangles, ids, s->positions);
+	for (int i = 0; i < 3 * s->num_triangles; i++)
+		s->triangles[i / 3][i % 3] = ids[i];
+
+	weld_wedges(vertices, indices, 3 * s->num_triangles, ids, s->wedges);
+	for (int i = 0; i < 3 * s->num_triangles; i++)
+		s->corners[i / 3][i % 3] = ids[i];
+	free(ids);
+
+	// A position is on a seam if its corners don't all have the texture
+	// coordinates of the first one
+	int *first = checked_alloc(s->num_vertices * sizeof(int));
+	for (int i = 0; i < s->num_vertices; i++)
+		first[i] = -1;
+	s->seams = checked_alloc(s->num_vertices * sizeof(bool));
+	for (int i = 0; i < 3 * s->num_triangles; i++) {
+		uint32_t p = s->triangles[i / 3][i % 3];
+		Vertex v = s->wedges[s->corners[i / 3][i % 3]];
+		if (first[p] < 0)
+			first[p] = s->corners[i / 3][i % 3];
+		else if (v.tx != s->wedges[first[p]].tx || v.ty != s->wedges[first[p]].ty)
+			s->seams[p] = true;
+	}
+	free(first);
+}
 
-        0.0, 1.0, 1.0,  -1.0, 0.0, 0.0,
-        0.0, 1.0, 0.0,  -1.0, 0.0, 0.0,
-        0.0, 0.0, 0.0,  -1.0, 0.0, 0.0,
+static void init_simplifier(Simplifier *s, VertexArray vertices, const uint32_t *indices, int num_indices)
+{
+	*s = (Simplifier) {0};
+	weld_vertices(s, vertices, indices, num_indices);
+
+	int nv = s->num_vertices;
+	int nt = s->num_triangles;
+	s->quadrics     = checked_alloc(nv * sizeof(Quadric));
+	s->versions     = checked_alloc(nv * sizeof(uint32_t));
+	s->removed      = checked_alloc(nv * sizeof(bool));
+	s->triangles_of = checked_alloc(nv * sizeof(IntList));
+	s->dead         = checked_alloc(nt * sizeof(bool));
+	s->live_triangles = nt;
+
+	HalfEdge *edges = checked_alloc(3 * nt * sizeof(HalfEdge));
+
+	for (int t = 0; t < nt; t++) {
+
+		uint32_t *tri = s->triangles[t];
+		Vector3 p0 = s->positions[tri[0]];
+		Vector3 p1 = s->positions[tri[1]];
+		Vector3 p2 = s->positions[tri[2]];
+
+		if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+			s->dead[t] = true;
+			s->live_triangles--;
+			continue;
+		}
 
-        0.0, 0.0, 1.0,  -1.0, 0.0, 0.0,
-        0.0, 1.0, 1.0,  -1.0, 0.0, 0.0,
-        0.0, 0.0, 0.0,  -1.0, 0.0, 0.0,
+		Vector3 n = triangle_normal(p0, p1, p2);
+		double len = sqrt(dot3(n, n));
+		if (len > 0) {
+			double nx = n.x / len, ny = n.y / len, nz = n.z / len;
+			double d = -(nx * p0.x + ny * p0.y + nz * p0.z);
+			Quadric q = plane_quadric(nx, ny, nz, d, len / 2);
+			for (int k = 0; k < 3; k++)
+				add_quadric(&s->quadrics[tri[k]], q);
+		}
+
+		for (int k = 0; k < 3; k++) {
+			push_int(&s->triangles_of[tri[k]], t);
+			uint32_t a = tri[k];
+			uint32_t b = tri[(k+1) % 3];
+			edges[3*t+k] = (HalfEdge) {a < b ? a : b, a < b ? b : a, t};
+		}
+	}
 
-        1.0, 0.0, 0.0,  1.0, 0.0, 0.0,
-        1.0, 1.0, 0.0,  1.0, 0.0, 0.0,
-        1.0, 1.0, 1.0,  1.0, 0.0, 0.0,
-        1.0, 0.0, 0.0,  1.0, 0.0, 0.0,
-        1.0, 1.0, 1.0,  1.0, 0.0, 0.0,
-        1.0, 0.0, 1.0,  1.0, 0.0, 0.0,
-    };
+	// Dead triangles left their slots zeroed, skip them
+	int num_edges = 0;
+	for (int t = 0; t < nt; t++)
+		if (!s->dead[t])
+			for (int k = 0; k < 3; k++)
+				edges[num_edges++] = edges[3*t+k];
+
+	qsort(edges, num_edges, sizeof(HalfEdge), compare_half_edges);
+
+	for (int i = 0; i < num_edges; ) {
+		int j = i + 1;
+		while (j < num_edges && edges[j].lo == edges[i].lo && edges[j].hi == edges[i].hi)
+			j++;
+
+		uint32_t a = edges[i].lo;
+		uint32_t b = edges[i].hi;
+
+		if (j - i == 1) {
+			// Border edge, add a plane through it perpendicular to its triangle
+			uint32_t *tri = s->triangles[edges[i].triangle];
+			Vector3 n = triangle_normal(s->positions[tri[0]], s->positions[tri[1]], s->positions[tri[2]]);
+			Vector3 dir = sub3(s->positions[b], s->positions[a]);
+			Vector3 side = cross(dir, n);
+			double len = sqrt(dot3(side, side));
+			if (len > 0) {
+				double nx = side.x / len, ny = side.y / len, nz = side.z / len;
+				Vector3 p = s->positions[a];
+				double d = -(nx * p.x + ny * p.y + nz * p.z);
+				Quadric q = plane_quadric(nx, ny, nz, d, BORDER_WEIGHT * dot3(dir, dir));
+				add_quadric(&s->quadrics[a], q);
+				add_quadric(&s->quadrics[b], q);
+			}
+		}
 
-   VertexArray result = {0, 0, 0}; 
-   for (int i = 0; i < (int) (sizeof(vertices)/sizeof(vertices[0])); i += 6) {
-        Vertex v;
-        v.x = vertices[i + 0];
-        v.y = vertices[i + 1];
-        v.z = vertices[i + 2];
-        v.nx = vertices[i + 3];
-        v.ny = vertices[i + 4];
-        v.nz = vertices[i + 5];
-        v.tx = 0;
-        v.ty = 0;
-		append_vertex(&result, v);
-   }
+		i = j;
+	}
 
-   return result;
+	for (int i = 0; i < num_edges; ) {
+		int j = i + 1;
+		while (j < num_edges && edges[j].lo == edges[i].lo && edges[j].hi == edges[i].hi)
+			j++;
+		push_collapse(s, edges[i].lo, edges[i].hi);
+		i = j;
+	}
+
+	free(edges);
 }
 
-static void
-get_file_data_callback(void *context, const char *filename, 
-	const int is_mtl, const char *obj_filename, char **data, size_t *len)
+static void free_simplifier(Simplifier *s)
 {
-	(void) context;
+	for (int i = 0; i < s->num_vertices; i++)
+		free(s->triangles_of[i].items);
+	free(s->triangles_of);
+	free(s->positions);
+	free(s->seams);
+	free(s->wedges);
+	free(s->corners);
+	free(s->quadrics);
+	free(s->versions);
+	free(s->removed);
+	free(s->triangles);
+	free(s->dead);
+	free(s->heap);
+}
 
-	if (filename == NULL) {
-		fprintf(stderr, "null filename\n");
-		(*data) = NULL;
-		(*len) = 0;
-		return;
+// Checks that moving the triangles around the edge to "p" doesn't turn
+// any of them over
+static bool collapse_keeps_orientation(Simplifier *s, uint32_t a, uint32_t b, Vector3 p)
+{
+	uint32_t ends[2] = {a, b};
+	for (int e = 0; e < 2; e++) {
+		IntList *list = &s->triangles_of[ends[e]];
+		for (int i = 0; i < list->count; i++) {
+
+			int t = list->items[i];
+			if (s->dead[t])
+				continue;
+
+			uint32_t *tri = s->triangles[t];
+			bool has_a = tri[0] == a || tri[1] == a || tri[2] == a;
+			bool has_b = tri[0] == b || tri[1] == b || tri[2] == b;
+			if (has_a && has_b)
+				continue; // Removed by the collapse
+
+			Vector3 before[3], after[3];
+			for (int k = 0; k < 3; k++) {
+				before[k] = s->positions[tri[k]];
+				after[k]  = tri[k] == ends[e] ? p : before[k];
+			}
+			Vector3 n0 = triangle_normal(before[0], before[1], before[2]);
+			Vector3 n1 = triangle_normal(after[0], after[1], after[2]);
+			if (dot3(n0, n1) <= 0.25f * sqrtf(dot3(n0, n0) * dot3(n1, n1)))
+				return false;
+		}
 	}
+	return true;
+}
 
-	size_t data_len = 0;
+// Stores the wedges of "b" and "a" in the live triangles around the
+// edge between them. Returns how many triangles there are.
+static int get_edge_wedges(Simplifier *s, uint32_t a, uint32_t b, uint32_t (*pairs)[2])
+{
+	IntList *list = &s->triangles_of[b];
+	int num_pairs = 0;
+	for (int i = 0; i < list->count && num_pairs < MAX_EDGE_TRIANGLES; i++) {
+		int t = list->items[i];
+		if (s->dead[t])
+			continue;
+		uint32_t *tri = s->triangles[t];
+		int ka = tri[0] == a ? 0 : tri[1] == a ? 1 : tri[2] == a ? 2 : -1;
+		int kb = tri[0] == b ? 0 : tri[1] == b ? 1 : 2;
+		if (ka >= 0) {
+			pairs[num_pairs][0] = s->corners[t][kb];
+			pairs[num_pairs][1] = s->corners[t][ka];
+			num_pairs++;
+		}
+	}
+	return num_pairs;
+}
 
-	printf("Reading file '%s'\n", filename);
-	*data = load_file(filename, &data_len);
-	(*len) = data_len;
+// Where a seam ends at "a", a wedge of "b" may border both of its sides,
+// and there'd be no telling which one its triangles should take
+static bool collapse_keeps_seams(Simplifier *s, uint32_t a, uint32_t b)
+{
+	uint32_t pairs[MAX_EDGE_TRIANGLES][2];
+	int num_pairs = get_edge_wedges(s, a, b, pairs);
+	for (int i = 0; i < num_pairs; i++)
+		for (int j = i + 1; j < num_pairs; j++) {
+			Vertex u = s->wedges[pairs[i][1]];
+			Vertex v = s->wedges[pairs[j][1]];
+			if (pairs[i][0] == pairs[j][0] && (u.tx != v.tx || u.ty != v.ty))
+				return false;
+		}
+	return true;
+}
 
-	char **free_me = context;
-	if (*free_me == NULL) *free_me = *data;
+// Wedge of "a" for a corner of "b" with wedge "w", given the pairs of
+// wedges of "b" and "a" across the collapsed triangles. Prefers a pair
+// of the same wedge, then the closest normal.
+static uint32_t remap_wedge(Simplifier *s, uint32_t (*pairs)[2], int num_pairs, uint32_t w)
+{
+	Vertex v = s->wedges[w];
+	uint32_t best = w;
+	float best_score = -INFINITY;
+	for (int i = 0; i < num_pairs; i++) {
+		Vertex u = s->wedges[pairs[i][1]];
+		float score = v.nx * u.nx + v.ny * u.ny + v.nz * u.nz;
+		if (pairs[i][0] == w)
+			score += 4; // More than any difference of unit normals
+		if (score > best_score) {
+			best_score = score;
+			best = pairs[i][1];
+		}
+	}
+	return best;
+}
+
+static void apply_collapse(Simplifier *s, uint32_t a, uint32_t b, Vector3 p)
+{
+	s->positions[a] = p;
+	add_quadric(&s->quadrics[a], s->quadrics[b]);
+	s->versions[a]++;
+	s->removed[b] = true;
+
+	IntList *from = &s->triangles_of[b];
+
+	uint32_t pairs[MAX_EDGE_TRIANGLES][2];
+	int num_pairs = get_edge_wedges(s, a, b, pairs);
+
+	for (int i = 0; i < from->count; i++) {
+		int t = from->items[i];
+		if (s->dead[t])
+			continue;
+		uint32_t *tri = s->triangles[t];
+		if (tri[0] == a || tri[1] == a || tri[2] == a) {
+			s->dead[t] = true;
+			s->live_triangles--;
+			continue;
+		}
+		for (int k = 0; k < 3; k++)
+			if (tri[k] == b) {
+				tri[k] = a;
+				s->corners[t][k] = remap_wedge(s, pairs, num_pairs, s->corners[t][k]);
+			}
+		push_int(&s->triangles_of[a], t);
+	}
+	free(from->items);
+	*from = (IntList) {0};
+
+	// Drop the dead triangles and queue the new edges
+	IntList *list = &s->triangles_of[a];
+	int kept = 0;
+	for (int i = 0; i < list->count; i++) {
+		int t = list->items[i];
+		if (s->dead[t])
+			continue;
+		list->items[kept++] = t;
+		uint32_t *tri = s->triangles[t];
+		// Edges inside the mesh get queued twice, but the second copy
+		// is dropped since "a" moves when the first one is applied
+		for (int k = 0; k < 3; k++)
+			if (tri[k] == a) {
+				push_collapse(s, a, tri[(k+1) % 3]);
+				push_collapse(s, a, tri[(k+2) % 3]);
+			}
+	}
+	list->count = kept;
+}
+
+// Writes the live triangles as a list of vertices
+static VertexArray extract_mesh(Simplifier *s)
+{
+	VertexArray result = {0, 0, 0};
+	result.capacity = 3 * s->live_triangles + 1;
+	result.data = checked_alloc(result.capacity * sizeof(Vertex));
+
+	for (int t = 0; t < s->num_triangles; t++) {
+
+		if (s->dead[t])
+			continue;
+
+		for (int k = 0; k < 3; k++) {
+			Vertex v = s->wedges[s->corners[t][k]];
+			Vector3 p = s->positions[s->triangles[t][k]];
+			v.x = p.x;
+			v.y = p.y;
+			v.z = p.z;
+			result.data[result.size++] = v;
+		}
+	}
+
+	return result;
 }
 
-bool load_mesh_from_file(const char *file, VertexArray *result)
+int build_mesh_lods(VertexArray vertices, const uint32_t *indices, int num_indices, MeshLOD *lods)
 {
+	lods[0] = (MeshLOD) {.vertices = vertices};
 
-	tinyobj_attrib_t attrib;
+	int num_triangles = (indices ? num_indices : vertices.size) / 3;
+	if (num_triangles / 2 < MIN_LOD_TRIANGLES)
+		return 1;
 
-	tinyobj_shape_t* shapes = NULL;
-	size_t num_shapes;
+	Simplifier s;
+	init_simplifier(&s, vertices, indices, num_indices);
 
-	tinyobj_material_t* materials = NULL;
-	size_t num_materials;
+	int num_lods = 1;
+	int target = num_triangles / 2;
+	float error = 0;
 
-	char *free_me = NULL;
+	while (num_lods < MAX_MESH_LODS && target >= MIN_LOD_TRIANGLES) {
 
-	unsigned int flags = TINYOBJ_FLAG_TRIANGULATE;
-	int ret = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials, &num_materials, file, get_file_data_callback, &free_me, flags);
-	if (ret != TINYOBJ_SUCCESS) {
-		if (free_me) free(free_me);
-		printf("Failed loading '%s'\n", file);
-		return false;
+		while (s.live_triangles > target && s.heap_count > 0) {
+
+			Collapse c = heap_pop(&s);
+			if (s.removed[c.a] || s.removed[c.b])
+				continue;
+			if (s.versions[c.a] != c.version_a || s.versions[c.b] != c.version_b)
+				continue; // One of the ends moved since this was queued
+			if (!collapse_keeps_orientation(&s, c.a, c.b, c.target))
+				continue;
+			if (!collapse_keeps_seams(&s, c.a, c.b))
+				continue;
+
+			// Roughly the distance of the new vertex from the surface
+			// its planes came from
+			Quadric q = s.quadrics[c.a];
+			add_quadric(&q, s.quadrics[c.b]);
+			if (q.area > 0)
+				error = fmaxf(error, sqrt(c.cost / q.area));
+
+			apply_collapse(&s, c.a, c.b, c.target);
+		}
+
+		// Stuck, the rest of the collapses would fold triangles over
+		if (s.live_triangles > target + target / 2)
+			break;
+
+		lods[num_lods++] = (MeshLOD) {.vertices = extract_mesh(&s), .error = error};
+		target /= 2;
 	}
 
-	*result = (VertexArray) {0, 0, 0};
+	free_simplifier(&s);
+	return num_lods;
+}
 
-	size_t face_offset = 0;
-	for (int i = 0; i < (int) attrib.num_face_num_verts; i++) {
+void free_mesh_lods(MeshLOD *lods, int num_lods)
+{
+	for (int i = 0; i < num_lods; i++) {
+		if (i > 0)
+			free(lods[i].vertices.data);
+		free(lods[i].meshlets);
+	}
+}
 
-		assert(attrib.face_num_verts[i] % 3 == 0); /* assume all triangle faces. */
-		for (size_t f = 0; f < (size_t)attrib.face_num_verts[i] / 3; f++) {
+/*
+ * Meshlets
+ *
+ * Each cluster grows from the first triangle that wasn't taken yet,
+ * adding one at a time the neighbor that best matches the average
+ * normal of the cluster and is closest to its center. Keeping the
+ * normals close is what lets the normal cones cull anything. The
+ * triangles are then reordered so that each cluster is a range.
+ *
+ * The renderer doesn't cull back faces, so open and two-sided meshes
+ * show them. Only closed meshes, whose back faces are always behind
+ * front ones, get normal cones.
+ */
+
+// Clusters of MESHLET_MIN_TRIANGLES or more stop growing early if the
+// best neighbor turns more than this (as a cosine) from their average
+// normal
+#define MESHLET_CREASE_COS    0.5f
+
+// Cones wider than this (as the cosine of their half angle) can only
+// be seen from the back from too few places to be worth testing
+#define MESHLET_MIN_CONE_COS  0.1f
 
-			tinyobj_vertex_index_t idx0 = attrib.faces[face_offset + f * 3 + 0];
-			tinyobj_vertex_index_t idx1 = attrib.faces[face_offset + f * 3 + 1];
-			tinyobj_vertex_index_t idx2 = attrib.faces[face_offset + f * 3 + 2];
+typedef struct {
+	int        num_triangles;
+	int        num_positions;
+	uint32_t (*triangles)[3]; // Welded positions
+	Vector3   *positions;
+	Vector3   *normals;   // Facing like the vertex normals
+	Vector3   *centroids;
+	int       *first_adjacent; // Triangles around each position
+	int       *adjacent;
+} ClusterMesh;
+
+static void init_cluster_mesh(ClusterMesh *m, VertexArray vertices, const uint32_t *indices, int num_indices)
+{
+	int num_corners = indices ? num_indices : vertices.size;
+	int nt = num_corners / 3;
+	m->num_triangles = nt;
+
+	uint32_t *ids = checked_alloc(num_corners * sizeof(uint32_t));
+	m->positions = checked_alloc(num_corners * sizeof(Vector3));
+	m->num_positions = weld_positions(vertices, indices, 3 * nt, ids, m->positions);
+
+	m->triangles = checked_alloc(nt * sizeof(*m->triangles));
+	m->normals   = checked_alloc(nt * sizeof(Vector3));
+	m->centroids = checked_alloc(nt * sizeof(Vector3));
+	for (int t = 0; t < nt; t++) {
+
+		Vector3 shading = {0, 0, 0};
+		for (int k = 0; k < 3; k++) {
+			m->triangles[t][k] = ids[3 * t + k];
+			Vertex v = corner_vertex(vertices, indices, 3 * t + k);
+			shading = combine(shading, (Vector3) {v.nx, v.ny, v.nz}, 1, 1);
+		}
 
-			Vertex v0;
-			Vertex v1;
-			Vertex v2;
+		Vector3 a = m->positions[m->triangles[t][0]];
+		Vector3 b = m->positions[m->triangles[t][1]];
+		Vector3 c = m->positions[m->triangles[t][2]];
+		Vector3 n = triangle_normal(a, b, c);
+		float len = sqrtf(dot3(n, n));
+		if (len > 0)
+			n = scale(n, (dot3(n, shading) < 0 ? -1 : 1) / len);
 
-			/*
-			 * Positions
-			 */
+		m->normals[t] = n;
+		m->centroids[t] = (Vector3) {(a.x + b.x + c.x) / 3, (a.y + b.y + c.y) / 3, (a.z + b.z + c.z) / 3};
+	}
+	free(ids);
+
+	m->first_adjacent = checked_alloc((m->num_positions + 1) * sizeof(int));
+	m->adjacent = checked_alloc(3 * nt * sizeof(int));
+	for (int t = 0; t < nt; t++)
+		for (int k = 0; k < 3; k++)
+			m->first_adjacent[m->triangles[t][k] + 1]++;
+	for (int i = 0; i < m->num_positions; i++)
+		m->first_adjacent[i+1] += m->first_adjacent[i];
+
+	int *fill = checked_alloc(m->num_positions * sizeof(int));
+	for (int t = 0; t < nt; t++)
+		for (int k = 0; k < 3; k++) {
+			uint32_t p = m->triangles[t][k];
+			m->adjacent[m->first_adjacent[p] + fill[p]++] = t;
+		}
+	free(fill);
+}
 
-			v0.x = attrib.vertices[idx0.v_idx * 3 + 0];
-			v0.y = attrib.vertices[idx0.v_idx * 3 + 1];
-			v0.z = attrib.vertices[idx0.v_idx * 3 + 2];
+// Whether every edge is shared by exactly two triangles. Triangles
+// with repeated positions have no area and are left out.
+static bool is_closed_mesh(ClusterMesh *m)
+{
+	HalfEdge *edges = checked_alloc(3 * m->num_triangles * sizeof(HalfEdge));
+	int num_edges = 0;
+	for (int t = 0; t < m->num_triangles; t++) {
+		uint32_t *tri = m->triangles[t];
+		if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2])
+			continue;
+		for (int k = 0; k < 3; k++) {
+			uint32_t a = tri[k];
+			uint32_t b = tri[(k+1) % 3];
+			edges[num_edges++] = (HalfEdge) {a < b ? a : b, a < b ? b : a, t};
+		}
+	}
 
-			v1.x = attrib.vertices[idx1.v_idx * 3 + 0];
-			v1.y = attrib.vertices[idx1.v_idx * 3 + 1];
-			v1.z = attrib.vertices[idx1.v_idx * 3 + 2];
+	qsort(edges, num_edges, sizeof(HalfEdge), compare_half_edges);
 
-			v2.x = attrib.vertices[idx2.v_idx * 3 + 0];
-			v2.y = attrib.vertices[idx2.v_idx * 3 + 1];
-			v2.z = attrib.vertices[idx2.v_idx * 3 + 2];
+	bool closed = true;
+	for (int i = 0; i < num_edges && closed; ) {
+		int j = i + 1;
+		while (j < num_edges && edges[j].lo == edges[i].lo && edges[j].hi == edges[i].hi)
+			j++;
+		closed = j - i == 2;
+		i = j;
+	}
 
-			/*
-			 * Normals
-			 */
+	free(edges);
+	return closed;
+}
 
-			v0.nx = attrib.normals[idx0.vn_idx * 3 + 0];
-			v0.ny = attrib.normals[idx0.vn_idx * 3 + 1];
-			v0.nz = attrib.normals[idx0.vn_idx * 3 + 2];
+static void free_cluster_mesh(ClusterMesh *m)
+{
+	free(m->triangles);
+	free(m->positions);
+	free(m->normals);
+	free(m->centroids);
+	free(m->first_adjacent);
+	free(m->adjacent);
+}
 
-			v1.nx = attrib.normals[idx1.vn_idx * 3 + 0];
-			v1.ny = attrib.normals[idx1.vn_idx * 3 + 1];
-			v1.nz = attrib.normals[idx1.vn_idx * 3 + 2];
+// Fills in the bounds of a cluster made of the triangles "order[first]"
+// to "order[first+count-1]", and its normal cone if "cone" is set
+static Meshlet bound_meshlet(ClusterMesh *m, const int *order, int first, int count, bool cone)
+{
+	Meshlet meshlet = {.first_triangle = first, .num_triangles = count};
+
+	Vector3 lo = m->positions[m->triangles[order[first]][0]];
+	Vector3 hi = lo;
+	Vector3 axis = {0, 0, 0};
+	for (int i = first; i < first + count; i++) {
+		int t = order[i];
+		for (int k = 0; k < 3; k++) {
+			Vector3 p = m->positions[m->triangles[t][k]];
+			lo = (Vector3) {fminf(lo.x, p.x), fminf(lo.y, p.y), fminf(lo.z, p.z)};
+			hi = (Vector3) {fmaxf(hi.x, p.x), fmaxf(hi.y, p.y), fmaxf(hi.z, p.z)};
+		}
+		axis = combine(axis, m->normals[t], 1, 1);
+	}
 
-			v2.nx = attrib.normals[idx2.vn_idx * 3 + 0];
-			v2.ny = attrib.normals[idx2.vn_idx * 3 + 1];
-			v2.nz = attrib.normals[idx2.vn_idx * 3 + 2];
+	Vector3 center = {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2};
+	float radius = 0;
+	for (int i = first; i < first + count; i++)
+		for (int k = 0; k < 3; k++) {
+			Vector3 d = combine(m->positions[m->triangles[order[i]][k]], center, 1, -1);
+			radius = fmaxf(radius, sqrtf(dot3(d, d)));
+		}
+	meshlet.center = center;
+	meshlet.radius = radius;
+
+	// Never culled unless the normals fit in a narrow enough cone
+	meshlet.cone_cutoff = 2;
+	if (!cone || dot3(axis, axis) == 0)
+		return meshlet;
+	axis = normalize(axis);
+
+	float min_dot = 1;
+	for (int i = first; i < first + count; i++) {
+		Vector3 n = m->normals[order[i]];
+		if (dot3(n, n) > 0)
+			min_dot = fminf(min_dot, dot3(n, axis));
+	}
+	if (min_dot <= MESHLET_MIN_CONE_COS)
+		return meshlet;
+
+	// Move the apex back along the axis until it's behind the plane of
+	// every triangle, so that the cone holds the points that see all
+	// of them from the back
+	float max_t = 0;
+	for (int i = first; i < first + count; i++) {
+		int t = order[i];
+		Vector3 n = m->normals[t];
+		float dn = dot3(n, axis);
+		if (dn <= 0)
+			continue;
+		Vector3 p = m->positions[m->triangles[t][0]];
+		max_t = fmaxf(max_t, dot3(combine(center, p, 1, -1), n) / dn);
+	}
 
-			/*
-			 * Texture coordinates
-			 */
+	meshlet.cone_apex   = combine(center, axis, 1, -max_t);
+	meshlet.cone_axis   = axis;
+	meshlet.cone_cutoff = sqrtf(1 - min_dot * min_dot);
+	return meshlet;
+}
 
-			v0.tx = attrib.normals[idx0.vt_idx * 2 + 0];
-			v0.ty = attrib.normals[idx0.vt_idx * 2 + 1];
+// Moves the triangles of cluster "donor" that touch the cluster "id",
+// whose "count" triangles are in "members", into it, those closest to
+// its normals first, until it has MESHLET_MIN_TRIANGLES. Returns how
+// many it ends up with.
+static int take_triangles(ClusterMesh *m, int *cluster, int *sizes, Vector3 *normal_sums,
+	int donor, int id, int *members, int count, Vector3 *normal_sum)
+{
+	while (count < MESHLET_MIN_TRIANGLES) {
+
+		Vector3 axis = dot3(*normal_sum, *normal_sum) > 0 ? normalize(*normal_sum) : *normal_sum;
+		int best = -1;
+		float best_dot = -INFINITY;
+		for (int j = 0; j < count; j++)
+			for (int k = 0; k < 3; k++) {
+				uint32_t p = m->triangles[members[j]][k];
+				for (int i = m->first_adjacent[p]; i < m->first_adjacent[p+1]; i++) {
+					int t = m->adjacent[i];
+					float d = dot3(m->normals[t], axis);
+					if (cluster[t] == donor && d > best_dot) {
+						best_dot = d;
+						best = t;
+					}
+				}
+			}
+		if (best < 0)
+			break;
+
+		cluster[best] = id;
+		members[count++] = best;
+		*normal_sum = combine(*normal_sum, m->normals[best], 1, 1);
+		sizes[donor]--;
+		normal_sums[donor] = combine(normal_sums[donor], m->normals[best], 1, -1);
+	}
+	return count;
+}
 
-			v1.tx = attrib.normals[idx1.vt_idx * 2 + 0];
-			v1.ty = attrib.normals[idx1.vt_idx * 2 + 1];
+int build_meshlets(VertexArray vertices, uint32_t *indices, int num_indices, Meshlet **meshlets)
+{
+	*meshlets = NULL;
+
+	int num_triangles = (indices ? num_indices : vertices.size) / 3;
+	if (num_triangles <= MESHLET_MAX_TRIANGLES)
+		return 0;
+
+	ClusterMesh m;
+	init_cluster_mesh(&m, vertices, indices, num_indices);
+	bool closed = is_closed_mesh(&m);
+
+	// Roughly how far the triangles of a full cluster are from its
+	// center, to weigh distance against normals
+	double area = 0;
+	for (int t = 0; t < num_triangles; t++) {
+		Vector3 *p = m.positions;
+		uint32_t *tri = m.triangles[t];
+		Vector3 n = triangle_normal(p[tri[0]], p[tri[1]], p[tri[2]]);
+		area += sqrt(dot3(n, n)) / 2;
+	}
+	float spread = sqrt(area / num_triangles * MESHLET_MAX_TRIANGLES);
+	if (spread == 0)
+		spread = 1;
+
+	int *order    = checked_alloc(num_triangles * sizeof(int)); // In the order they were added
+	int *cluster  = checked_alloc(num_triangles * sizeof(int)); // Of each triangle, or -1
+	int *queued   = checked_alloc(num_triangles * sizeof(int)); // Last growth whose frontier had it
+	int *frontier = checked_alloc(num_triangles * sizeof(int));
+	for (int t = 0; t < num_triangles; t++) {
+		cluster[t] = -1;
+		queued[t]  = -1;
+	}
 
-			v2.tx = attrib.normals[idx2.vt_idx * 2 + 0];
-			v2.ty = attrib.normals[idx2.vt_idx * 2 + 1];
+	// Of each cluster
+	int     *sizes       = checked_alloc(num_triangles * sizeof(int));
+	Vector3 *normal_sums = checked_alloc(num_triangles * sizeof(Vector3));
+	int num_clusters = 0;
+
+	int placed = 0;
+	int seed = 0;
+	for (int growth = 0; placed < num_triangles; growth++) {
+
+		while (cluster[seed] >= 0)
+			seed++;
+
+		int id = num_clusters;
+		int first = placed;
+		int frontier_count = 0;
+		Vector3 normal_sum = {0, 0, 0};
+		Vector3 centroid_sum = {0, 0, 0};
+
+		int next = seed;
+		while (next >= 0) {
+
+			cluster[next] = id;
+			order[placed++] = next;
+			normal_sum = combine(normal_sum, m.normals[next], 1, 1);
+			centroid_sum = combine(centroid_sum, m.centroids[next], 1, 1);
+
+			for (int k = 0; k < 3; k++) {
+				uint32_t p = m.triangles[next][k];
+				for (int i = m.first_adjacent[p]; i < m.first_adjacent[p+1]; i++) {
+					int t = m.adjacent[i];
+					if (cluster[t] < 0 && queued[t] != growth) {
+						queued[t] = growth;
+						frontier[frontier_count++] = t;
+					}
+				}
+			}
+
+			int count = placed - first;
+			if (count == MESHLET_MAX_TRIANGLES)
+				break;
+
+			Vector3 axis = dot3(normal_sum, normal_sum) > 0 ? normalize(normal_sum) : normal_sum;
+			Vector3 center = scale(centroid_sum, 1.0f / count);
+
+			next = -1;
+			float best_score = -INFINITY;
+			float best_dot = 0;
+			int i = 0;
+			while (i < frontier_count) {
+				int t = frontier[i];
+				if (cluster[t] >= 0) {
+					frontier[i] = frontier[--frontier_count];
+					continue;
+				}
+				float d = dot3(m.normals[t], axis);
+				Vector3 offset = combine(m.centroids[t], center, 1, -1);
+				float score = d - sqrtf(dot3(offset, offset)) / spread;
+				if (score > best_score) {
+					best_score = score;
+					best_dot = d;
+					next = t;
+				}
+				i++;
+			}
+
+			if (next >= 0 && count >= MESHLET_MIN_TRIANGLES && best_dot < MESHLET_CREASE_COS)
+				next = -1;
+		}
 
-			append_vertex(result, v0);
-			append_vertex(result, v1);
-			append_vertex(result, v2);
+		// Clusters only end this small when the clusters around them
+		// took all of their neighbors. They join the one with room
+		// whose normals are the closest, or else take triangles from
+		// it. Small separate parts of the mesh stay on their own.
+		int count = placed - first;
+		int target = -1;
+		int donor  = -1;
+		if (count < MESHLET_MIN_TRIANGLES) {
+			Vector3 axis = dot3(normal_sum, normal_sum) > 0 ? normalize(normal_sum) : normal_sum;
+			float target_dot = -INFINITY;
+			float donor_dot  = -INFINITY;
+			for (int j = first; j < placed; j++)
+				for (int k = 0; k < 3; k++) {
+					uint32_t p = m.triangles[order[j]][k];
+					for (int i = m.first_adjacent[p]; i < m.first_adjacent[p+1]; i++) {
+						int c = cluster[m.adjacent[i]];
+						if (c < 0 || c == id)
+							continue;
+						Vector3 n = normal_sums[c];
+						float d = dot3(n, n) > 0 ? dot3(normalize(n), axis) : -1;
+						if (sizes[c] + count <= MESHLET_MAX_TRIANGLES) {
+							if (d > target_dot) {
+								target_dot = d;
+								target = c;
+							}
+						} else if (sizes[c] + count >= 2 * MESHLET_MIN_TRIANGLES && d > donor_dot) {
+							donor_dot = d;
+							donor = c;
+						}
+					}
+				}
 		}
 
-		face_offset += (size_t)attrib.face_num_verts[i];
+		if (target >= 0) {
+			for (int j = first; j < placed; j++)
+				cluster[order[j]] = target;
+			sizes[target] += count;
+			normal_sums[target] = combine(normal_sums[target], normal_sum, 1, 1);
+		} else {
+			if (donor >= 0) {
+				int members[MESHLET_MIN_TRIANGLES];
+				memcpy(members, &order[first], count * sizeof(int));
+				count = take_triangles(&m, cluster, sizes, normal_sums, donor, id, members, count, &normal_sum);
+			}
+			sizes[id] = count;
+			normal_sums[id] = normal_sum;
+			num_clusters++;
+		}
+	}
+
+	// Group the triangles by cluster, each still in the order it grew
+	int *starts = checked_alloc((num_clusters + 1) * sizeof(int));
+	starts[0] = 0;
+	for (int c = 0; c < num_clusters; c++)
+		starts[c+1] = starts[c] + sizes[c];
+	int *grouped = checked_alloc(num_triangles * sizeof(int));
+	for (int i = 0; i < num_triangles; i++)
+		grouped[starts[cluster[order[i]]]++] = order[i];
+	free(order);
+	order = grouped;
+
+	Meshlet *result = checked_alloc(num_clusters * sizeof(Meshlet));
+	for (int c = 0, first = 0; c < num_clusters; first += sizes[c++])
+		result[c] = bound_meshlet(&m, order, first, sizes[c], closed);
+	free(starts);
+	free(sizes);
+	free(normal_sums);
+
+	// Lay the triangles out in cluster order
+	if (indices) {
+		uint32_t *copy = checked_alloc(3 * num_triangles * sizeof(uint32_t));
+		memcpy(copy, indices, 3 * num_triangles * sizeof(uint32_t));
+		for (int i = 0; i < num_triangles; i++)
+			memcpy(&indices[3 * i], &copy[3 * order[i]], 3 * sizeof(uint32_t));
+		free(copy);
+	} else {
+		Vertex *copy = checked_alloc(3 * num_triangles * sizeof(Vertex));
+		memcpy(copy, vertices.data, 3 * num_triangles * sizeof(Vertex));
+		for (int i = 0; i < num_triangles; i++)
+			memcpy(&vertices.data[3 * i], &copy[3 * order[i]], 3 * sizeof(Vertex));
+		free(copy);
+	}
+
+	free(order);
+	free(cluster);
+	free(queued);
+	free(frontier);
+	free_cluster_mesh(&m);
+
+	*meshlets = result;
+	return num_clusters;
+}
+
+#define PACKED_MESH_HEADER 16
+
+void *pack_mesh(VertexArray vertices, size_t *size)
+{
+	*size = PACKED_MESH_HEADER + (size_t) vertices.size * sizeof(Vertex);
+	char *data = calloc(1, *size);
+	if (data == NULL)
+		return NULL;
+
+	uint32_t count = vertices.size;
+	memcpy(data, PACKED_MESH_MAGIC, 8);
+	memcpy(data + 8, &count, sizeof(count));
+	memcpy(data + PACKED_MESH_HEADER, vertices.data, (size_t) vertices.size * sizeof(Vertex));
+	return data;
+}
+
+static bool unpack_mesh(const char *src, size_t len, VertexArray *result, const char *file)
+{
+	uint32_t count;
+	memcpy(&count, src + 8, sizeof(count));
+
+	if (count > (len - PACKED_MESH_HEADER) / sizeof(Vertex)) {
+		printf("Failed loading '%s' (truncated mesh)\n", file);
+		return false;
 	}
 
-	if (free_me)
-		free(free_me);
+	Vertex *vertices = malloc(((size_t) count + 1) * sizeof(Vertex));
+	if (vertices == NULL) {
+		printf("Failed loading '%s' (out of memory)\n", file);
+		return false;
+	}
+	memcpy(vertices, src + PACKED_MESH_HEADER, (size_t) count * sizeof(Vertex));
 
-	tinyobj_attrib_free(&attrib);
-	tinyobj_shapes_free(shapes, num_shapes);
-	tinyobj_materials_free(materials, num_materials);
+	result->data     = vertices;
+	result->size     = count;
+	result->capacity = count + 1;
 	return true;
-}
\ No newline at end of file
+}
+
+bool load_mesh_from_file(const char *file, int num_threads, MeshData *result)
+{
+	*result = (MeshData) {0};
+
+	MappedFile mapped;
+	if (!map_file(file, &mapped)) {
+		printf("Failed loading '%s'\n", file);
+		return false;
+	}
+
+	bool ok;
+	if (mapped.size >= PACKED_MESH_HEADER && !memcmp(mapped.data, PACKED_MESH_MAGIC, 8))
+		ok = unpack_mesh(mapped.data, mapped.size, &result->vertices, file);
+	else if (mapped.size >= 4 && !memcmp(mapped.data, GLB_MAGIC, 4))
+		ok = parse_glb(mapped.data, mapped.size, result, file);
+	else
+		ok = parse_obj(mapped.data, mapped.size, num_threads, &result->vertices, file);
+
+	unmap_file(&mapped);
+	return ok;
+}
+
+void free_mesh_data(MeshData *data)
+{
+	free(data->vertices.data);
+	free(data->indices);
+	*data = (MeshData) {0};
+}
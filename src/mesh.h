@@ -1,3 +1,8 @@
+#ifndef MESH_INCLUDED
+#define MESH_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
 #include "vector.h"
 
 typedef struct {
@@ -14,8 +19,85 @@ typedef struct {
 
 void append_vertex(VertexArray *array, Vertex v);
 
-VertexArray make_sphere_mesh(float radius);
-VertexArray make_sphere_mesh_2(float radius, int num_segms, bool fake_normals);
-VertexArray make_cube_mesh(void);
+// Clusters of up to MESHLET_MAX_TRIANGLES connected triangles, stored
+// as ranges of triangles of the mesh they were built from. All of their
+// triangles face away from the points P for which
+//
+//   dot(normalize(cone_apex - P), cone_axis) >= cone_cutoff
+//
+// which holds for none if the cutoff is greater than 1. That's always
+// the case for meshes that aren't closed, since their back faces may
+// be seen.
+//
+// Clusters have at least MESHLET_MIN_TRIANGLES, unless they are a
+// separate part of the mesh.
+#define MESHLET_MIN_TRIANGLES 32
+#define MESHLET_MAX_TRIANGLES 128
+
+typedef struct {
+	int     first_triangle;
+	int     num_triangles;
+	Vector3 center; // Bounding sphere
+	float   radius;
+	Vector3 cone_apex;
+	Vector3 cone_axis;
+	float   cone_cutoff;
+} Meshlet;
+
+// Partitions a mesh, made of the triangles of "vertices" or, if not
+// NULL, of "indices", into meshlets and reorders the triangles in
+// place so that each is a range. Returns the number of meshlets, which
+// is 0 for meshes that fit in one.
+int build_meshlets(VertexArray vertices, uint32_t *indices, int num_indices, Meshlet **meshlets);
+
+// Levels of detail of a mesh, each with about half the triangles of the
+// previous one. The first level is the full mesh.
+#define MAX_MESH_LODS 4
+
+typedef struct {
+	VertexArray vertices;
+	float error; // Estimated distance from the full mesh, in model units
+	Meshlet *meshlets; // Not built by build_mesh_lods
+	int num_meshlets;
+} MeshLOD;
+
+// Simplifies "vertices", a list of triangles or, if "indices" isn't
+// NULL, the vertices they index, by collapsing edges in order of
+// quadric error. Sets lods[0] to "vertices" itself and stores the
+// simplified levels after it as lists of triangles. Each level aims for
+// half the triangles of the previous one, and stops there at no more
+// than half again as many. Texture seams stay in place and the normals
+// and texture coordinates come from the input. Returns the number of
+// levels, which is 1 for meshes too small to simplify.
+// free_mesh_lods frees the levels after the first and the meshlets of
+// all of them.
+int  build_mesh_lods(VertexArray vertices, const uint32_t *indices, int num_indices, MeshLOD *lods);
+void free_mesh_lods(MeshLOD *lods, int num_lods);
+
+// Factors of the metallic-roughness material model
+typedef struct {
+	bool  present;
+	float base_color[3];
+	float metallic;
+	float roughness;
+} MeshMaterial;
+
+typedef struct {
+	VertexArray  vertices;
+	uint32_t    *indices; // NULL if "vertices" is a list of triangles
+	int          num_indices;
+	MeshMaterial material;
+} MeshData;
+
+// Meshes are stored in asset archives already parsed, as
+// PACKED_MESH_MAGIC, the number of vertices (uint32_t), four bytes of
+// padding and the vertices. load_mesh_from_file reads these, glTF
+// binaries (see parse_glb) and OBJ files, parsing the latter with up
+// to "num_threads" threads (see load_obj).
+#define PACKED_MESH_MAGIC "PBRMESH1"
+
+bool  load_mesh_from_file(const char *file, int num_threads, MeshData *result);
+void  free_mesh_data(MeshData *data);
+void *pack_mesh(VertexArray vertices, size_t *size);
 
-bool load_mesh_from_file(const char *file, VertexArray *result);
\ No newline at end of file
+#endif
@@ -0,0 +1,608 @@
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "utils.h"
+#include "obj.h"
+
+/*
+ * The file is parsed in three passes, each one running on all chunks
+ * in parallel:
+ *
+ *   1. Count the attributes and triangles defined by each chunk
+ *   2. Parse the attributes and corner indices into global arrays, at
+ *      the offsets given by the prefix sums of the counts
+ *   3. Resolve the corners of each triangle into vertices
+ *
+ * Faces can refer to attributes defined by any earlier chunk, which is
+ * why the vertices can only be built once all chunks are parsed.
+ */
+
+// Chunks smaller than this aren't worth a thread
+#define OBJ_MIN_CHUNK (64 * 1024)
+
+#define NO_INDEX INT32_MIN
+
+typedef struct {
+	const char *start;
+	const char *end;
+
+	// Counts of the chunk (pass 1)
+	int num_positions;
+	int num_normals;
+	int num_texcoords;
+	int num_triangles;
+
+	// Offsets of the chunk in the global arrays (prefix sums)
+	int first_position;
+	int first_normal;
+	int first_texcoord;
+	int first_triangle;
+
+	int error_line; // Relative to the chunk, or 0
+} ObjChunk;
+
+typedef struct {
+	ObjChunk *chunks;
+	int num_chunks;
+
+	float   *positions; // 3 per position
+	float   *normals;   // 3 per normal
+	float   *texcoords; // 2 per texture coordinate
+	int32_t *corners;   // 3 indices (position, texcoord, normal) per corner
+	int num_positions;
+	int num_normals;
+	int num_texcoords;
+	int num_triangles;
+
+	Vertex *vertices;
+} ObjFile;
+
+typedef struct {
+	ObjFile *obj;
+	int      chunk;
+	void   (*pass)(ObjFile *obj, ObjChunk *chunk);
+} ObjTask;
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static const char *skip_spaces(const char *p, const char *end)
+{
+	while (p < end && is_space(*p))
+		p++;
+	return p;
+}
+
+static const char *next_line(const char *p, const char *end)
+{
+	const char *newline = memchr(p, '\n', end - p);
+	return newline ? newline + 1 : end;
+}
+
+// Parses a decimal number. The significant digits are accumulated in an
+// integer and scaled by an exact power of ten, which is both faster and
+// more precise than accumulating a float digit by digit. Returns NULL
+// if there is no number at "p".
+static const char *parse_float(const char *p, const char *end, float *out)
+{
+	static const double powers[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0;   // Significant digits in the mantissa
+	int exponent = 0;
+	bool any = false;
+
+	while (p < end && is_digit(*p)) {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa) digits++;
+		} else
+			exponent++;
+		any = true;
+		p++;
+	}
+
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && is_digit(*p)) {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa) digits++;
+				exponent--;
+			}
+			any = true;
+			p++;
+		}
+	}
+
+	if (!any)
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool negative_exp = false;
+		if (q < end && (*q == '-' || *q == '+')) {
+			negative_exp = (*q == '-');
+			q++;
+		}
+		if (q < end && is_digit(*q)) {
+			int value = 0;
+			while (q < end && is_digit(*q)) {
+				if (value < 10000)
+					value = value * 10 + (*q - '0');
+				q++;
+			}
+			exponent += negative_exp ? -value : value;
+			p = q;
+		}
+	}
+
+	double value = (double) mantissa;
+	if (exponent < 0) {
+		if (exponent >= -22) value /= powers[-exponent];
+		else                 value *= pow(10, exponent);
+	} else if (exponent > 0) {
+		if (exponent <= 22) value *= powers[exponent];
+		else                value *= pow(10, exponent);
+	}
+
+	*out = negative ? -value : value;
+	return p;
+}
+
+static const char *parse_int(const char *p, const char *end, int32_t *out)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+	if (p == end || !is_digit(*p))
+		return NULL;
+
+	int64_t value = 0;
+	while (p < end && is_digit(*p)) {
+		if (value <= INT32_MAX)
+			value = value * 10 + (*p - '0');
+		p++;
+	}
+	if (value > INT32_MAX)
+		return NULL;
+
+	*out = negative ? -value : value;
+	return p;
+}
+
+// Parses the floats of a "v", "vn" or "vt" record. Missing trailing
+// components are left to zero and extra ones are ignored.
+static bool parse_floats(const char *p, const char *end, float *dst, int count)
+{
+	for (int i = 0; i < count; i++) {
+		p = skip_spaces(p, end);
+		if (p == end || *p == '\n' || *p == '#') {
+			if (i == 0)
+				return false;
+			dst[i] = 0;
+			continue;
+		}
+		p = parse_float(p, end, &dst[i]);
+		if (p == NULL)
+			return false;
+	}
+	return true;
+}
+
+// Returns the type of the record at the start of the line and the
+// position after its keyword
+typedef enum {
+	RECORD_OTHER,
+	RECORD_POSITION,
+	RECORD_NORMAL,
+	RECORD_TEXCOORD,
+	RECORD_FACE,
+} RecordType;
+
+static RecordType record_type(const char *p, const char *end, const char **args)
+{
+	p = skip_spaces(p, end);
+	if (end - p < 2)
+		return RECORD_OTHER;
+
+	if (p[0] == 'v') {
+		if (is_space(p[1]))                     { *args = p + 1; return RECORD_POSITION; }
+		if (end - p < 3 || !is_space(p[2]))     return RECORD_OTHER;
+		if (p[1] == 'n')                        { *args = p + 2; return RECORD_NORMAL; }
+		if (p[1] == 't')                        { *args = p + 2; return RECORD_TEXCOORD; }
+	}
+	if (p[0] == 'f' && is_space(p[1]))          { *args = p + 1; return RECORD_FACE; }
+	return RECORD_OTHER;
+}
+
+// Number of corners of the face record starting at "p"
+static int count_corners(const char *p, const char *end)
+{
+	int count = 0;
+	for (;;) {
+		p = skip_spaces(p, end);
+		if (p == end || *p == '\n' || *p == '#')
+			break;
+		count++;
+		while (p < end && !is_space(*p) && *p != '\n')
+			p++;
+	}
+	return count;
+}
+
+static void count_pass(ObjFile *obj, ObjChunk *chunk)
+{
+	(void) obj;
+
+	for (const char *p = chunk->start; p < chunk->end; p = next_line(p, chunk->end)) {
+		const char *args;
+		switch (record_type(p, chunk->end, &args)) {
+			case RECORD_POSITION: chunk->num_positions++; break;
+			case RECORD_NORMAL:   chunk->num_normals++;   break;
+			case RECORD_TEXCOORD: chunk->num_texcoords++; break;
+			case RECORD_FACE: {
+				int corners = count_corners(args, chunk->end);
+				if (corners >= 3)
+					chunk->num_triangles += corners - 2;
+				break;
+			}
+			case RECORD_OTHER: break;
+		}
+	}
+}
+
+// Converts an OBJ index (1-based, or negative to count back from the
+// last defined element) to a 0-based one. "defined" is the number of
+// elements defined before the current line.
+static int32_t resolve_index(int32_t index, int defined)
+{
+	if (index > 0)
+		return index - 1;
+	if (index < 0)
+		return defined + index;
+	return NO_INDEX;
+}
+
+// Parses a corner like "1", "1/2", "1//3" or "1/2/3"
+static const char *parse_corner(const char *p, const char *end, int32_t corner[3], int positions, int texcoords, int normals)
+{
+	int32_t index;
+
+	p = parse_int(p, end, &index);
+	if (p == NULL)
+		return NULL;
+	corner[0] = resolve_index(index, positions);
+	corner[1] = NO_INDEX;
+	corner[2] = NO_INDEX;
+
+	if (p < end && *p == '/') {
+		p++;
+		if (p < end && *p != '/') {
+			p = parse_int(p, end, &index);
+			if (p == NULL)
+				return NULL;
+			corner[1] = resolve_index(index, texcoords);
+		}
+		if (p < end && *p == '/') {
+			p++;
+			p = parse_int(p, end, &index);
+			if (p == NULL)
+				return NULL;
+			corner[2] = resolve_index(index, normals);
+		}
+	}
+
+	if (p < end && !is_space(*p) && *p != '\n')
+		return NULL;
+	return p;
+}
+
+static void parse_pass(ObjFile *obj, ObjChunk *chunk)
+{
+	int positions = chunk->first_position;
+	int normals   = chunk->first_normal;
+	int texcoords = chunk->first_texcoord;
+	int triangles = chunk->first_triangle;
+
+	int line = 1;
+	for (const char *p = chunk->start; p < chunk->end; p = next_line(p, chunk->end), line++) {
+
+		const char *args;
+		bool ok = true;
+		switch (record_type(p, chunk->end, &args)) {
+
+			case RECORD_POSITION:
+			ok = parse_floats(args, chunk->end, &obj->positions[3 * positions++], 3);
+			break;
+
+			case RECORD_NORMAL:
+			ok = parse_floats(args, chunk->end, &obj->normals[3 * normals++], 3);
+			break;
+
+			case RECORD_TEXCOORD:
+			ok = parse_floats(args, chunk->end, &obj->texcoords[2 * texcoords++], 2);
+			break;
+
+			case RECORD_FACE: {
+				int32_t first[3];
+				int32_t prev[3];
+				int n = 0;
+
+				const char *q = args;
+				for (;;) {
+					q = skip_spaces(q, chunk->end);
+					if (q == chunk->end || *q == '\n' || *q == '#')
+						break;
+
+					int32_t corner[3];
+					q = parse_corner(q, chunk->end, corner, positions, texcoords, normals);
+					if (q == NULL) {
+						ok = false;
+						break;
+					}
+
+					if (n == 0)
+						memcpy(first, corner, sizeof(first));
+					else if (n >= 2) {
+						int32_t *dst = &obj->corners[9 * triangles++];
+						memcpy(dst + 0, first,  sizeof(first));
+						memcpy(dst + 3, prev,   sizeof(prev));
+						memcpy(dst + 6, corner, sizeof(corner));
+					}
+					memcpy(prev, corner, sizeof(prev));
+					n++;
+				}
+				break;
+			}
+
+			case RECORD_OTHER:
+			break;
+		}
+
+		if (!ok) {
+			chunk->error_line = line;
+			return;
+		}
+	}
+}
+
+static void build_pass(ObjFile *obj, ObjChunk *chunk)
+{
+	for (int i = 0; i < chunk->num_triangles; i++) {
+
+		int triangle = chunk->first_triangle + i;
+		const int32_t *corners = &obj->corners[9 * triangle];
+		Vertex *v = &obj->vertices[3 * triangle];
+
+		for (int j = 0; j < 3; j++) {
+
+			int32_t position = corners[3 * j + 0];
+			int32_t texcoord = corners[3 * j + 1];
+			int32_t normal   = corners[3 * j + 2];
+
+			if (position < 0 || position >= obj->num_positions
+				|| (texcoord != NO_INDEX && (texcoord < 0 || texcoord >= obj->num_texcoords))
+				|| (normal   != NO_INDEX && (normal   < 0 || normal   >= obj->num_normals))) {
+				chunk->error_line = -1;
+				return;
+			}
+
+			v[j].x = obj->positions[3 * position + 0];
+			v[j].y = obj->positions[3 * position + 1];
+			v[j].z = obj->positions[3 * position + 2];
+
+			if (texcoord != NO_INDEX) {
+				v[j].tx = obj->texcoords[2 * texcoord + 0];
+				v[j].ty = obj->texcoords[2 * texcoord + 1];
+			} else {
+				v[j].tx = 0;
+				v[j].ty = 0;
+			}
+
+			if (normal != NO_INDEX) {
+				v[j].nx = obj->normals[3 * normal + 0];
+				v[j].ny = obj->normals[3 * normal + 1];
+				v[j].nz = obj->normals[3 * normal + 2];
+			} else {
+				v[j].nx = NAN; // Filled below
+			}
+		}
+
+		Vector3 a = {v[0].x, v[0].y, v[0].z};
+		Vector3 b = {v[1].x, v[1].y, v[1].z};
+		Vector3 c = {v[2].x, v[2].y, v[2].z};
+		Vector3 n = {0, 0, 0};
+		bool need_face_normal = isnan(v[0].nx) || isnan(v[1].nx) || isnan(v[2].nx);
+		if (need_face_normal) {
+			n = cross(combine(b, a, 1, -1), combine(c, a, 1, -1));
+			if (n.x != 0 || n.y != 0 || n.z != 0)
+				n = normalize(n);
+		}
+		for (int j = 0; j < 3; j++)
+			if (isnan(v[j].nx)) {
+				v[j].nx = n.x;
+				v[j].ny = n.y;
+				v[j].nz = n.z;
+			}
+	}
+}
+
+static void *run_task(void *arg)
+{
+	ObjTask *task = arg;
+	task->pass(task->obj, &task->obj->chunks[task->chunk]);
+	return NULL;
+}
+
+// Runs a pass over all chunks, one thread per chunk. The calling thread
+// takes the first one.
+static void run_pass(ObjFile *obj, void (*pass)(ObjFile *obj, ObjChunk *chunk))
+{
+	ObjTask   tasks[OBJ_MAX_THREADS];
+	pthread_t threads[OBJ_MAX_THREADS];
+	bool      started[OBJ_MAX_THREADS];
+
+	for (int i = 1; i < obj->num_chunks; i++) {
+		tasks[i] = (ObjTask) {obj, i, pass};
+		started[i] = !pthread_create(&threads[i], NULL, run_task, &tasks[i]);
+		if (!started[i])
+			run_task(&tasks[i]);
+	}
+
+	pass(obj, &obj->chunks[0]);
+
+	for (int i = 1; i < obj->num_chunks; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+}
+
+static int count_cores(void)
+{
+#ifdef _WIN32
+	return 4;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+#endif
+}
+
+bool parse_obj(const char *src, size_t len, int num_threads, VertexArray *result, const char *file)
+{
+	if (len == 0) {
+		*result = (VertexArray) {0, 0, 0};
+		return true;
+	}
+
+	if (num_threads <= 0)
+		num_threads = count_cores();
+	if (num_threads > OBJ_MAX_THREADS)
+		num_threads = OBJ_MAX_THREADS;
+
+	int num_chunks = len / OBJ_MIN_CHUNK;
+	if (num_chunks > num_threads) num_chunks = num_threads;
+	if (num_chunks < 1)           num_chunks = 1;
+
+	ObjChunk chunks[OBJ_MAX_THREADS];
+	ObjFile obj = {.chunks = chunks};
+
+	// Split at the first line boundary after each even cut
+	const char *end = src + len;
+	const char *p = src;
+	for (int i = 0; i < num_chunks && p < end; i++) {
+		const char *cut = src + len * (i + 1) / num_chunks;
+		if (cut < p) cut = p;
+		const char *chunk_end = (i == num_chunks-1) ? end : next_line(cut, end);
+		chunks[obj.num_chunks++] = (ObjChunk) {.start = p, .end = chunk_end};
+		p = chunk_end;
+	}
+
+	if (obj.num_chunks == 0) {
+		*result = (VertexArray) {0, 0, 0};
+		return true;
+	}
+
+	run_pass(&obj, count_pass);
+
+	for (int i = 0; i < obj.num_chunks; i++) {
+		ObjChunk *c = &chunks[i];
+		c->first_position = obj.num_positions;
+		c->first_normal   = obj.num_normals;
+		c->first_texcoord = obj.num_texcoords;
+		c->first_triangle = obj.num_triangles;
+		obj.num_positions += c->num_positions;
+		obj.num_normals   += c->num_normals;
+		obj.num_texcoords += c->num_texcoords;
+		obj.num_triangles += c->num_triangles;
+	}
+
+	obj.positions = malloc((3 * (size_t) obj.num_positions + 1) * sizeof(float));
+	obj.normals   = malloc((3 * (size_t) obj.num_normals   + 1) * sizeof(float));
+	obj.texcoords = malloc((2 * (size_t) obj.num_texcoords + 1) * sizeof(float));
+	obj.corners   = malloc((9 * (size_t) obj.num_triangles + 1) * sizeof(int32_t));
+	obj.vertices  = malloc((3 * (size_t) obj.num_triangles + 1) * sizeof(Vertex));
+
+	bool ok = obj.positions && obj.normals && obj.texcoords && obj.corners && obj.vertices;
+	if (!ok)
+		printf("OUT OF MEMORY\n");
+
+	if (ok) {
+		run_pass(&obj, parse_pass);
+
+		// Report the error closest to the start of the file
+		int line = 0;
+		for (int i = 0; i < obj.num_chunks; i++) {
+			if (chunks[i].error_line) {
+				printf("Failed loading '%s' (invalid record at line %d)\n", file, line + chunks[i].error_line);
+				ok = false;
+				break;
+			}
+			for (const char *q = chunks[i].start; q < chunks[i].end; q = next_line(q, chunks[i].end))
+				line++;
+		}
+	}
+
+	if (ok) {
+		run_pass(&obj, build_pass);
+
+		for (int i = 0; i < obj.num_chunks; i++)
+			if (chunks[i].error_line) {
+				printf("Failed loading '%s' (index out of range)\n", file);
+				ok = false;
+				break;
+			}
+	}
+
+	free(obj.positions);
+	free(obj.normals);
+	free(obj.texcoords);
+	free(obj.corners);
+
+	if (!ok) {
+		free(obj.vertices);
+		return false;
+	}
+
+	result->data     = obj.vertices;
+	result->size     = 3 * obj.num_triangles;
+	result->capacity = 3 * obj.num_triangles + 1;
+	return true;
+}
+
+bool load_obj(const char *file, int num_threads, VertexArray *result)
+{
+	MappedFile mapped;
+	if (!map_file(file, &mapped)) {
+		printf("Failed loading '%s'\n", file);
+		return false;
+	}
+
+	bool ok = parse_obj(mapped.data, mapped.size, num_threads, result, file);
+	unmap_file(&mapped);
+	return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef OBJ_INCLUDED
+#define OBJ_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "mesh.h"
+
+// Parser for Wavefront OBJ files. The file is memory mapped and split
+// at line boundaries, then each part is parsed by its own thread.
+// Only the geometry is read (v, vt, vn and f records), materials and
+// groups are ignored. Faces with more than three corners are split
+// into a fan of triangles.
+//
+// The result is a flat list of triangles, three vertices each. Corners
+// without a normal get the normal of the face.
+
+#define OBJ_MAX_THREADS 16
+
+// Uses up to "num_threads" threads, or one per core if it's 0
+bool load_obj(const char *file, int num_threads, VertexArray *result);
+
+// Same as load_obj, for a file that is already in memory. "file" is
+// only used in error messages.
+bool parse_obj(const char *src, size_t len, int num_threads, VertexArray *result, const char *file);
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "mesh.h"
+#include "obj.h"
+
+// Bundles the files given on the command line into an asset archive
+// (see mount_archive). OBJ files are stored already parsed, the others
+// as they are. Paths are stored as given, so they should be relative
+// to the directory the program runs from.
+//
+//   pack assets.pak assets/shaders/*.glsl assets/pieces/*.obj ...
+
+typedef struct {
+	const char *path;
+	char  *data;
+	size_t size;
+	uint64_t offset;
+} PackedFile;
+
+static int compare_paths(const void *a, const void *b)
+{
+	const PackedFile *x = a;
+	const PackedFile *y = b;
+	size_t lx = strlen(x->path);
+	size_t ly = strlen(y->path);
+	int c = memcmp(x->path, y->path, lx < ly ? lx : ly);
+	if (c) return c;
+	return (lx > ly) - (lx < ly);
+}
+
+static bool has_extension(const char *path, const char *ext)
+{
+	const char *dot = strrchr(path, '.');
+	return dot && !strcmp(dot, ext);
+}
+
+static bool read_input(const char *path, PackedFile *file)
+{
+	file->path = path;
+	while (file->path[0] == '.' && file->path[1] == '/')
+		file->path += 2;
+
+	if (has_extension(path, ".obj")) {
+		VertexArray vertices;
+		if (!load_obj(path, 0, &vertices))
+			return false;
+		file->data = pack_mesh(vertices, &file->size);
+		free(vertices.data);
+		return file->data != NULL;
+	}
+
+	file->data = load_file(path, &file->size);
+	if (file->data == NULL) {
+		printf("Failed loading '%s'\n", path);
+		return false;
+	}
+	return true;
+}
+
+static uint64_t align(uint64_t n)
+{
+	return (n + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+}
+
+static bool write_padding(FILE *stream, uint64_t from, uint64_t to)
+{
+	static const char zeros[ARCHIVE_ALIGNMENT];
+	return fwrite(zeros, 1, to - from, stream) == to - from;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <archive> <file>...\n", argv[0]);
+		return -1;
+	}
+
+	int num_files = argc - 2;
+	PackedFile *files = calloc(num_files, sizeof(PackedFile));
+	if (files == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	for (int i = 0; i < num_files; i++)
+		if (!read_input(argv[i+2], &files[i]))
+			return -1;
+
+	qsort(files, num_files, sizeof(PackedFile), compare_paths);
+
+	for (int i = 1; i < num_files; i++)
+		if (!compare_paths(&files[i-1], &files[i])) {
+			fprintf(stderr, "File '%s' given twice\n", files[i].path);
+			return -1;
+		}
+
+	// Lay out the paths after the entries and the contents after the paths
+	uint64_t offset = sizeof(ArchiveHeader) + (uint64_t) num_files * sizeof(ArchiveEntry);
+	uint64_t paths_offset = offset;
+	for (int i = 0; i < num_files; i++)
+		offset += strlen(files[i].path);
+	uint64_t paths_end = offset;
+	for (int i = 0; i < num_files; i++) {
+		offset = align(offset);
+		files[i].offset = offset;
+		offset += files[i].size;
+	}
+
+	FILE *stream = fopen(argv[1], "wb");
+	if (stream == NULL) {
+		fprintf(stderr, "Couldn't open '%s'\n", argv[1]);
+		return -1;
+	}
+
+	ArchiveHeader header = {0};
+	memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+	header.num_entries = num_files;
+	fwrite(&header, sizeof(header), 1, stream);
+
+	uint64_t path_offset = paths_offset;
+	for (int i = 0; i < num_files; i++) {
+		ArchiveEntry entry;
+		entry.path_offset = path_offset;
+		entry.path_length = strlen(files[i].path);
+		entry.data_offset = files[i].offset;
+		entry.data_size   = files[i].size;
+		fwrite(&entry, sizeof(entry), 1, stream);
+		path_offset += entry.path_length;
+	}
+
+	for (int i = 0; i < num_files; i++)
+		fwrite(files[i].path, 1, strlen(files[i].path), stream);
+
+	uint64_t written = paths_end;
+	for (int i = 0; i < num_files; i++) {
+		write_padding(stream, written, files[i].offset);
+		fwrite(files[i].data, 1, files[i].size, stream);
+		written = files[i].offset + files[i].size;
+		free(files[i].data);
+	}
+
+	bool failed = ferror(stream);
+	if (fclose(stream) || failed) {
+		fprintf(stderr, "Couldn't write '%s'\n", argv[1]);
+		return -1;
+	}
+
+	printf("Packed %d files in '%s' (%llu bytes)\n", num_files, argv[1], (unsigned long long) written);
+	free(files);
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+static void insert_free_range(RangePool *pool, int index, Range range)
+{
+	if (pool->num_free == pool->cap_free) {
+		int new_cap = pool->cap_free ? 2 * pool->cap_free : 8;
+		pool->free = realloc(pool->free, new_cap * sizeof(Range));
+		if (!pool->free) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+		pool->cap_free = new_cap;
+	}
+	memmove(pool->free + index + 1, pool->free + index, (pool->num_free - index) * sizeof(Range));
+	pool->free[index] = range;
+	pool->num_free++;
+}
+
+static void remove_free_range(RangePool *pool, int index)
+{
+	memmove(pool->free + index, pool->free + index + 1, (pool->num_free - index - 1) * sizeof(Range));
+	pool->num_free--;
+}
+
+void init_range_pool(RangePool *pool, uint32_t capacity)
+{
+	*pool = (RangePool) {0};
+	pool->capacity = capacity;
+	if (capacity > 0)
+		insert_free_range(pool, 0, (Range) {0, capacity});
+}
+
+void free_range_pool(RangePool *pool)
+{
+	free(pool->free);
+	*pool = (RangePool) {0};
+}
+
+void grow_range_pool(RangePool *pool, uint32_t capacity)
+{
+	if (capacity <= pool->capacity)
+		return;
+	// The new space is added as if it was allocated and then released,
+	// so that it merges with a free range at the end of the pool.
+	uint32_t added = capacity - pool->capacity;
+	uint32_t offset = pool->capacity;
+	pool->used += added;
+	pool->capacity = capacity;
+	release_range(pool, offset, added);
+}
+
+// First fit. Returns false when no free range is big enough, in which
+// case the caller may grow the pool and try again.
+bool alloc_range(RangePool *pool, uint32_t size, uint32_t *offset)
+{
+	if (size == 0) {
+		*offset = 0;
+		return true;
+	}
+
+	for (int i = 0; i < pool->num_free; i++) {
+		Range *range = &pool->free[i];
+		if (range->size >= size) {
+			*offset = range->offset;
+			range->offset += size;
+			range->size   -= size;
+			if (range->size == 0)
+				remove_free_range(pool, i);
+			pool->used += size;
+			return true;
+		}
+	}
+	return false;
+}
+
+void release_range(RangePool *pool, uint32_t offset, uint32_t size)
+{
+	if (size == 0)
+		return;
+
+	// Find the first free range after the released one
+	int i = 0;
+	while (i < pool->num_free && pool->free[i].offset < offset)
+		i++;
+
+	bool merge_prev = i > 0 && pool->free[i-1].offset + pool->free[i-1].size == offset;
+	bool merge_next = i < pool->num_free && offset + size == pool->free[i].offset;
+
+	if (merge_prev && merge_next) {
+		pool->free[i-1].size += size + pool->free[i].size;
+		remove_free_range(pool, i);
+	} else if (merge_prev) {
+		pool->free[i-1].size += size;
+	} else if (merge_next) {
+		pool->free[i].offset = offset;
+		pool->free[i].size  += size;
+	} else {
+		insert_free_range(pool, i, (Range) {offset, size});
+	}
+	pool->used -= size;
+}
+
+PoolStats get_range_pool_stats(RangePool *pool)
+{
+	PoolStats stats = {0};
+	stats.capacity = pool->capacity;
+	stats.used = pool->used;
+	stats.free_blocks = pool->num_free;
+	for (int i = 0; i < pool->num_free; i++)
+		if (stats.largest_free < pool->free[i].size)
+			stats.largest_free = pool->free[i].size;
+
+	uint32_t total_free = pool->capacity - pool->used;
+	if (total_free > 0)
+		stats.fragmentation = 1.0f - (float) stats.largest_free / total_free;
+	return stats;
+}
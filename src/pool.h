@@ -0,0 +1,39 @@
+#ifndef POOL_INCLUDED
+#define POOL_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Free-list suballocator of [offset, offset+size) ranges inside a
+// buffer of "capacity" elements. It only does the bookkeeping, the
+// storage itself lives elsewhere (usually in a GPU buffer).
+
+typedef struct {
+	uint32_t offset;
+	uint32_t size;
+} Range;
+
+typedef struct {
+	uint32_t capacity;
+	uint32_t used;
+	Range   *free;     // Sorted by offset, never adjacent
+	int      num_free;
+	int      cap_free;
+} RangePool;
+
+typedef struct {
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t free_blocks;
+	uint32_t largest_free;
+	float    fragmentation; // 0 when all free space is contiguous, close to 1 when it's all scattered
+} PoolStats;
+
+void init_range_pool(RangePool *pool, uint32_t capacity);
+void free_range_pool(RangePool *pool);
+void grow_range_pool(RangePool *pool, uint32_t capacity);
+bool alloc_range(RangePool *pool, uint32_t size, uint32_t *offset);
+void release_range(RangePool *pool, uint32_t offset, uint32_t size);
+PoolStats get_range_pool_stats(RangePool *pool);
+
+#endif
@@ -0,0 +1,244 @@
+// For clock_gettime
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "profiler.h"
+
+#define PROFILE_RING_SIZE  (1 << 16) // Events kept per thread
+#define PROFILE_MAX_DEPTH  32
+#define PROFILE_MAX_TRACKS 8
+
+typedef struct {
+	const char *name;
+	uint64_t    start;
+	uint64_t    end;
+	int         track;
+} ProfileEvent;
+
+typedef struct ThreadProfile ThreadProfile;
+struct ThreadProfile {
+	ThreadProfile *next;
+	const char    *name;
+	const char    *track_names[PROFILE_MAX_TRACKS];
+	int            id;
+	bool           in_use; // Cleared when the thread exits
+
+	ProfileEvent *events;
+	uint64_t      count; // Total events recorded, the ring keeps the last PROFILE_RING_SIZE
+
+	int         depth;
+	const char *open_names[PROFILE_MAX_DEPTH];
+	uint64_t    open_times[PROFILE_MAX_DEPTH];
+};
+
+bool profiler_enabled = false;
+
+static _Thread_local ThreadProfile *thread_profile;
+
+static pthread_mutex_t profiles_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ThreadProfile *profiles;
+static int num_profiles;
+
+void enable_profiler(bool yes)
+{
+	profiler_enabled = yes;
+}
+
+uint64_t profile_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static ThreadProfile *get_thread_profile(void)
+{
+	if (thread_profile)
+		return thread_profile;
+
+	// Take over the ring of a thread that exited, keeping its events,
+	// so that short-lived threads don't each allocate one
+	pthread_mutex_lock(&profiles_mutex);
+	ThreadProfile *profile = profiles;
+	while (profile && profile->in_use)
+		profile = profile->next;
+	if (profile) {
+		profile->in_use = true;
+		profile->name = NULL;
+		memset(profile->track_names, 0, sizeof(profile->track_names));
+		profile->depth = 0;
+	}
+	pthread_mutex_unlock(&profiles_mutex);
+
+	if (profile == NULL) {
+		profile = calloc(1, sizeof(ThreadProfile));
+		if (profile == NULL)
+			return NULL;
+		profile->events = malloc(PROFILE_RING_SIZE * sizeof(ProfileEvent));
+		if (profile->events == NULL) {
+			free(profile);
+			return NULL;
+		}
+		profile->in_use = true;
+
+		pthread_mutex_lock(&profiles_mutex);
+		profile->id = ++num_profiles;
+		profile->next = profiles;
+		profiles = profile;
+		pthread_mutex_unlock(&profiles_mutex);
+	}
+
+	thread_profile = profile;
+	return profile;
+}
+
+static void push_event(ThreadProfile *profile, const char *name, uint64_t start, uint64_t end, int track)
+{
+	ProfileEvent *event = &profile->events[profile->count % PROFILE_RING_SIZE];
+	event->name  = name;
+	event->start = start;
+	event->end   = end;
+	event->track = track;
+	profile->count++;
+}
+
+void profile_begin(const char *name)
+{
+	ThreadProfile *profile = get_thread_profile();
+	if (profile == NULL)
+		return;
+
+	// Zones deeper than the limit are counted but not recorded
+	if (profile->depth < PROFILE_MAX_DEPTH) {
+		profile->open_names[profile->depth] = name;
+		profile->open_times[profile->depth] = profile_time();
+	}
+	profile->depth++;
+}
+
+void profile_end(void)
+{
+	ThreadProfile *profile = get_thread_profile();
+	if (profile == NULL || profile->depth == 0)
+		return;
+
+	profile->depth--;
+	if (profile->depth < PROFILE_MAX_DEPTH)
+		push_event(profile,
+			profile->open_names[profile->depth],
+			profile->open_times[profile->depth],
+			profile_time(), 0);
+}
+
+void profile_thread_name(const char *name)
+{
+	ThreadProfile *profile = get_thread_profile();
+	if (profile)
+		profile->name = name;
+}
+
+void profile_thread_exit(void)
+{
+	if (thread_profile == NULL)
+		return;
+
+	pthread_mutex_lock(&profiles_mutex);
+	thread_profile->in_use = false;
+	pthread_mutex_unlock(&profiles_mutex);
+	thread_profile = NULL;
+}
+
+void profile_track_name(int track, const char *name)
+{
+	ThreadProfile *profile = get_thread_profile();
+	if (profile && track > 0 && track < PROFILE_MAX_TRACKS)
+		profile->track_names[track] = name;
+}
+
+void profile_event(const char *name, uint64_t start, uint64_t end, int track)
+{
+	if (!profiler_enabled || track < 0 || track >= PROFILE_MAX_TRACKS)
+		return;
+
+	ThreadProfile *profile = get_thread_profile();
+	if (profile)
+		push_event(profile, name, start, end, track);
+}
+
+static void write_json_string(FILE *stream, const char *str)
+{
+	fputc('"', stream);
+	for (const char *p = str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			fputc('\\', stream);
+		if ((unsigned char) *p >= 0x20)
+			fputc(*p, stream);
+	}
+	fputc('"', stream);
+}
+
+bool save_profile(const char *file)
+{
+	FILE *stream = fopen(file, "w");
+	if (stream == NULL)
+		return false;
+
+	// Timestamps are relative to the oldest event
+	uint64_t origin = UINT64_MAX;
+	for (ThreadProfile *p = profiles; p; p = p->next) {
+		uint64_t first = p->count > PROFILE_RING_SIZE ? p->count - PROFILE_RING_SIZE : 0;
+		for (uint64_t i = first; i < p->count; i++) {
+			uint64_t start = p->events[i % PROFILE_RING_SIZE].start;
+			if (start < origin)
+				origin = start;
+		}
+	}
+
+	fprintf(stream, "{\"traceEvents\":[\n");
+	bool first_event = true;
+
+	for (ThreadProfile *p = profiles; p; p = p->next) {
+
+		// Tracks other than 0 get their own row in the viewer, named
+		// after the thread they were recorded on
+		int max_track = 0;
+		uint64_t first = p->count > PROFILE_RING_SIZE ? p->count - PROFILE_RING_SIZE : 0;
+		for (uint64_t i = first; i < p->count; i++)
+			if (p->events[i % PROFILE_RING_SIZE].track > max_track)
+				max_track = p->events[i % PROFILE_RING_SIZE].track;
+
+		for (int track = 0; track <= max_track; track++) {
+			char name[64];
+			if (track == 0)                  snprintf(name, sizeof(name), "%s", p->name ? p->name : "thread");
+			else if (p->track_names[track])  snprintf(name, sizeof(name), "%s", p->track_names[track]);
+			else                             snprintf(name, sizeof(name), "%s (track %d)", p->name ? p->name : "thread", track);
+
+			fprintf(stream, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+				first_event ? "" : ",\n", p->id * 16 + track);
+			write_json_string(stream, name);
+			fprintf(stream, "}}");
+			first_event = false;
+		}
+
+		for (uint64_t i = first; i < p->count; i++) {
+			ProfileEvent *e = &p->events[i % PROFILE_RING_SIZE];
+			fprintf(stream, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+				p->id * 16 + e->track,
+				(e->start - origin) / 1000.0,
+				(e->end - e->start) / 1000.0);
+			write_json_string(stream, e->name);
+			fputc('}', stream);
+		}
+	}
+
+	fprintf(stream, "\n]}\n");
+
+	bool ok = !ferror(stream);
+	if (fclose(stream))
+		ok = false;
+	return ok;
+}
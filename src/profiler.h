@@ -0,0 +1,47 @@
+#ifndef PROFILER_INCLUDED
+#define PROFILER_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// CPU profiler. Zones are opened and closed with PROFILE_BEGIN/END on
+// the same thread and can be nested. Every thread records into its own
+// ring buffer, so recording takes no locks and only the most recent
+// events are kept. When the profiler is disabled a zone costs a branch.
+//
+// Zone names are stored by pointer, so they must be string literals
+// or otherwise outlive the profiler.
+
+#define PROFILE_BEGIN(name) do { if (profiler_enabled) profile_begin(name); } while (0)
+#define PROFILE_END()       do { if (profiler_enabled) profile_end(); } while (0)
+
+extern bool profiler_enabled;
+
+void enable_profiler(bool yes);
+void profile_begin(const char *name);
+void profile_end(void);
+
+// Names the calling thread in the trace
+void profile_thread_name(const char *name);
+
+// Hands the ring of the calling thread over to the next thread that
+// starts recording. Threads that don't live as long as the program call
+// this before exiting, otherwise each would keep its own ring.
+void profile_thread_exit(void);
+
+// Names one of the extra tracks of the calling thread (see profile_event)
+void profile_track_name(int track, const char *name);
+
+// Nanoseconds from an arbitrary point, on the same clock used by zones
+uint64_t profile_time(void);
+
+// Records an already measured event. Used for timings that don't come
+// from the CPU, like GPU queries, which go on their own "track".
+void profile_event(const char *name, uint64_t start, uint64_t end, int track);
+
+// Writes all recorded events in the Chrome trace_event JSON format,
+// viewable in chrome://tracing or Perfetto. Must not be called while
+// other threads are recording.
+bool save_profile(const char *file);
+
+#endif
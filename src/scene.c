@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "scene.h"
+
+#define NODE_USED    1
+#define NODE_DIRTY   2
+#define NODE_HIDDEN  4
+
+// Nodes are stored as a structure of arrays so that the update loop
+// only touches the flags and the hierarchy unless a matrix needs to be
+// recomputed. Links are node indices plus one, 0 meaning none.
+static int num_nodes;
+static int cap_nodes;
+static uint8_t  *node_flags;
+static uint32_t *node_parent;
+static uint32_t *node_first_child;
+static uint32_t *node_next_sibling;
+static Vector3  *node_pos;
+static Vector3  *node_scale;
+static Vector3  *node_rotate;
+static Matrix4  *node_world;
+static Matrix4  *node_normal;
+static ModelID  *node_model;
+static Material *node_material;
+
+static void *grow_array(void *array, int count, size_t elem_size)
+{
+	array = realloc(array, count * elem_size);
+	if (!array) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+	return array;
+}
+
+static void grow_nodes(void)
+{
+	cap_nodes = cap_nodes ? 2 * cap_nodes : 64;
+	node_flags        = grow_array(node_flags,        cap_nodes, sizeof(*node_flags));
+	node_parent       = grow_array(node_parent,       cap_nodes, sizeof(*node_parent));
+	node_first_child  = grow_array(node_first_child,  cap_nodes, sizeof(*node_first_child));
+	node_next_sibling = grow_array(node_next_sibling, cap_nodes, sizeof(*node_next_sibling));
+	node_pos          = grow_array(node_pos,          cap_nodes, sizeof(*node_pos));
+	node_scale        = grow_array(node_scale,        cap_nodes, sizeof(*node_scale));
+	node_rotate       = grow_array(node_rotate,       cap_nodes, sizeof(*node_rotate));
+	node_world        = grow_array(node_world,        cap_nodes, sizeof(*node_world));
+	node_normal       = grow_array(node_normal,       cap_nodes, sizeof(*node_normal));
+	node_model        = grow_array(node_model,        cap_nodes, sizeof(*node_model));
+	node_material     = grow_array(node_material,     cap_nodes, sizeof(*node_material));
+}
+
+static bool valid_node(NodeID node)
+{
+	return node != NODE_INVALID && node <= (NodeID) num_nodes && (node_flags[node-1] & NODE_USED);
+}
+
+static void link_node(NodeID node, NodeID parent)
+{
+	node_parent[node-1] = parent;
+	if (parent == NODE_INVALID) {
+		node_next_sibling[node-1] = NODE_INVALID;
+		return;
+	}
+	node_next_sibling[node-1] = node_first_child[parent-1];
+	node_first_child[parent-1] = node;
+}
+
+static void unlink_node(NodeID node)
+{
+	NodeID parent = node_parent[node-1];
+	if (parent == NODE_INVALID)
+		return;
+
+	NodeID *link = &node_first_child[parent-1];
+	while (*link != node)
+		link = &node_next_sibling[*link-1];
+	*link = node_next_sibling[node-1];
+
+	node_parent[node-1] = NODE_INVALID;
+	node_next_sibling[node-1] = NODE_INVALID;
+}
+
+NodeID create_node(NodeID parent)
+{
+	if (parent != NODE_INVALID && !valid_node(parent))
+		return NODE_INVALID;
+
+	// Look for a free slot
+	int i = 0;
+	while (i < num_nodes && (node_flags[i] & NODE_USED))
+		i++;
+
+	if (i == num_nodes) {
+		if (num_nodes == cap_nodes)
+			grow_nodes();
+		num_nodes++;
+	}
+
+	node_flags[i] = NODE_USED | NODE_DIRTY;
+	node_first_child[i] = NODE_INVALID;
+	node_pos[i]      = (Vector3) {0, 0, 0};
+	node_scale[i]    = (Vector3) {1, 1, 1};
+	node_rotate[i]   = (Vector3) {0, 0, 0};
+	node_world[i]    = identity_matrix();
+	node_normal[i]   = identity_matrix();
+	node_model[i]    = MODEL_INVALID;
+	node_material[i] = (Material) {0};
+
+	NodeID node = i+1;
+	link_node(node, parent);
+	return node;
+}
+
+// Frees the node and all of its descendants
+void free_node(NodeID node)
+{
+	if (!valid_node(node))
+		return;
+
+	while (node_first_child[node-1] != NODE_INVALID)
+		free_node(node_first_child[node-1]);
+
+	unlink_node(node);
+	node_flags[node-1] = 0;
+}
+
+void set_node_parent(NodeID node, NodeID parent)
+{
+	if (!valid_node(node) || (parent != NODE_INVALID && !valid_node(parent)))
+		return;
+
+	// Don't allow cycles
+	for (NodeID p = parent; p != NODE_INVALID; p = node_parent[p-1])
+		if (p == node)
+			return;
+
+	unlink_node(node);
+	link_node(node, parent);
+	node_flags[node-1] |= NODE_DIRTY;
+}
+
+void set_node_transform(NodeID node, Vector3 pos, Vector3 scale, Vector3 rotate)
+{
+	if (!valid_node(node))
+		return;
+	node_pos[node-1]    = pos;
+	node_scale[node-1]  = scale;
+	node_rotate[node-1] = rotate;
+	node_flags[node-1] |= NODE_DIRTY;
+}
+
+void set_node_model(NodeID node, ModelID model, Material mat)
+{
+	if (!valid_node(node))
+		return;
+	node_model[node-1] = model;
+	node_material[node-1] = mat;
+}
+
+// Hiding a node also hides its descendants
+void set_node_visible(NodeID node, bool visible)
+{
+	if (!valid_node(node))
+		return;
+	if (visible)
+		node_flags[node-1] &= ~NODE_HIDDEN;
+	else
+		node_flags[node-1] |= NODE_HIDDEN;
+}
+
+// Only up to date after update_scene or draw_scene
+Matrix4 get_node_world_matrix(NodeID node)
+{
+	if (!valid_node(node))
+		return identity_matrix();
+	return node_world[node-1];
+}
+
+static void update_node(NodeID node, bool parent_changed)
+{
+	int i = node-1;
+
+	bool changed = parent_changed || (node_flags[i] & NODE_DIRTY);
+	if (changed) {
+		Matrix4 local = transform_matrix(node_pos[i], node_scale[i], node_rotate[i]);
+		NodeID parent = node_parent[i];
+		if (parent == NODE_INVALID)
+			node_world[i] = local;
+		else
+			node_world[i] = dotm(node_world[parent-1], local);
+		node_normal[i] = normal_matrix(node_world[i]);
+		node_flags[i] &= ~NODE_DIRTY;
+	}
+
+	for (NodeID child = node_first_child[i]; child != NODE_INVALID; child = node_next_sibling[child-1])
+		update_node(child, changed);
+}
+
+void update_scene(void)
+{
+	for (int i = 0; i < num_nodes; i++)
+		if ((node_flags[i] & NODE_USED) && node_parent[i] == NODE_INVALID)
+			update_node(i+1, false);
+}
+
+static void draw_node(NodeID node)
+{
+	int i = node-1;
+	if (node_flags[i] & NODE_HIDDEN)
+		return;
+
+	if (node_model[i] != MODEL_INVALID)
+		draw_model_matrix(node_model[i], node_world[i], node_normal[i], node_material[i]);
+
+	for (NodeID child = node_first_child[i]; child != NODE_INVALID; child = node_next_sibling[child-1])
+		draw_node(child);
+}
+
+// Queues a draw command for every visible node with a model
+void draw_scene(void)
+{
+	update_scene();
+
+	for (int i = 0; i < num_nodes; i++)
+		if ((node_flags[i] & NODE_USED) && node_parent[i] == NODE_INVALID)
+			draw_node(i+1);
+}
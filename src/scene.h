@@ -0,0 +1,21 @@
+#include "vector.h"
+#include "graphics.h"
+
+// Retained scene. Nodes hold a transform relative to their parent and
+// optionally a model to draw. World matrices are cached and only
+// recomputed for nodes whose transform, or one of whose ancestors'
+// transform, changed since the last update.
+
+typedef uint32_t NodeID;
+#define NODE_INVALID ((NodeID) 0)
+
+NodeID  create_node(NodeID parent);
+void    free_node(NodeID node);
+void    set_node_parent(NodeID node, NodeID parent);
+void    set_node_transform(NodeID node, Vector3 pos, Vector3 scale, Vector3 rotate);
+void    set_node_model(NodeID node, ModelID model, Material mat);
+void    set_node_visible(NodeID node, bool visible);
+Matrix4 get_node_world_matrix(NodeID node);
+
+void update_scene(void);
+void draw_scene(void);
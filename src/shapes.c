@@ -0,0 +1,184 @@
+#include <math.h>
+#include "shapes.h"
+
+#define PI 3.14159265358979323846
+
+static void emit_triangle(uint32_t **indices, uint32_t a, uint32_t b, uint32_t c)
+{
+	uint32_t *dst = *indices;
+	dst[0] = a;
+	dst[1] = b;
+	dst[2] = c;
+	*indices += 3;
+}
+
+ShapeSize sphere_size(int segments, int rings)
+{
+	// The seam and the poles have a vertex per texture coordinate,
+	// and the bands at the poles are made of triangles instead of quads
+	ShapeSize size;
+	size.num_vertices = (segments + 1) * (rings + 1);
+	size.num_indices  = 6 * segments * (rings - 1);
+	return size;
+}
+
+void build_sphere(float radius, int segments, int rings, Vertex *vertices, uint32_t *indices)
+{
+	for (int i = 0; i <= rings; i++) {
+
+		float theta = PI * i / rings;
+		float ring_y = cosf(theta);
+		float ring_r = sinf(theta);
+
+		for (int j = 0; j <= segments; j++) {
+
+			float phi = 2 * PI * j / segments;
+			float nx = ring_r * cosf(phi);
+			float nz = ring_r * sinf(phi);
+
+			Vertex v;
+			v.x  = radius * nx;
+			v.y  = radius * ring_y;
+			v.z  = radius * nz;
+			v.nx = nx;
+			v.ny = ring_y;
+			v.nz = nz;
+			v.tx = (float) j / segments;
+			v.ty = (float) i / rings;
+			*vertices++ = v;
+		}
+	}
+
+	int stride = segments + 1;
+	for (int i = 0; i < rings; i++)
+		for (int j = 0; j < segments; j++) {
+			uint32_t a = i * stride + j;
+			uint32_t b = a + stride;
+			uint32_t c = b + 1;
+			uint32_t d = a + 1;
+			if (i < rings - 1) emit_triangle(&indices, a, c, b);
+			if (i > 0)         emit_triangle(&indices, a, d, c);
+		}
+}
+
+ShapeSize cube_size(void)
+{
+	return (ShapeSize) {24, 36};
+}
+
+void build_cube(Vector3 min, Vector3 max, Vertex *vertices, uint32_t *indices)
+{
+	// Corners of each face in the unit cube, counter-clockwise
+	static const struct {
+		float normal[3];
+		unsigned char corners[4][3];
+	} faces[6] = {
+		{{ 0,  0, -1}, {{1, 0, 0}, {0, 0, 0}, {0, 1, 0}, {1, 1, 0}}},
+		{{ 0,  0,  1}, {{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}}},
+		{{-1,  0,  0}, {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}}},
+		{{ 1,  0,  0}, {{1, 0, 1}, {1, 0, 0}, {1, 1, 0}, {1, 1, 1}}},
+		{{ 0, -1,  0}, {{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1}}},
+		{{ 0,  1,  0}, {{0, 1, 1}, {1, 1, 1}, {1, 1, 0}, {0, 1, 0}}},
+	};
+	static const float texcoords[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+
+	for (int i = 0; i < 6; i++) {
+		for (int j = 0; j < 4; j++) {
+			Vertex v;
+			v.x  = faces[i].corners[j][0] ? max.x : min.x;
+			v.y  = faces[i].corners[j][1] ? max.y : min.y;
+			v.z  = faces[i].corners[j][2] ? max.z : min.z;
+			v.nx = faces[i].normal[0];
+			v.ny = faces[i].normal[1];
+			v.nz = faces[i].normal[2];
+			v.tx = texcoords[j][0];
+			v.ty = texcoords[j][1];
+			*vertices++ = v;
+		}
+		uint32_t base = 4 * i;
+		emit_triangle(&indices, base, base + 1, base + 2);
+		emit_triangle(&indices, base, base + 2, base + 3);
+	}
+}
+
+ShapeSize cylinder_size(int segments)
+{
+	// Side rings with a seam vertex, plus each cap's center and ring
+	ShapeSize size;
+	size.num_vertices = 2 * (segments + 1) + 2 * (segments + 2);
+	size.num_indices  = 12 * segments;
+	return size;
+}
+
+void build_cylinder(float radius, float height, int segments, Vertex *vertices, uint32_t *indices)
+{
+	float top    =  height / 2;
+	float bottom = -height / 2;
+
+	// Bottom and top vertex of each side segment, interleaved
+	for (int j = 0; j <= segments; j++) {
+		float phi = 2 * PI * j / segments;
+		float nx = cosf(phi);
+		float nz = sinf(phi);
+		float tx = (float) j / segments;
+		*vertices++ = (Vertex) {radius * nx, bottom, radius * nz, nx, 0, nz, tx, 0};
+		*vertices++ = (Vertex) {radius * nx, top,    radius * nz, nx, 0, nz, tx, 1};
+	}
+	for (int j = 0; j < segments; j++) {
+		uint32_t a = 2 * j;
+		emit_triangle(&indices, a, a + 3, a + 2);
+		emit_triangle(&indices, a, a + 1, a + 3);
+	}
+
+	for (int cap = 0; cap < 2; cap++) {
+
+		float y  = cap ? top : bottom;
+		float ny = cap ? 1 : -1;
+
+		uint32_t center = 2 * (segments + 1) + cap * (segments + 2);
+		*vertices++ = (Vertex) {0, y, 0, 0, ny, 0, 0.5f, 0.5f};
+
+		for (int j = 0; j <= segments; j++) {
+			float phi = 2 * PI * j / segments;
+			float c = cosf(phi);
+			float s = sinf(phi);
+			*vertices++ = (Vertex) {radius * c, y, radius * s, 0, ny, 0, 0.5f + c / 2, 0.5f + s / 2};
+		}
+		for (int j = 0; j < segments; j++) {
+			uint32_t a = center + 1 + j;
+			if (cap)
+				emit_triangle(&indices, center, a + 1, a);
+			else
+				emit_triangle(&indices, center, a, a + 1);
+		}
+	}
+}
+
+ShapeSize plane_size(int divisions)
+{
+	ShapeSize size;
+	size.num_vertices = (divisions + 1) * (divisions + 1);
+	size.num_indices  = 6 * divisions * divisions;
+	return size;
+}
+
+void build_plane(float width, float depth, int divisions, Vertex *vertices, uint32_t *indices)
+{
+	for (int i = 0; i <= divisions; i++)
+		for (int j = 0; j <= divisions; j++) {
+			float u = (float) i / divisions;
+			float v = (float) j / divisions;
+			*vertices++ = (Vertex) {(u - 0.5f) * width, 0, (v - 0.5f) * depth, 0, 1, 0, u, v};
+		}
+
+	int stride = divisions + 1;
+	for (int i = 0; i < divisions; i++)
+		for (int j = 0; j < divisions; j++) {
+			uint32_t a = i * stride + j;
+			uint32_t b = a + stride;
+			uint32_t c = b + 1;
+			uint32_t d = a + 1;
+			emit_triangle(&indices, a, c, b);
+			emit_triangle(&indices, a, d, c);
+		}
+}
@@ -0,0 +1,35 @@
+#ifndef SHAPES_INCLUDED
+#define SHAPES_INCLUDED
+
+#include <stdint.h>
+#include "mesh.h"
+
+// Procedural meshes. The *_size functions tell how many vertices and
+// indices a shape takes, and the build_* functions write exactly that
+// many into arrays given by the caller, which may be mapped buffers.
+// Triangles are counter-clockwise when seen from outside and indices
+// start from 0.
+typedef struct {
+	int num_vertices;
+	int num_indices;
+} ShapeSize;
+
+// UV sphere centered in the origin, with "segments" slices around the
+// Y axis and "rings" from pole to pole
+ShapeSize sphere_size(int segments, int rings);
+void      build_sphere(float radius, int segments, int rings, Vertex *vertices, uint32_t *indices);
+
+// Box from "min" to "max", with flat normals
+ShapeSize cube_size(void);
+void      build_cube(Vector3 min, Vector3 max, Vertex *vertices, uint32_t *indices);
+
+// Capped cylinder around the Y axis, centered in the origin
+ShapeSize cylinder_size(int segments);
+void      build_cylinder(float radius, float height, int segments, Vertex *vertices, uint32_t *indices);
+
+// Grid on the XZ plane facing up, centered in the origin, with
+// "divisions" quads per side
+ShapeSize plane_size(int divisions);
+void      build_plane(float width, float depth, int divisions, Vertex *vertices, uint32_t *indices);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "stream.h"
+
+/*
+ * Ring buffer for data that is rewritten every frame. The buffer is split
+ * in STREAM_FRAMES regions and each frame only writes to its own region,
+ * which is fenced at the end of the frame. Before reusing a region we wait
+ * on its fence, so the driver never has to orphan or copy the storage.
+ *
+ * When GL_ARB_buffer_storage is available (core since 4.4) the whole
+ * buffer is mapped once, persistently and coherently, and written in place.
+ * On plain GL 3.3 the unused part of the region is mapped unsynchronized
+ * on the first allocation and unmapped by flush_stream_buffer. This is
+ * safe because the fence already guarantees the GPU is done with it.
+ */
+
+bool init_stream_buffer(StreamBuffer *stream, unsigned int target, size_t region_size)
+{
+	memset(stream, 0, sizeof(*stream));
+	stream->target = target;
+	stream->region_size = region_size;
+
+	size_t total = region_size * STREAM_FRAMES;
+
+	glGenBuffers(1, &stream->buffer);
+	glBindBuffer(target, stream->buffer);
+
+	if (GLAD_GL_ARB_buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, total, NULL, flags);
+		stream->mapped = glMapBufferRange(target, 0, total, flags);
+		if (stream->mapped == NULL) {
+			fprintf(stderr, "Couldn't map stream buffer\n");
+			glBindBuffer(target, 0);
+			glDeleteBuffers(1, &stream->buffer);
+			return false;
+		}
+		stream->persistent = true;
+	} else {
+		glBufferData(target, total, NULL, GL_STREAM_DRAW);
+		stream->persistent = false;
+	}
+
+	glBindBuffer(target, 0);
+	return true;
+}
+
+void free_stream_buffer(StreamBuffer *stream)
+{
+	for (int i = 0; i < STREAM_FRAMES; i++)
+		if (stream->fences[i]) {
+			glDeleteSync(stream->fences[i]);
+			stream->fences[i] = NULL;
+		}
+
+	if (stream->mapped) {
+		glBindBuffer(stream->target, stream->buffer);
+		glUnmapBuffer(stream->target);
+		glBindBuffer(stream->target, 0);
+		stream->mapped = NULL;
+	}
+
+	glDeleteBuffers(1, &stream->buffer);
+	stream->buffer = 0;
+}
+
+void begin_stream_frame(StreamBuffer *stream)
+{
+	GLsync fence = stream->fences[stream->region];
+	if (fence) {
+		GLenum status;
+		do
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		while (status == GL_TIMEOUT_EXPIRED);
+
+		glDeleteSync(fence);
+		stream->fences[stream->region] = NULL;
+	}
+	stream->head = 0;
+}
+
+// Returns a pointer where "size" bytes can be written. The offset of the
+// allocation relative to the start of the buffer is stored in "offset"
+// so that it can be used with glBindBufferRange or as an attribute offset.
+void *alloc_stream_data(StreamBuffer *stream, size_t size, size_t align, size_t *offset)
+{
+	size_t start = (stream->head + align - 1) / align * align;
+	if (start + size > stream->region_size) {
+		printf("Stream buffer full.. Ignoring allocation\n");
+		return NULL;
+	}
+
+	size_t base = stream->region * stream->region_size;
+
+	if (!stream->persistent && stream->mapped == NULL) {
+		GLbitfield flags = GL_MAP_WRITE_BIT
+			| GL_MAP_UNSYNCHRONIZED_BIT
+			| GL_MAP_INVALIDATE_RANGE_BIT
+			| GL_MAP_FLUSH_EXPLICIT_BIT;
+		glBindBuffer(stream->target, stream->buffer);
+		stream->mapped = glMapBufferRange(stream->target, base + start, stream->region_size - start, flags);
+		glBindBuffer(stream->target, 0);
+		if (stream->mapped == NULL) {
+			fprintf(stderr, "Couldn't map stream buffer\n");
+			return NULL;
+		}
+		stream->map_start = start;
+	}
+
+	stream->head = start + size;
+	*offset = base + start;
+
+	if (stream->persistent)
+		return stream->mapped + base + start;
+	return stream->mapped + (start - stream->map_start);
+}
+
+// Makes the data written so far visible to the GPU. Must be called before
+// issuing draw calls that read from the buffer.
+void flush_stream_buffer(StreamBuffer *stream)
+{
+	if (stream->persistent || stream->mapped == NULL)
+		return;
+
+	glBindBuffer(stream->target, stream->buffer);
+	glFlushMappedBufferRange(stream->target, 0, stream->head - stream->map_start);
+	glUnmapBuffer(stream->target);
+	glBindBuffer(stream->target, 0);
+	stream->mapped = NULL;
+}
+
+void end_stream_frame(StreamBuffer *stream)
+{
+	flush_stream_buffer(stream);
+
+	stream->fences[stream->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	stream->region = (stream->region + 1) % STREAM_FRAMES;
+}
@@ -0,0 +1,26 @@
+#include <stddef.h>
+#include <stdbool.h>
+
+// Number of frames the CPU is allowed to run ahead of the GPU. Each
+// frame writes to its own region of the buffer, so a region is only
+// reused once the fence of the frame that last used it was signaled.
+#define STREAM_FRAMES 3
+
+typedef struct {
+	unsigned int buffer;
+	unsigned int target;
+	size_t region_size;
+	int    region;     // Region written by the current frame
+	size_t head;       // Bytes used in the current region
+	size_t map_start;  // Start of the current mapping (fallback path only)
+	char  *mapped;
+	bool   persistent;
+	void  *fences[STREAM_FRAMES];
+} StreamBuffer;
+
+bool  init_stream_buffer(StreamBuffer *stream, unsigned int target, size_t region_size);
+void  free_stream_buffer(StreamBuffer *stream);
+void  begin_stream_frame(StreamBuffer *stream);
+void *alloc_stream_data(StreamBuffer *stream, size_t size, size_t align, size_t *offset);
+void  flush_stream_buffer(StreamBuffer *stream);
+void  end_stream_frame(StreamBuffer *stream);
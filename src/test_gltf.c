@@ -0,0 +1,259 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "obj.h"
+#include "gltf.h"
+
+// Checks parse_glb on the piece models converted to glTF binaries, and
+// on a small file with interleaved and quantized attributes, a node
+// transform, a primitive without normals and a material
+
+typedef struct {
+	char  *data;
+	size_t size;
+	size_t capacity;
+} Buffer;
+
+static void append(Buffer *buffer, const void *data, size_t size)
+{
+	if (buffer->size + size > buffer->capacity) {
+		buffer->capacity = 2 * (buffer->size + size);
+		buffer->data = realloc(buffer->data, buffer->capacity);
+		if (buffer->data == NULL) {
+			printf("OUT OF MEMORY\n");
+			abort();
+		}
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+static void pad(Buffer *buffer, char c)
+{
+	while (buffer->size % 4)
+		append(buffer, &c, 1);
+}
+
+static Buffer make_glb(Buffer json, Buffer bin)
+{
+	pad(&json, ' ');
+	pad(&bin, 0);
+
+	uint32_t length = 12 + 8 + json.size + 8 + bin.size;
+	uint32_t header[3] = {0, 2, length};
+	memcpy(header, GLB_MAGIC, 4);
+	uint32_t json_chunk[2] = {json.size, 0x4E4F534A};
+	uint32_t bin_chunk[2]  = {bin.size,  0x004E4942};
+
+	Buffer glb = {0};
+	append(&glb, header, sizeof(header));
+	append(&glb, json_chunk, sizeof(json_chunk));
+	append(&glb, json.data, json.size);
+	append(&glb, bin_chunk, sizeof(bin_chunk));
+	append(&glb, bin.data, bin.size);
+	free(json.data);
+	free(bin.data);
+	return glb;
+}
+
+static bool floateq(float a, float b)
+{
+	return fabsf(a - b) <= 1e-4f * fmaxf(1, fabsf(a));
+}
+
+static bool vertexeq(Vertex a, Vertex b)
+{
+	return floateq(a.x, b.x) && floateq(a.y, b.y) && floateq(a.z, b.z)
+		&& floateq(a.nx, b.nx) && floateq(a.ny, b.ny) && floateq(a.nz, b.nz)
+		&& floateq(a.tx, b.tx) && floateq(a.ty, b.ty);
+}
+
+// Stores the OBJ vertices once each, as separate float arrays indexed
+// by 32 bit integers
+static void compare(const char *file)
+{
+	VertexArray expected;
+	if (!load_obj(file, 1, &expected)) {
+		printf("load_obj failed on '%s'\n", file);
+		abort();
+	}
+
+	int n = expected.size;
+	Buffer bin = {0};
+	for (int i = 0; i < n; i++) append(&bin, &expected.data[i].x,  3 * sizeof(float));
+	for (int i = 0; i < n; i++) append(&bin, &expected.data[i].nx, 3 * sizeof(float));
+	for (int i = 0; i < n; i++) {
+		float t[2] = {expected.data[i].tx, 1 - expected.data[i].ty};
+		append(&bin, t, sizeof(t));
+	}
+	for (uint32_t i = 0; i < (uint32_t) n; i++) append(&bin, &i, sizeof(i));
+
+	char text[2048];
+	int len = snprintf(text, sizeof(text),
+		"{\"asset\": {\"version\": \"2.0\"}, \"scene\": 0, \"scenes\": [{\"nodes\": [0]}],"
+		" \"nodes\": [{\"mesh\": 0}],"
+		" \"meshes\": [{\"primitives\": [{\"attributes\": {\"POSITION\": 0, \"NORMAL\": 1, \"TEXCOORD_0\": 2}, \"indices\": 3}]}],"
+		" \"buffers\": [{\"byteLength\": %zu}],"
+		" \"bufferViews\": [{\"buffer\": 0, \"byteOffset\": 0, \"byteLength\": %d},"
+		" {\"buffer\": 0, \"byteOffset\": %d, \"byteLength\": %d},"
+		" {\"buffer\": 0, \"byteOffset\": %d, \"byteLength\": %d},"
+		" {\"buffer\": 0, \"byteOffset\": %d, \"byteLength\": %d}],"
+		" \"accessors\": [{\"bufferView\": 0, \"componentType\": 5126, \"count\": %d, \"type\": \"VEC3\"},"
+		" {\"bufferView\": 1, \"componentType\": 5126, \"count\": %d, \"type\": \"VEC3\"},"
+		" {\"bufferView\": 2, \"componentType\": 5126, \"count\": %d, \"type\": \"VEC2\"},"
+		" {\"bufferView\": 3, \"componentType\": 5125, \"count\": %d, \"type\": \"SCALAR\"}]}",
+		bin.size,
+		12 * n, 12 * n, 12 * n, 24 * n, 8 * n, 32 * n, 4 * n,
+		n, n, n, n);
+	Buffer json = {0};
+	append(&json, text, len);
+
+	Buffer glb = make_glb(json, bin);
+
+	MeshData result;
+	if (!parse_glb(glb.data, glb.size, &result, file)) {
+		printf("parse_glb failed on '%s'\n", file);
+		abort();
+	}
+	if (result.num_indices != n || result.vertices.size != n) {
+		printf("'%s': %d indices, expected %d\n", file, result.num_indices, n);
+		abort();
+	}
+	for (int i = 0; i < n; i++)
+		if (!vertexeq(result.vertices.data[result.indices[i]], expected.data[i])) {
+			printf("'%s': vertex %d doesn't match\n", file, i);
+			abort();
+		}
+
+	printf("'%s': %d vertices OK\n", file, n);
+	free_mesh_data(&result);
+	free(expected.data);
+	free(glb.data);
+}
+
+static Buffer make_small_glb(void)
+{
+	// Interleaved position, normal and 16 bit texture coordinates
+	struct {
+		float    pos[3];
+		float    normal[3];
+		uint16_t tex[2];
+	} quad[4] = {
+		{{0, 0, 0}, {0, 0, 1}, {0,     0}},
+		{{1, 0, 0}, {0, 0, 1}, {65535, 0}},
+		{{1, 1, 0}, {0, 0, 1}, {65535, 65535}},
+		{{0, 1, 0}, {0, 0, 1}, {0,     65535}},
+	};
+	uint16_t indices[6] = {0, 1, 2, 0, 2, 3};
+	float triangle[3][3] = {{0, 0, 0}, {0, 0, -1}, {1, 0, 0}};
+
+	Buffer bin = {0};
+	append(&bin, quad, sizeof(quad));
+	append(&bin, indices, sizeof(indices));
+	append(&bin, triangle, sizeof(triangle));
+
+	char text[2048];
+	int len = snprintf(text, sizeof(text),
+		"{\"asset\": {\"version\": \"2.0\"}, \"scenes\": [{\"nodes\": [0]}],"
+		" \"nodes\": [{\"children\": [1], \"translation\": [1, 2, 3]},"
+		" {\"mesh\": 0, \"scale\": [2, 2, 2], \"rotation\": [0, 0, 0, 1]}],"
+		" \"meshes\": [{\"primitives\": ["
+		"  {\"attributes\": {\"POSITION\": 0, \"NORMAL\": 1, \"TEXCOORD_0\": 2}, \"indices\": 3, \"material\": 0},"
+		"  {\"attributes\": {\"POSITION\": 4}},"
+		"  {\"attributes\": {\"POSITION\": 4}, \"mode\": 1}]}],"
+		" \"materials\": [{\"pbrMetallicRoughness\": {\"baseColorFactor\": [0.5, 0.25, 1, 1], \"metallicFactor\": 0, \"roughnessFactor\": 0.75}}],"
+		" \"buffers\": [{\"byteLength\": %zu}],"
+		" \"bufferViews\": [{\"buffer\": 0, \"byteLength\": %zu, \"byteStride\": %zu},"
+		" {\"buffer\": 0, \"byteOffset\": %zu, \"byteLength\": %zu},"
+		" {\"buffer\": 0, \"byteOffset\": %zu, \"byteLength\": %zu}],"
+		" \"accessors\": [{\"bufferView\": 0, \"componentType\": 5126, \"count\": 4, \"type\": \"VEC3\"},"
+		" {\"bufferView\": 0, \"byteOffset\": 12, \"componentType\": 5126, \"count\": 4, \"type\": \"VEC3\"},"
+		" {\"bufferView\": 0, \"byteOffset\": 24, \"componentType\": 5123, \"normalized\": true, \"count\": 4, \"type\": \"VEC2\"},"
+		" {\"bufferView\": 1, \"componentType\": 5123, \"count\": 6, \"type\": \"SCALAR\"},"
+		" {\"bufferView\": 2, \"componentType\": 5126, \"count\": 3, \"type\": \"VEC3\"}]}",
+		bin.size,
+		sizeof(quad), sizeof(quad[0]),
+		sizeof(quad), sizeof(indices),
+		sizeof(quad) + sizeof(indices), sizeof(triangle));
+	Buffer json = {0};
+	append(&json, text, len);
+
+	return make_glb(json, bin);
+}
+
+static void test_small(void)
+{
+	Buffer glb = make_small_glb();
+
+	MeshData result;
+	if (!parse_glb(glb.data, glb.size, &result, "small")) {
+		printf("parse_glb failed on the small file\n");
+		abort();
+	}
+
+	// The line primitive is skipped and the triangle gets a vertex per
+	// corner
+	if (result.vertices.size != 7 || result.num_indices != 9) {
+		printf("Small file: %d vertices and %d indices\n", result.vertices.size, result.num_indices);
+		abort();
+	}
+
+	Vertex expected[7] = {
+		{1, 2, 3,  0, 0, 1,  0, 1},
+		{3, 2, 3,  0, 0, 1,  1, 1},
+		{3, 4, 3,  0, 0, 1,  1, 0},
+		{1, 4, 3,  0, 0, 1,  0, 0},
+		{1, 2, 3,  0, -1, 0,  0, 1},
+		{1, 2, 1,  0, -1, 0,  0, 1},
+		{3, 2, 3,  0, -1, 0,  0, 1},
+	};
+	uint32_t expected_indices[9] = {0, 1, 2, 0, 2, 3, 4, 5, 6};
+	for (int i = 0; i < 7; i++)
+		if (!vertexeq(result.vertices.data[i], expected[i])) {
+			printf("Small file: vertex %d doesn't match\n", i);
+			abort();
+		}
+	for (int i = 0; i < 9; i++)
+		if (result.indices[i] != expected_indices[i]) {
+			printf("Small file: index %d doesn't match\n", i);
+			abort();
+		}
+
+	MeshMaterial mat = result.material;
+	if (!mat.present || !floateq(mat.base_color[0], 0.5f) || !floateq(mat.base_color[1], 0.25f)
+		|| !floateq(mat.base_color[2], 1) || !floateq(mat.metallic, 0) || !floateq(mat.roughness, 0.75f)) {
+		printf("Small file: wrong material\n");
+		abort();
+	}
+	free_mesh_data(&result);
+
+	// Truncating the binary chunk leaves the accessors out of range
+	if (parse_glb(glb.data, glb.size - 8, &result, "truncated")) {
+		printf("Truncated file was accepted\n");
+		abort();
+	}
+
+	free(glb.data);
+	printf("Small file OK\n");
+}
+
+int main(void)
+{
+	const char *pieces[] = {
+		"assets/pieces/pawn.obj",
+		"assets/pieces/rook.obj",
+		"assets/pieces/knight.obj",
+		"assets/pieces/bishop.obj",
+		"assets/pieces/queen.obj",
+		"assets/pieces/king.obj",
+	};
+	for (int i = 0; i < (int) (sizeof(pieces) / sizeof(pieces[0])); i++)
+		compare(pieces[i]);
+
+	test_small();
+	return 0;
+}
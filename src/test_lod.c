@@ -0,0 +1,204 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obj.h"
+#include "mesh.h"
+
+// Checks build_mesh_lods on the piece models: each level must be close
+// to its target number of triangles, stay within a bound of its
+// reported error from the full mesh, and keep the texture seams and
+// the attributes of the input
+
+// Distance allowed from the full mesh, relative to the reported error,
+// plus a small fraction of the size of the model for rounding
+#define ERROR_FACTOR 2.0f
+#define ERROR_SLACK  1e-4f
+
+static Vector3 position_of(Vertex v)
+{
+	return (Vector3) {v.x, v.y, v.z};
+}
+
+static float dot3(Vector3 a, Vector3 b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static Vector3 sub3(Vector3 a, Vector3 b)
+{
+	return (Vector3) {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+// Squared distance of "p" from the triangle "abc" (Ericson, Real-Time
+// Collision Detection 5.1.5)
+static float triangle_distance2(Vector3 p, Vector3 a, Vector3 b, Vector3 c)
+{
+	Vector3 ab = sub3(b, a), ac = sub3(c, a), ap = sub3(p, a);
+	float d1 = dot3(ab, ap), d2 = dot3(ac, ap);
+	Vector3 q;
+	if (d1 <= 0 && d2 <= 0)
+		q = a;
+	else {
+		Vector3 bp = sub3(p, b);
+		float d3 = dot3(ab, bp), d4 = dot3(ac, bp);
+		Vector3 cp = sub3(p, c);
+		float d5 = dot3(ab, cp), d6 = dot3(ac, cp);
+		float vc = d1 * d4 - d3 * d2;
+		float vb = d5 * d2 - d1 * d6;
+		float va = d3 * d6 - d5 * d4;
+		if (d3 >= 0 && d4 <= d3)
+			q = b;
+		else if (d6 >= 0 && d5 <= d6)
+			q = c;
+		else if (vc <= 0 && d1 >= 0 && d3 <= 0)
+			q = combine(a, ab, 1, d1 / (d1 - d3));
+		else if (vb <= 0 && d2 >= 0 && d6 <= 0)
+			q = combine(a, ac, 1, d2 / (d2 - d6));
+		else if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+			q = combine(b, sub3(c, b), 1, (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		else {
+			float denom = 1 / (va + vb + vc);
+			q = combine(combine(a, ab, 1, vb * denom), ac, 1, vc * denom);
+		}
+	}
+	Vector3 d = sub3(p, q);
+	return dot3(d, d);
+}
+
+static float mesh_distance(Vector3 p, VertexArray mesh)
+{
+	float best = INFINITY;
+	for (int i = 0; i + 2 < mesh.size; i += 3) {
+		float d = triangle_distance2(p,
+			position_of(mesh.data[i]),
+			position_of(mesh.data[i+1]),
+			position_of(mesh.data[i+2]));
+		if (d < best)
+			best = d;
+	}
+	return sqrtf(best);
+}
+
+// Orders vertices by normal and texture coordinates, which are stored
+// one after the other
+static int compare_attributes(const void *a, const void *b)
+{
+	return memcmp(&((const Vertex*) a)->nx, &((const Vertex*) b)->nx, 5 * sizeof(float));
+}
+
+static bool same_position(Vertex a, Vertex b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool has_texcoords(VertexArray mesh, Vertex v)
+{
+	for (int i = 0; i < mesh.size; i++)
+		if (same_position(mesh.data[i], v) && mesh.data[i].tx == v.tx && mesh.data[i].ty == v.ty)
+			return true;
+	return false;
+}
+
+static void check(const char *file)
+{
+	VertexArray mesh;
+	if (!load_obj(file, 1, &mesh)) {
+		printf("load_obj failed on '%s'\n", file);
+		abort();
+	}
+
+	MeshLOD lods[MAX_MESH_LODS];
+	int num_lods = build_mesh_lods(mesh, NULL, 0, lods);
+	if (num_lods < 2) {
+		printf("'%s': no simplified levels\n", file);
+		abort();
+	}
+
+	Vector3 lo = position_of(mesh.data[0]), hi = lo;
+	for (int i = 0; i < mesh.size; i++) {
+		lo.x = fminf(lo.x, mesh.data[i].x); hi.x = fmaxf(hi.x, mesh.data[i].x);
+		lo.y = fminf(lo.y, mesh.data[i].y); hi.y = fmaxf(hi.y, mesh.data[i].y);
+		lo.z = fminf(lo.z, mesh.data[i].z); hi.z = fmaxf(hi.z, mesh.data[i].z);
+	}
+	float size = norm_of(sub3(hi, lo));
+
+	// Vertices of the input, to look up the attributes of the simplified
+	// ones
+	Vertex *sorted = malloc(mesh.size * sizeof(Vertex));
+	if (sorted == NULL) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+	memcpy(sorted, mesh.data, mesh.size * sizeof(Vertex));
+	qsort(sorted, mesh.size, sizeof(Vertex), compare_attributes);
+
+	// Corners whose position has other texture coordinates elsewhere
+	VertexArray seams = {0, 0, 0};
+	for (int i = 0; i < mesh.size; i++)
+		for (int j = 0; j < mesh.size; j++)
+			if (same_position(mesh.data[i], mesh.data[j])
+				&& (mesh.data[i].tx != mesh.data[j].tx || mesh.data[i].ty != mesh.data[j].ty)) {
+				append_vertex(&seams, mesh.data[i]);
+				break;
+			}
+
+	int num_triangles = mesh.size / 3;
+	for (int l = 1; l < num_lods; l++) {
+
+		VertexArray lod = lods[l].vertices;
+		int target = num_triangles >> l;
+		if (lod.size / 3 > target + target / 2) {
+			printf("'%s': level %d has %d triangles, target %d\n", file, l, lod.size / 3, target);
+			abort();
+		}
+		if (!(lods[l].error >= lods[l-1].error)) {
+			printf("'%s': level %d has less error than the previous one\n", file, l);
+			abort();
+		}
+
+		float bound = ERROR_FACTOR * lods[l].error + ERROR_SLACK * size;
+		for (int i = 0; i < lod.size; i++) {
+			float d = mesh_distance(position_of(lod.data[i]), mesh);
+			if (d > bound) {
+				printf("'%s': level %d is %f from the full mesh, reported error %f\n", file, l, d, lods[l].error);
+				abort();
+			}
+
+			// Normals and texture coordinates come from the input
+			if (!bsearch(&lod.data[i], sorted, mesh.size, sizeof(Vertex), compare_attributes)) {
+				printf("'%s': level %d has attributes that aren't in the input\n", file, l);
+				abort();
+			}
+		}
+
+		for (int i = 0; i < seams.size; i++)
+			if (!has_texcoords(lod, seams.data[i])) {
+				printf("'%s': level %d lost a seam vertex\n", file, l);
+				abort();
+			}
+
+		printf("'%s': level %d, %d triangles, error %f OK\n", file, l, lod.size / 3, lods[l].error);
+	}
+
+	free_mesh_lods(lods, num_lods);
+	free(seams.data);
+	free(sorted);
+	free(mesh.data);
+}
+
+int main(void)
+{
+	const char *pieces[] = {
+		"assets/pieces/pawn.obj",
+		"assets/pieces/rook.obj",
+		"assets/pieces/knight.obj",
+		"assets/pieces/bishop.obj",
+		"assets/pieces/queen.obj",
+		"assets/pieces/king.obj",
+	};
+	for (int i = 0; i < (int) (sizeof(pieces) / sizeof(pieces[0])); i++)
+		check(pieces[i]);
+	return 0;
+}
@@ -0,0 +1,330 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obj.h"
+#include "mesh.h"
+
+// Checks build_meshlets on every level of the piece models and on an
+// indexed open grid and closed sphere: the meshlets must split the
+// reordered triangles into ranges, small ones must be separate parts
+// of the mesh, and culling a meshlet by its sphere or cone must never drop a
+// triangle that brute force finds in front of a plane or facing the eye
+
+#define NUM_PLANES 2000
+#define NUM_EYES   2000
+
+// Of the size of the model, for rounding
+#define TOLERANCE 1e-4f
+
+static int num_cone_culls;
+
+static Vector3 position_of(Vertex v)
+{
+	return (Vector3) {v.x, v.y, v.z};
+}
+
+static float dot3(Vector3 a, Vector3 b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static Vector3 sub3(Vector3 a, Vector3 b)
+{
+	return (Vector3) {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static float random_float(float lo, float hi)
+{
+	return lo + (hi - lo) * rand() / (float) RAND_MAX;
+}
+
+static Vector3 random_direction(void)
+{
+	Vector3 d;
+	do
+		d = (Vector3) {random_float(-1, 1), random_float(-1, 1), random_float(-1, 1)};
+	while (dot3(d, d) > 1 || dot3(d, d) < 1e-4f);
+	return normalize(d);
+}
+
+static Vertex corner_of(VertexArray vertices, const uint32_t *indices, int i)
+{
+	return vertices.data[indices ? indices[i] : (uint32_t) i];
+}
+
+static int compare_triangles(const void *a, const void *b)
+{
+	return memcmp(a, b, 3 * sizeof(Vertex));
+}
+
+// The triangles as lists of three vertices, sorted
+static Vertex *sorted_triangles(VertexArray vertices, const uint32_t *indices, int num_triangles)
+{
+	Vertex *result = malloc(3 * num_triangles * sizeof(Vertex));
+	if (result == NULL) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+	for (int i = 0; i < 3 * num_triangles; i++)
+		result[i] = corner_of(vertices, indices, i);
+	qsort(result, num_triangles, 3 * sizeof(Vertex), compare_triangles);
+	return result;
+}
+
+static bool share_position(VertexArray vertices, const uint32_t *indices, Meshlet a, Meshlet b)
+{
+	for (int i = 3 * a.first_triangle; i < 3 * (a.first_triangle + a.num_triangles); i++)
+		for (int j = 3 * b.first_triangle; j < 3 * (b.first_triangle + b.num_triangles); j++) {
+			Vertex u = corner_of(vertices, indices, i);
+			Vertex v = corner_of(vertices, indices, j);
+			if (u.x == v.x && u.y == v.y && u.z == v.z)
+				return true;
+		}
+	return false;
+}
+
+static void check(const char *name, VertexArray vertices, uint32_t *indices, int num_indices, bool open)
+{
+	int num_triangles = (indices ? num_indices : vertices.size) / 3;
+	Vertex *before = sorted_triangles(vertices, indices, num_triangles);
+
+	Meshlet *meshlets;
+	int num_meshlets = build_meshlets(vertices, indices, num_indices, &meshlets);
+	if (num_triangles <= MESHLET_MAX_TRIANGLES) {
+		if (num_meshlets != 0) {
+			printf("'%s': %d meshlets for %d triangles\n", name, num_meshlets, num_triangles);
+			abort();
+		}
+		free(before);
+		return;
+	}
+
+	// The triangles are the same, reordered
+	Vertex *after = sorted_triangles(vertices, indices, num_triangles);
+	if (memcmp(before, after, 3 * num_triangles * sizeof(Vertex))) {
+		printf("'%s': the triangles changed\n", name);
+		abort();
+	}
+	free(before);
+	free(after);
+
+	int next = 0;
+	int min_size = MESHLET_MAX_TRIANGLES;
+	int max_size = 0;
+	for (int i = 0; i < num_meshlets; i++) {
+		Meshlet m = meshlets[i];
+		if (m.first_triangle != next || m.num_triangles < 1 || m.num_triangles > MESHLET_MAX_TRIANGLES) {
+			printf("'%s': meshlet %d has triangles %d to %d, expected to start at %d\n",
+				name, i, m.first_triangle, m.first_triangle + m.num_triangles - 1, next);
+			abort();
+		}
+		next += m.num_triangles;
+		if (m.num_triangles < min_size) min_size = m.num_triangles;
+		if (m.num_triangles > max_size) max_size = m.num_triangles;
+
+		if (open && m.cone_cutoff <= 1) {
+			printf("'%s': meshlet %d of an open mesh has a cone\n", name, i);
+			abort();
+		}
+
+		if (m.num_triangles < MESHLET_MIN_TRIANGLES)
+			for (int j = 0; j < num_meshlets; j++)
+				if (j != i && share_position(vertices, indices, m, meshlets[j])) {
+					printf("'%s': meshlet %d has %d triangles, but touches meshlet %d\n",
+						name, i, m.num_triangles, j);
+					abort();
+				}
+	}
+	if (next != num_triangles) {
+		printf("'%s': the meshlets have %d triangles, expected %d\n", name, next, num_triangles);
+		abort();
+	}
+
+	Vector3 lo = position_of(vertices.data[0]), hi = lo;
+	for (int i = 0; i < vertices.size; i++) {
+		lo.x = fminf(lo.x, vertices.data[i].x); hi.x = fmaxf(hi.x, vertices.data[i].x);
+		lo.y = fminf(lo.y, vertices.data[i].y); hi.y = fmaxf(hi.y, vertices.data[i].y);
+		lo.z = fminf(lo.z, vertices.data[i].z); hi.z = fmaxf(hi.z, vertices.data[i].z);
+	}
+	Vector3 center = {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2};
+	float size = norm_of(sub3(hi, lo));
+	float tolerance = TOLERANCE * size;
+
+	// Frustum culling: a meshlet whose sphere is behind a plane must
+	// have all of its vertices behind it
+	for (int n = 0; n < NUM_PLANES; n++) {
+		Vector3 normal = random_direction();
+		Vector3 point = combine(center, random_direction(), 1, random_float(0, size / 2));
+		float d = -dot3(normal, point);
+
+		for (int i = 0; i < num_meshlets; i++) {
+			Meshlet m = meshlets[i];
+			if (dot3(normal, m.center) + d >= -m.radius)
+				continue;
+			for (int k = 3 * m.first_triangle; k < 3 * (m.first_triangle + m.num_triangles); k++)
+				if (dot3(normal, position_of(corner_of(vertices, indices, k))) + d > tolerance) {
+					printf("'%s': meshlet %d was culled by a plane it crosses\n", name, i);
+					abort();
+				}
+		}
+	}
+
+	// Cone culling: every triangle of a culled meshlet must face away
+	// from the eye, with normals facing like the vertex normals
+	for (int n = 0; n < NUM_EYES; n++) {
+		Vector3 eye = combine(center, random_direction(), 1, random_float(0, 1.5f * size));
+
+		for (int i = 0; i < num_meshlets; i++) {
+			Meshlet m = meshlets[i];
+			if (m.cone_cutoff > 1)
+				continue;
+			Vector3 d = sub3(m.cone_apex, eye);
+			if (dot3(m.cone_axis, d) < m.cone_cutoff * norm_of(d))
+				continue;
+			num_cone_culls++;
+
+			for (int t = m.first_triangle; t < m.first_triangle + m.num_triangles; t++) {
+				Vertex v[3];
+				for (int k = 0; k < 3; k++)
+					v[k] = corner_of(vertices, indices, 3 * t + k);
+				Vector3 a = position_of(v[0]);
+				Vector3 normal = cross(sub3(position_of(v[1]), a), sub3(position_of(v[2]), a));
+				float len = norm_of(normal);
+				if (len == 0)
+					continue;
+				Vector3 shading = {v[0].nx + v[1].nx + v[2].nx, v[0].ny + v[1].ny + v[2].ny, v[0].nz + v[1].nz + v[2].nz};
+				if (dot3(normal, shading) < 0)
+					len = -len;
+				if (dot3(normal, sub3(eye, a)) / len > tolerance) {
+					printf("'%s': meshlet %d was culled with triangle %d facing the eye\n", name, i, t);
+					abort();
+				}
+			}
+		}
+	}
+
+	printf("'%s': %d triangles, %d meshlets of %d to %d OK\n", name, num_triangles, num_meshlets, min_size, max_size);
+	free(meshlets);
+}
+
+static void check_piece(const char *file, bool open)
+{
+	VertexArray mesh;
+	if (!load_obj(file, 1, &mesh)) {
+		printf("load_obj failed on '%s'\n", file);
+		abort();
+	}
+
+	MeshLOD lods[MAX_MESH_LODS];
+	int num_lods = build_mesh_lods(mesh, NULL, 0, lods);
+	for (int l = 0; l < num_lods; l++) {
+		char name[256];
+		snprintf(name, sizeof(name), "%s level %d", file, l);
+		check(name, lods[l].vertices, NULL, 0, open);
+	}
+
+	free_mesh_lods(lods, num_lods);
+	free(mesh.data);
+}
+
+// A wavy square of "n" by "n" cells, indexed
+static void check_grid(int n)
+{
+	VertexArray vertices = {0, 0, 0};
+	for (int j = 0; j <= n; j++)
+		for (int i = 0; i <= n; i++) {
+			float x = (float) i / n, z = (float) j / n;
+			float y = 0.05f * sinf(6 * x) * cosf(5 * z);
+			append_vertex(&vertices, (Vertex) {x, y, z, 0, 1, 0, x, z});
+		}
+
+	int num_indices = 6 * n * n;
+	uint32_t *indices = malloc(num_indices * sizeof(uint32_t));
+	if (indices == NULL) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+	int k = 0;
+	for (int j = 0; j < n; j++)
+		for (int i = 0; i < n; i++) {
+			uint32_t a = j * (n + 1) + i, b = a + 1, c = a + n + 1, d = c + 1;
+			uint32_t quad[6] = {a, c, b, b, c, d};
+			memcpy(&indices[k], quad, sizeof(quad));
+			k += 6;
+		}
+
+	check("grid", vertices, indices, num_indices, true);
+	free(indices);
+	free(vertices.data);
+}
+
+// A sphere of "rings" rings of "segments" quads, with a single vertex at
+// each pole so that it's closed, indexed
+static void check_sphere(int rings, int segments)
+{
+	VertexArray vertices = {0, 0, 0};
+	append_vertex(&vertices, (Vertex) {0, 1, 0, 0, 1, 0, 0, 0});
+	for (int j = 1; j < rings; j++)
+		for (int i = 0; i < segments; i++) {
+			float theta = 3.14159265f * j / rings, phi = 2 * 3.14159265f * i / segments;
+			Vector3 p = {sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)};
+			append_vertex(&vertices, (Vertex) {p.x, p.y, p.z, p.x, p.y, p.z, 0, 0});
+		}
+	append_vertex(&vertices, (Vertex) {0, -1, 0, 0, -1, 0, 0, 0});
+	uint32_t bottom = vertices.size - 1;
+
+	int num_indices = 6 * segments * (rings - 1);
+	uint32_t *indices = malloc(num_indices * sizeof(uint32_t));
+	if (indices == NULL) {
+		printf("OUT OF MEMORY\n");
+		abort();
+	}
+	int k = 0;
+	for (int i = 0; i < segments; i++) {
+		uint32_t a = 1 + i, b = 1 + (i + 1) % segments;
+		uint32_t top[3] = {0, b, a};
+		memcpy(&indices[k], top, sizeof(top));
+		k += 3;
+		uint32_t c = 1 + (rings - 2) * segments + i, d = 1 + (rings - 2) * segments + (i + 1) % segments;
+		uint32_t low[3] = {bottom, c, d};
+		memcpy(&indices[k], low, sizeof(low));
+		k += 3;
+	}
+	for (int j = 1; j < rings - 1; j++)
+		for (int i = 0; i < segments; i++) {
+			uint32_t a = 1 + (j - 1) * segments + i, b = 1 + (j - 1) * segments + (i + 1) % segments;
+			uint32_t c = a + segments, d = b + segments;
+			uint32_t quad[6] = {a, b, c, b, d, c};
+			memcpy(&indices[k], quad, sizeof(quad));
+			k += 6;
+		}
+
+	check("sphere", vertices, indices, num_indices, false);
+	free(indices);
+	free(vertices.data);
+}
+
+int main(void)
+{
+	srand(1);
+
+	// The knight and the king aren't closed
+	check_piece("assets/pieces/pawn.obj",   false);
+	check_piece("assets/pieces/rook.obj",   false);
+	check_piece("assets/pieces/knight.obj", true);
+	check_piece("assets/pieces/bishop.obj", false);
+	check_piece("assets/pieces/queen.obj",  false);
+	check_piece("assets/pieces/king.obj",   true);
+
+	check_grid(40);
+	check_sphere(24, 32);
+
+	if (num_cone_culls == 0) {
+		printf("No meshlet was ever cone culled\n");
+		abort();
+	}
+	printf("%d cone culls OK\n", num_cone_culls);
+	return 0;
+}
@@ -0,0 +1,183 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TINYOBJ_LOADER_C_IMPLEMENTATION
+#include "tinyobj_loader_c.h"
+
+#include "utils.h"
+#include "obj.h"
+
+// Checks load_obj against tinyobj on the piece models and on generated
+// files large enough to be split in many chunks
+
+static void get_file_data(void *context, const char *filename, const int is_mtl,
+	const char *obj_filename, char **data, size_t *len)
+{
+	(void) is_mtl;
+	(void) obj_filename;
+
+	char **loaded = context;
+	*data = NULL;
+	*len  = 0;
+	if (is_mtl)
+		return;
+	*data = load_file(filename, len);
+	*loaded = *data;
+}
+
+// Expands the faces parsed by tinyobj in the same layout as load_obj
+static VertexArray load_reference(const char *file)
+{
+	tinyobj_attrib_t attrib;
+	tinyobj_shape_t *shapes;
+	tinyobj_material_t *materials;
+	size_t num_shapes, num_materials;
+	char *data = NULL;
+
+	if (tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials, &num_materials,
+			file, get_file_data, &data, TINYOBJ_FLAG_TRIANGULATE) != TINYOBJ_SUCCESS) {
+		printf("tinyobj couldn't load '%s'\n", file);
+		abort();
+	}
+
+	VertexArray result = {0, 0, 0};
+	for (unsigned int i = 0; i < attrib.num_faces; i++) {
+		tinyobj_vertex_index_t idx = attrib.faces[i];
+		Vertex v;
+		v.x  = attrib.vertices[3 * idx.v_idx + 0];
+		v.y  = attrib.vertices[3 * idx.v_idx + 1];
+		v.z  = attrib.vertices[3 * idx.v_idx + 2];
+		v.nx = attrib.normals[3 * idx.vn_idx + 0];
+		v.ny = attrib.normals[3 * idx.vn_idx + 1];
+		v.nz = attrib.normals[3 * idx.vn_idx + 2];
+		v.tx = attrib.texcoords[2 * idx.vt_idx + 0];
+		v.ty = attrib.texcoords[2 * idx.vt_idx + 1];
+		append_vertex(&result, v);
+	}
+
+	free(data);
+	tinyobj_attrib_free(&attrib);
+	tinyobj_shapes_free(shapes, num_shapes);
+	tinyobj_materials_free(materials, num_materials);
+	return result;
+}
+
+static bool floateq(float a, float b)
+{
+	return fabsf(a - b) <= 1e-6f * fmaxf(1, fabsf(a));
+}
+
+static void compare(const char *file, int num_threads)
+{
+	VertexArray expected = load_reference(file);
+
+	VertexArray result;
+	if (!load_obj(file, num_threads, &result)) {
+		printf("load_obj failed on '%s'\n", file);
+		abort();
+	}
+
+	if (result.size != expected.size) {
+		printf("'%s' (%d threads): %d vertices, expected %d\n", file, num_threads, result.size, expected.size);
+		abort();
+	}
+
+	for (int i = 0; i < result.size; i++) {
+		Vertex a = result.data[i];
+		Vertex b = expected.data[i];
+		if (!floateq(a.x, b.x) || !floateq(a.y, b.y) || !floateq(a.z, b.z)
+			|| !floateq(a.nx, b.nx) || !floateq(a.ny, b.ny) || !floateq(a.nz, b.nz)
+			|| !floateq(a.tx, b.tx) || !floateq(a.ty, b.ty)) {
+			printf("'%s' (%d threads): vertex %d doesn't match\n", file, num_threads, i);
+			abort();
+		}
+	}
+
+	printf("'%s' (%d threads): %d vertices OK\n", file, num_threads, result.size);
+	free(result.data);
+	free(expected.data);
+}
+
+// A grid of quads, using relative indices every other row
+static void write_grid(const char *file, int n)
+{
+	FILE *stream = fopen(file, "w");
+	if (stream == NULL) {
+		printf("Couldn't write '%s'\n", file);
+		abort();
+	}
+
+	fprintf(stream, "# generated\no grid\n");
+	for (int i = 0; i <= n; i++)
+		for (int j = 0; j <= n; j++) {
+			fprintf(stream, "v %f %.7e %g\n", i * 0.37f, sinf(i * j * 0.01f), -j * 1.5f);
+			fprintf(stream, "vt %f %f\n", (float) i / n, (float) j / n);
+			fprintf(stream, "vn 0 1 0\n");
+		}
+
+	for (int i = 0; i < n; i++)
+		for (int j = 0; j < n; j++) {
+			int a = i * (n + 1) + j + 1;
+			int b = a + 1;
+			int c = a + n + 2;
+			int d = a + n + 1;
+			if (i & 1) {
+				int total = (n + 1) * (n + 1);
+				a -= total + 1; b -= total + 1; c -= total + 1; d -= total + 1;
+			}
+			fprintf(stream, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+		}
+
+	fclose(stream);
+}
+
+// Corners without normals get the normal of the face
+static void test_face_normals(void)
+{
+	const char *file = "test_obj_normals.obj";
+	FILE *stream = fopen(file, "w");
+	fprintf(stream, "v 0 0 0\nv 1 0 0\nv 0 0 -1\nvt 0 0\nf 1 2 3\nf 1/1 2/1 3/1\n");
+	fclose(stream);
+
+	VertexArray result;
+	if (!load_obj(file, 1, &result) || result.size != 6) {
+		printf("Couldn't load '%s'\n", file);
+		abort();
+	}
+	for (int i = 0; i < result.size; i++)
+		if (!floateq(result.data[i].nx, 0) || !floateq(result.data[i].ny, 1) || !floateq(result.data[i].nz, 0)) {
+			printf("Wrong face normal\n");
+			abort();
+		}
+	free(result.data);
+	remove(file);
+	printf("Face normals OK\n");
+}
+
+int main(void)
+{
+	const char *pieces[] = {
+		"assets/pieces/pawn.obj",
+		"assets/pieces/rook.obj",
+		"assets/pieces/knight.obj",
+		"assets/pieces/bishop.obj",
+		"assets/pieces/queen.obj",
+		"assets/pieces/king.obj",
+	};
+	for (int i = 0; i < (int) (sizeof(pieces) / sizeof(pieces[0])); i++) {
+		compare(pieces[i], 1);
+		compare(pieces[i], 4);
+	}
+
+	const char *grid = "test_obj_grid.obj";
+	write_grid(grid, 300);
+	compare(grid, 1);
+	compare(grid, 3);
+	compare(grid, OBJ_MAX_THREADS);
+	remove(grid);
+
+	test_face_normals();
+	return 0;
+}
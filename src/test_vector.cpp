@@ -321,6 +321,26 @@ int main(void)
 
 			TEST(my_final_vector, expected_final_vector);
 		}
+
+		// --- transform --- //
+		{
+			Vector3 pos = random_vec3();
+			Vector3 scale = random_vec3();
+			Vector3 rotate = {angle, angle / 2, angle / 4};
+
+			Matrix4 my_m = transform_matrix(pos, scale, rotate);
+			Vector4 my_final_vector = rdotv(my_m, starting_vector);
+
+			glm::mat4 glm_m(1);
+			glm_m = glm::translate(glm_m, vec3toglm(pos));
+			glm_m = glm::scale(glm_m, vec3toglm(scale));
+			glm_m = glm::rotate(glm_m, rotate.x, glm::vec3(1, 0, 0));
+			glm_m = glm::rotate(glm_m, rotate.y, glm::vec3(0, 1, 0));
+			glm_m = glm::rotate(glm_m, rotate.z, glm::vec3(0, 0, 1));
+			glm::vec4 expected_final_vector = glm_m * vec4toglm(starting_vector);
+
+			TEST(my_final_vector, expected_final_vector);
+		}
 	}
 
 	return 0;
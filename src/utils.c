@@ -1,5 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "utils.h"
 
 char *load_file(const char *file, size_t *size)
@@ -29,3 +37,211 @@ char *load_file(const char *file, size_t *size)
     if (size) *size = size2;
     return dst;
 }
+
+static int compare_floats(const void *a, const void *b)
+{
+    float x = *(const float*) a;
+    float y = *(const float*) b;
+    return (x > y) - (x < y);
+}
+
+TimeSummary summarize_times(float *times, int count)
+{
+    qsort(times, count, sizeof(float), compare_floats);
+
+    double sum = 0;
+    for (int i = 0; i < count; i++)
+        sum += times[i];
+
+    TimeSummary summary;
+    summary.min = times[0];
+    summary.avg = sum / count;
+    summary.p50 = times[(count - 1) * 50 / 100];
+    summary.p95 = times[(count - 1) * 95 / 100];
+    summary.p99 = times[(count - 1) * 99 / 100];
+    summary.max = times[count - 1];
+    return summary;
+}
+
+static MappedFile archive;
+static const ArchiveEntry *archive_entries;
+static uint32_t archive_num_entries;
+
+// "data" is the archive that "entry" belongs to
+static int compare_entry_path(const char *data, const char *path, size_t len, const ArchiveEntry *entry)
+{
+    size_t min = len < entry->path_length ? len : entry->path_length;
+    int c = memcmp(path, data + entry->path_offset, min);
+    if (c) return c;
+    if (len < entry->path_length) return -1;
+    if (len > entry->path_length) return 1;
+    return 0;
+}
+
+static const ArchiveEntry *find_archive_entry(const char *path)
+{
+    // Archives are packed with paths relative to the working directory
+    while (path[0] == '.' && path[1] == '/')
+        path += 2;
+
+    size_t len = strlen(path);
+    uint32_t lo = 0;
+    uint32_t hi = archive_num_entries;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = compare_entry_path(archive.data, path, len, &archive_entries[mid]);
+        if (c == 0) return &archive_entries[mid];
+        if (c < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return NULL;
+}
+
+static bool check_archive(const MappedFile *file)
+{
+    if (file->size < sizeof(ArchiveHeader))
+        return false;
+
+    ArchiveHeader header;
+    memcpy(&header, file->data, sizeof(header));
+    if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)))
+        return false;
+
+    if (header.num_entries > (file->size - sizeof(header)) / sizeof(ArchiveEntry))
+        return false;
+
+    const ArchiveEntry *entries = (const ArchiveEntry*) (file->data + sizeof(header));
+    for (uint32_t i = 0; i < header.num_entries; i++) {
+        ArchiveEntry e = entries[i];
+        if (e.path_offset > file->size || e.path_length > file->size - e.path_offset)
+            return false;
+        if (e.data_offset > file->size || e.data_size > file->size - e.data_offset)
+            return false;
+
+        // find_archive_entry does a binary search, which would silently
+        // miss paths of an unsorted table
+        if (i > 0) {
+            ArchiveEntry prev = entries[i-1];
+            if (compare_entry_path(file->data, file->data + prev.path_offset, prev.path_length, &e) >= 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool mount_archive(const char *file)
+{
+    MappedFile mapped;
+    if (!map_file(file, &mapped))
+        return false;
+
+    // The entry table is read in place
+    if ((uintptr_t) mapped.data % ARCHIVE_ALIGNMENT || !check_archive(&mapped)) {
+        fprintf(stderr, "Invalid archive '%s'\n", file);
+        unmap_file(&mapped);
+        return false;
+    }
+
+    unmount_archive();
+    archive = mapped;
+    archive_entries = (const ArchiveEntry*) (archive.data + sizeof(ArchiveHeader));
+    archive_num_entries = ((const ArchiveHeader*) archive.data)->num_entries;
+    return true;
+}
+
+void unmount_archive(void)
+{
+    archive_entries = NULL;
+    archive_num_entries = 0;
+    unmap_file(&archive);
+}
+
+bool map_file(const char *file, MappedFile *result)
+{
+    const ArchiveEntry *entry = find_archive_entry(file);
+    if (entry) {
+        *result = (MappedFile) {archive.data + entry->data_offset, entry->data_size, false, true};
+        return true;
+    }
+
+#ifndef _WIN32
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        return false;
+    }
+
+    // Pipes and other special files can't be mapped
+    if (S_ISREG(info.st_mode)) {
+
+        size_t size = info.st_size;
+        if (size == 0) {
+            close(fd);
+            *result = (MappedFile) {NULL, 0, false, false};
+            return true;
+        }
+
+        char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data != MAP_FAILED) {
+            // Assets are read front to back, so let the kernel read ahead
+            // aggressively and drop the pages behind
+            posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+            *result = (MappedFile) {data, size, true, false};
+            return true;
+        }
+    } else {
+        close(fd);
+    }
+#endif
+
+    // Read it in chunks, since the size may not be known in advance
+    FILE *stream = fopen(file, "rb");
+    if (stream == NULL) return false;
+
+    char  *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    for (;;) {
+        if (size == capacity) {
+            capacity = capacity ? 2 * capacity : 65536;
+            char *p = realloc(data, capacity);
+            if (p == NULL) {
+                free(data);
+                fclose(stream);
+                return false;
+            }
+            data = p;
+        }
+        size_t n = fread(data + size, 1, capacity - size, stream);
+        size += n;
+        if (n == 0) break;
+    }
+    bool failed = ferror(stream);
+    fclose(stream);
+    if (failed) {
+        free(data);
+        return false;
+    }
+
+    *result = (MappedFile) {data, size, false, false};
+    return true;
+}
+
+void unmap_file(MappedFile *file)
+{
+    // Archived files are owned by the archive
+    if (!file->archived) {
+#ifndef _WIN32
+        if (file->mapped)
+            munmap(file->data, file->size);
+        else
+#endif
+            free(file->data);
+    }
+
+    *file = (MappedFile) {NULL, 0, false, false};
+}
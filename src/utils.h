@@ -1,3 +1,66 @@
+#ifndef UTILS_INCLUDED
+#define UTILS_INCLUDED
+
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+char *load_file(const char *file, size_t *size);
+
+typedef struct {
+    float min, avg, p50, p95, p99, max;
+} TimeSummary;
+
+// Sorts "times" in place. "count" must be positive.
+TimeSummary summarize_times(float *times, int count);
+
+// Read-only contents of a file. Where possible the file is mapped in
+// memory, so pages are read on demand and never copied to the heap,
+// else it's read into a buffer. The data is not null-terminated.
+//
+// If an archive is mounted, files are looked up in it first and the
+// result points into its mapping.
+typedef struct {
+    char  *data;
+    size_t size;
+    bool   mapped;
+    bool   archived;
+} MappedFile;
+
+bool map_file(const char *file, MappedFile *result);
+void unmap_file(MappedFile *file);
+
+// Asset archives bundle many files in one, so that they are all loaded
+// with a single open and mapping. The layout is:
+//
+//   ArchiveHeader
+//   ArchiveEntry[num_entries], sorted by path (byte-wise)
+//   the paths, not null-terminated
+//   the file contents, each aligned to ARCHIVE_ALIGNMENT bytes
+//
+// Offsets are from the start of the archive. Integers are stored in
+// the byte order of the machine that packed it.
+
+#define ARCHIVE_MAGIC "PBRPAK01"
+#define ARCHIVE_ALIGNMENT 16
+
+typedef struct {
+    char     magic[8];
+    uint32_t num_entries;
+    uint32_t reserved;
+} ArchiveHeader;
+
+typedef struct {
+    uint32_t path_offset;
+    uint32_t path_length;
+    uint64_t data_offset;
+    uint64_t data_size;
+} ArchiveEntry;
+
+// Replaces the mounted archive, if any. Paths that aren't in the
+// archive are still read from the disk, which is handy while assets
+// are being edited. Must not be called while files are being mapped.
+bool mount_archive(const char *file);
+void unmount_archive(void);
 
-char *load_file(const char *file, size_t *size);
\ No newline at end of file
+#endif
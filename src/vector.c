@@ -12,6 +12,11 @@ float deg2rad(float deg)
 	return 3.14159265358979323846 * deg / 180;
 }
 
+float rad2deg(float rad)
+{
+	return 180 * rad / 3.14159265358979323846;
+}
+
 float norm2_of(Vector3 v)
 {
 	return v.x * v.x + v.y * v.y + v.z * v.z;
@@ -318,6 +323,26 @@ Matrix4 perspective_matrix(float fov, float aspect, float near, float far)
 	return m;
 }
 
+// Translation, then scale, then rotation around X, Y and Z
+Matrix4 transform_matrix(Vector3 pos, Vector3 scale, Vector3 rotate)
+{
+	Matrix4 m = translate_matrix(pos, 1);
+	m = dotm(m, scale_matrix(scale));
+	m = dotm(m, rotate_matrix_x(rotate.x));
+	m = dotm(m, rotate_matrix_y(rotate.y));
+	m = dotm(m, rotate_matrix_z(rotate.z));
+	return m;
+}
+
+// Matrix that transforms the normals of a mesh transformed by "model"
+Matrix4 normal_matrix(Matrix4 model)
+{
+	Matrix4 inv;
+	if (!invert(model, &inv))
+		return identity_matrix();
+	return transpose(inv);
+}
+
 void print_matrix(Matrix4 m)
 {
 	printf(
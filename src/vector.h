@@ -25,6 +25,7 @@ typedef struct {
 } Matrix3;
 
 float deg2rad(float deg);
+float rad2deg(float rad);
 
 Matrix4 translate_matrix(Vector3 v, float f);
 Matrix4 identity_matrix(void);
@@ -35,6 +36,8 @@ Matrix4 rotate_matrix_z(float angle);
 Matrix4 lookat_matrix(Vector3 pos, Vector3 front, Vector3 up);
 Matrix4 ortho_matrix(float left, float right, float bottom, float top, float near, float far);
 Matrix4 perspective_matrix(float fov, float aspect, float near, float far);
+Matrix4 transform_matrix(Vector3 pos, Vector3 scale, Vector3 rotate);
+Matrix4 normal_matrix(Matrix4 model);
 
 void print_matrix(Matrix4 m);
 